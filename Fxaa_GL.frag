@@ -0,0 +1,126 @@
+#version 330 core
+
+// FXAA over the scene target : where the luma contrast around a pixel
+// says it is on an edge, the edge is followed both ways to find how far
+// the pixel is from its ends, and the pixel is resampled that far across
+// the edge (the linear filter does the blending). Thin features get a
+// sub-pixel blend from the average of the 3x3 neighbourhood.
+in vec2 uv;
+
+uniform sampler2D scene;
+uniform vec2 texelSize;         // 1 / size of the scene texture
+uniform float edgeThreshold;    // contrast that makes an edge, relative to the brightest neighbour
+uniform float edgeThresholdMin; // and absolute, so the dark areas stay untouched
+uniform float subpixel;         // 0 : edges only, 1 : full sub-pixel smoothing
+uniform int searchSteps;        // along the edge, each way
+
+out vec4 color;
+
+float luma (vec3 c)
+{
+    return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+float lumaAt (vec2 p)
+{
+    return luma(textureLod(scene, p, 0.0).rgb);
+}
+
+void main ()
+{
+    vec3 rgbM = textureLod(scene, uv, 0.0).rgb;
+    float lumaM = luma(rgbM);
+    float lumaN = luma(textureLodOffset(scene, uv, 0.0, ivec2(0, 1)).rgb);
+    float lumaS = luma(textureLodOffset(scene, uv, 0.0, ivec2(0, -1)).rgb);
+    float lumaE = luma(textureLodOffset(scene, uv, 0.0, ivec2(1, 0)).rgb);
+    float lumaW = luma(textureLodOffset(scene, uv, 0.0, ivec2(-1, 0)).rgb);
+
+    float lumaMin = min(lumaM, min(min(lumaN, lumaS), min(lumaE, lumaW)));
+    float lumaMax = max(lumaM, max(max(lumaN, lumaS), max(lumaE, lumaW)));
+    float range = lumaMax - lumaMin;
+    if (range < max(edgeThresholdMin, lumaMax * edgeThreshold)) {
+        color = vec4(rgbM, 1);
+        return;
+    }
+
+    float lumaNW = luma(textureLodOffset(scene, uv, 0.0, ivec2(-1, 1)).rgb);
+    float lumaNE = luma(textureLodOffset(scene, uv, 0.0, ivec2(1, 1)).rgb);
+    float lumaSW = luma(textureLodOffset(scene, uv, 0.0, ivec2(-1, -1)).rgb);
+    float lumaSE = luma(textureLodOffset(scene, uv, 0.0, ivec2(1, -1)).rgb);
+
+    // horizontal or vertical edge, from the second differences of the rows and columns
+    float lumaNS = lumaN + lumaS;
+    float lumaWE = lumaW + lumaE;
+    float lumaWest = lumaNW + lumaSW;
+    float lumaEast = lumaNE + lumaSE;
+    float lumaNorth = lumaNW + lumaNE;
+    float lumaSouth = lumaSW + lumaSE;
+    float edgeHorizontal = abs(lumaWest - 2.0*lumaW) + 2.0*abs(lumaNS - 2.0*lumaM) + abs(lumaEast - 2.0*lumaE);
+    float edgeVertical = abs(lumaSouth - 2.0*lumaS) + 2.0*abs(lumaWE - 2.0*lumaM) + abs(lumaNorth - 2.0*lumaN);
+    bool horizontal = edgeHorizontal >= edgeVertical;
+
+    // the side of the pixel the edge runs on : the steeper neighbour
+    float luma1 = horizontal ? lumaS : lumaW;
+    float luma2 = horizontal ? lumaN : lumaE;
+    float gradient1 = luma1 - lumaM;
+    float gradient2 = luma2 - lumaM;
+    bool steepest1 = abs(gradient1) >= abs(gradient2);
+    float gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+    float stepLength = horizontal ? texelSize.y : texelSize.x;
+    float lumaLocal;
+    if (steepest1) {
+        stepLength = -stepLength;
+        lumaLocal = 0.5 * (luma1 + lumaM);
+    }
+    else
+        lumaLocal = 0.5 * (luma2 + lumaM);
+
+    // walk along the edge, half a pixel over, until the luma leaves it
+    vec2 edgeUv = uv;
+    if (horizontal)
+        edgeUv.y += 0.5 * stepLength;
+    else
+        edgeUv.x += 0.5 * stepLength;
+    vec2 along = horizontal ? vec2(texelSize.x, 0) : vec2(0, texelSize.y);
+    vec2 uv1 = edgeUv - along, uv2 = edgeUv + along;
+    float end1 = lumaAt(uv1) - lumaLocal;
+    float end2 = lumaAt(uv2) - lumaLocal;
+    bool reached1 = abs(end1) >= gradientScaled;
+    bool reached2 = abs(end2) >= gradientScaled;
+    for (int i=1; i<searchSteps && !(reached1 && reached2); i++) {
+        // longer strides once the edge turns out to be long
+        float stride = i < 3 ? 1.0 : i < 6 ? 1.5 : i < 9 ? 2.0 : 4.0;
+        if (!reached1) {
+            uv1 -= along * stride;
+            end1 = lumaAt(uv1) - lumaLocal;
+            reached1 = abs(end1) >= gradientScaled;
+        }
+        if (!reached2) {
+            uv2 += along * stride;
+            end2 = lumaAt(uv2) - lumaLocal;
+            reached2 = abs(end2) >= gradientScaled;
+        }
+    }
+
+    // the nearer end decides, when its luma varies the way this pixel does
+    float distance1 = horizontal ? uv.x - uv1.x : uv.y - uv1.y;
+    float distance2 = horizontal ? uv2.x - uv.x : uv2.y - uv.y;
+    bool nearer1 = distance1 < distance2;
+    float offset = 0.5 - min(distance1, distance2) / (distance1 + distance2);
+    bool centerSmaller = lumaM < lumaLocal;
+    if (((nearer1 ? end1 : end2) < 0.0) == centerSmaller)
+        offset = 0.0;
+
+    // sub-pixel : how much the pixel stands out of its neighbourhood
+    float lumaAverage = (2.0 * (lumaNS + lumaWE) + lumaWest + lumaEast) / 12.0;
+    float blend = clamp(abs(lumaAverage - lumaM) / range, 0.0, 1.0);
+    blend = (-2.0 * blend + 3.0) * blend * blend;
+    offset = max(offset, blend * blend * subpixel);
+
+    vec2 finalUv = uv;
+    if (horizontal)
+        finalUv.y += offset * stepLength;
+    else
+        finalUv.x += offset * stepLength;
+    color = vec4(textureLod(scene, finalUv, 0.0).rgb, 1);
+}
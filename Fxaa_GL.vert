@@ -0,0 +1,11 @@
+#version 330 core
+
+// Full screen triangle, no vertex buffer : vertices 0, 1, 2 cover
+// (0,0) (2,0) (0,2) in texture coordinates, the screen is its lower left quarter
+out vec2 uv;
+
+void main ()
+{
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0, 1);
+}
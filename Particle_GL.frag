@@ -0,0 +1,15 @@
+#version 330 core
+
+in vec3 fragColor;
+in float fade;
+
+out vec4 color;
+
+void main ()
+{
+    // round points, fading out with their life
+    vec2 p = gl_PointCoord * 2.0 - 1.0;
+    if (dot(p, p) > 1.0)
+        discard;
+    color = vec4(fragColor, fade);
+}
@@ -0,0 +1,25 @@
+#version 330 core
+
+// Drawing of the particle buffer Particle_Update.vert wrote last
+layout (location = 0) in vec3 position;
+layout (location = 2) in vec2 life;     // seconds left, seconds at birth
+layout (location = 3) in vec3 color;
+
+uniform mat4 VP;
+// framebuffer height in pixels, the points have a size in world units
+uniform float viewportHeight;
+
+out vec3 fragColor;
+out float fade;
+
+void main ()
+{
+    fragColor = color;
+    fade = clamp(life.x / max(life.y, 0.001), 0.0, 1.0);
+    gl_Position = VP * vec4(position, 1);
+    gl_PointSize = viewportHeight * 0.04 / max(gl_Position.w, 0.1);
+
+    // dead : outside of the clip volume
+    if (life.x <= 0.0)
+        gl_Position = vec4(2, 2, 2, 1);
+}
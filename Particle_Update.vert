@@ -0,0 +1,55 @@
+#version 330 core
+
+// Particle simulation : one vertex per particle, drawn as points with the
+// rasterizer off, the outputs are captured by transform feedback into the
+// other buffer of the pair
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 velocity;
+layout (location = 2) in vec2 life;     // seconds left, seconds at birth
+layout (location = 3) in vec3 color;
+
+uniform float dt;
+uniform vec3 gravity;
+
+// the particles emitStart .. emitStart + emitCount - 1 (wrapping around
+// particleCount) are born again this step, emitCount is 0 without a burst
+uniform int emitStart;
+uniform int emitCount;
+uniform int particleCount;
+uniform vec3 emitOrigin;
+uniform vec3 emitVelocity;   // mean launch velocity
+uniform float emitSpread;    // random part of the velocity
+uniform float emitLife;      // longest life, in seconds
+uniform vec3 emitColor;
+uniform float seed;          // changes with every burst
+
+out vec3 outPosition;
+out vec3 outVelocity;
+out vec2 outLife;
+out vec3 outColor;
+
+float hash (float n)
+{
+    return fract(sin(n) * 43758.5453);
+}
+
+void main ()
+{
+    int slot = (gl_VertexID - emitStart + particleCount) % particleCount;
+    if (slot < emitCount) {
+        float n = float(gl_VertexID) * 0.618 + seed;
+        vec3 r = vec3(hash(n), hash(n + 17.0), hash(n + 31.0)) * 2.0 - 1.0;
+        float l = emitLife * (0.5 + 0.5 * hash(n + 47.0));
+        outPosition = emitOrigin + r * vec3(0.4, 0.2, 0.4);
+        outVelocity = emitVelocity + r * emitSpread;
+        outLife = vec2(l, l);
+        outColor = emitColor * (0.75 + 0.5 * hash(n + 59.0));
+        return;
+    }
+
+    // dead particles keep falling, nobody sees them
+    outVelocity = velocity + gravity * dt;
+    outPosition = position + outVelocity * dt;
+    outLife = vec2(life.x - dt, life.y);
+    outColor = color;
+}
@@ -2,13 +2,88 @@
 
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
+in vec3 localPos;
+
+// 0 : use the vertex color, otherwise the tile type from map1
+// (1 normal, 3 fragile, 4 bridge, 5 switch)
+flat in int tileType;
 
 // output data
 out vec3 color;
 
+// Half size of the tile slab in model space
+const vec3 halfSize = vec3(0.5, 0.1, 0.5);
+
+// Face color of a tile, face is 0..5 for +x,-x,+y,-y,+z,-z
+vec3 faceColor (int type, int face)
+{
+    if (type == 3)
+        return vec3(1.0, 0.5, 0.0);
+    if (type == 4 || type == 5)
+        return vec3(0.2, 0.2, 0.0);
+
+    // normal tiles keep one color per face
+    if (face == 0) return vec3(1.0, 0.0, 1.0);
+    if (face == 1) return vec3(1.0, 0.0, 0.0);
+    if (face == 2) return vec3(0.0, 1.0, 0.0);
+    if (face == 3) return vec3(0.0, 0.0, 1.0);
+    if (face == 4) return vec3(1.0, 1.0, 0.0);
+    return vec3(0.0, 1.0, 1.0);
+}
+
 void main()
 {
-    // Output color = color specified in the vertex shader,
-    // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
+    if (tileType == 0) {
+        // Output color = color specified in the vertex shader,
+        // interpolated between all 3 surrounding vertices of the triangle
+        color = fragColor;
+        return;
+    }
+
+    // The little flag on top of every tile
+    if (localPos.y > halfSize.y + 0.001) {
+        color = vec3((localPos.y - halfSize.y) / 0.15);
+        return;
+    }
+
+    // The face is the axis on which the point touches the slab
+    vec3 d = halfSize - abs(localPos);
+    int face;
+    vec2 uv, extent;
+    if (d.x <= d.y && d.x <= d.z) {
+        face = localPos.x > 0.0 ? 0 : 1;
+        uv = localPos.zy; extent = halfSize.zy;
+    }
+    else if (d.y <= d.z) {
+        face = localPos.y > 0.0 ? 2 : 3;
+        uv = localPos.xz; extent = halfSize.xz;
+    }
+    else {
+        face = localPos.z > 0.0 ? 4 : 5;
+        uv = localPos.xy; extent = halfSize.xy;
+    }
+
+    vec3 base = faceColor(tileType, face);
+
+    // Distance to the closest edge of this face
+    vec2 edge = extent - abs(uv);
+    float dist = min(edge.x, edge.y);
+
+    // Bevel : lit on the edges facing -x/+z, shaded on the others
+    float bevel = 1.0 - smoothstep(0.0, 0.08, dist);
+    float side = (edge.x < edge.y) ? sign(uv.x) : -sign(uv.y);
+    base *= 1.0 - 0.35 * bevel * side;
+
+    // Thin highlight along the edges
+    float highlight = 1.0 - smoothstep(0.0, 0.015, dist);
+    base = mix(base, vec3(1.0), highlight);
+
+    // Switches get a ring painted on their top face
+    if (tileType == 5 && face == 2) {
+        float r = length(localPos.xz);
+        if (r > 0.2 && r < 0.28)
+            base = vec3(1.0, 1.0, 1.0);
+    }
+
+    color = base;
 }
@@ -3,11 +3,38 @@
 // input data : sent from main program
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
+// per instance : model matrix and tile type
+// (identity and 0 for objects drawn without instances)
+layout (location = 2) in mat4 instanceModel;
+layout (location = 6) in float instanceType;
 
+// view projection, the model part comes from instanceModel
 uniform mat4 MVP;
 
+// roll of the block over one of its bottom edges, set once per move : the
+// block turns from its pose before the move (rollFrom) by rollAngle
+// around the edge through rollPivot along rollAxis, shifted by up to
+// rollOffset, until it lands on instanceModel rollDuration after its start
+uniform int rolling;            // 1 while the block is drawn
+uniform mat4 rollFrom;
+uniform vec3 rollPivot;
+uniform vec3 rollAxis;
+uniform vec3 rollOffset;
+uniform float rollAngle;
+uniform float rollDuration;
+uniform float rollElapsed;      // seconds since the roll started, from the CPU clock
+
 // output data : used by fragment shader
 out vec3 fragColor;
+out vec3 localPos;
+flat out int tileType;
+
+// v turned by angle around the unit vector k (Rodrigues)
+vec3 rotate (vec3 v, vec3 k, float angle)
+{
+    float c = cos(angle), s = sin(angle);
+    return v*c + cross(k, v)*s + k*dot(k, v)*(1.0 - c);
+}
 
 void main ()
 {
@@ -15,8 +42,20 @@ void main ()
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
+    // (floor tiles have no color stream, the fragment shader colors them)
     fragColor = vertexColor;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Model space position, used to find the face and its edges
+    localPos = vertexPosition;
+    tileType = int(instanceType + 0.5);
+
+    vec4 world = instanceModel * v;
+    float t = rolling == 1 && rollDuration > 0.0 ? rollElapsed / rollDuration : 1.0;
+    if (t < 1.0) {
+        t = smoothstep(0.0, 1.0, max(t, 0.0));
+        world = vec4(rollPivot + rotate((rollFrom * v).xyz - rollPivot, rollAxis, rollAngle * t) + rollOffset * t, 1);
+    }
+
+    // Output position of the vertex, in clip space : MVP * model * position
+    gl_Position = MVP * world;
 }
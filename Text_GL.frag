@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec2 uv;
+in vec3 fragColor;
+
+// glyph atlas, one channel, set texels are 1
+uniform sampler2D glyphs;
+
+out vec3 color;
+
+void main ()
+{
+    if (texture(glyphs, uv).r < 0.5)
+        discard;
+    color = fragColor;
+}
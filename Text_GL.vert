@@ -0,0 +1,21 @@
+#version 330 core
+
+// HUD text : one quad per glyph, positions in window pixels from the top left
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec2 vertexUV;
+layout (location = 2) in vec3 vertexColor;
+
+// window size in pixels
+uniform vec2 screenSize;
+
+out vec2 uv;
+out vec3 fragColor;
+
+void main ()
+{
+    uv = vertexUV;
+    fragColor = vertexColor;
+
+    vec2 ndc = vertexPosition / screenSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0, 1);
+}
@@ -0,0 +1,297 @@
+#include <bits/stdc++.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <immintrin.h>
+
+#include "batchenv.h"
+#include "logic.h"
+
+using namespace std;
+
+struct BatchEnv {
+    int n;
+    vector<int32_t> x2, z2, state, level, bridge, moves;
+    bool simd;
+
+    // block_moves packed for the SIMD lookup, indexed state*4 + key-1 :
+    // (dx2+8) | (dz2+8) << 4 | new state << 8
+    int32_t packed_moves[16];
+
+    // worker threads, each runs one slice of the games per step
+    int threads;
+    vector<thread> workers;
+    mutex lock;
+    condition_variable start_cv, done_cv;
+    int generation, remaining;
+    bool quit;
+    const int32_t* actions;
+    float* rewards;
+    uint8_t* done;
+};
+
+static bool cpuHasAvx2 ()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/* Reference path : the rules of stepGame, one game at a time */
+static void stepScalar (BatchEnv* env, int begin, int end)
+{
+    for (int i=begin; i<end; i++) {
+        GameState g = { env->x2[i], env->z2[i], env->state[i], env->level[i], env->bridge[i], env->moves[i] };
+        int support = stepGame(g, env->actions[i]);
+
+        float reward = REWARD_STEP;
+        if (support != SUPPORT_OK) {
+            reward = support == SUPPORT_GOAL ? REWARD_WIN : REWARD_FALL;
+            resetGame(g, g.level);
+            g.moves = 0;
+        }
+        env->rewards[i] = reward;
+        env->done[i] = support != SUPPORT_OK;
+
+        env->x2[i] = g.x2;
+        env->z2[i] = g.z2;
+        env->state[i] = g.state;
+        env->bridge[i] = g.bridge;
+        env->moves[i] = g.moves;
+    }
+}
+
+/* (int) of a half tile position, truncated towards zero */
+__attribute__((target("avx2")))
+static inline __m256i halfTile (__m256i v)
+{
+    return _mm256_srai_epi32(_mm256_add_epi32(v, _mm256_srli_epi32(v, 31)), 1);
+}
+
+/* map1 tile under 8 blocks, empty outside of the board */
+__attribute__((target("avx2")))
+static inline __m256i gatherTiles (__m256i x2, __m256i z2, __m256i level)
+{
+    __m256i x = halfTile(x2), z = halfTile(z2);
+    __m256i minus1 = _mm256_set1_epi32(-1);
+    __m256i inside = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpgt_epi32(x, minus1), _mm256_cmpgt_epi32(_mm256_set1_epi32(LEVEL_ROWS), x)),
+        _mm256_and_si256(_mm256_cmpgt_epi32(z, minus1), _mm256_cmpgt_epi32(_mm256_set1_epi32(LEVEL_COLS), z)));
+    __m256i index = _mm256_add_epi32(
+        _mm256_mullo_epi32(level, _mm256_set1_epi32(LEVEL_ROWS*LEVEL_COLS)),
+        _mm256_add_epi32(_mm256_mullo_epi32(x, _mm256_set1_epi32(LEVEL_COLS)), z));
+    index = _mm256_and_si256(index, inside);
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), &map1[0][0][0], index, inside, 4);
+}
+
+/* Same rules as stepScalar, 8 games per iteration */
+__attribute__((target("avx2")))
+static void stepAvx2 (BatchEnv* env, int begin, int end)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i standing_state = _mm256_set1_epi32(BLOCK_STANDING);
+    const __m256i moves_lo = _mm256_loadu_si256((const __m256i*)env->packed_moves);
+    const __m256i moves_hi = _mm256_loadu_si256((const __m256i*)(env->packed_moves + 8));
+    const __m256i start_x2 = _mm256_setr_epi32(2*initPos[0][0], 2*initPos[1][0], 2*initPos[2][0], 0, 0, 0, 0, 0);
+    const __m256i start_z2 = _mm256_setr_epi32(2*initPos[0][1], 2*initPos[1][1], 2*initPos[2][1], 0, 0, 0, 0, 0);
+
+    int i = begin;
+    for (; i+8<=end; i+=8) {
+        __m256i x2 = _mm256_loadu_si256((const __m256i*)&env->x2[i]);
+        __m256i z2 = _mm256_loadu_si256((const __m256i*)&env->z2[i]);
+        __m256i s = _mm256_loadu_si256((const __m256i*)&env->state[i]);
+        __m256i level = _mm256_loadu_si256((const __m256i*)&env->level[i]);
+        __m256i bridge = _mm256_loadu_si256((const __m256i*)&env->bridge[i]);
+        __m256i moves = _mm256_loadu_si256((const __m256i*)&env->moves[i]);
+        __m256i key = _mm256_loadu_si256((const __m256i*)&env->actions[i]);
+
+        // checkBridges : standing on the switch turns the bridge on
+        __m256i tile = gatherTiles(x2, z2, level);
+        __m256i standing = _mm256_cmpeq_epi32(s, standing_state);
+        __m256i on_switch = _mm256_and_si256(standing, _mm256_cmpeq_epi32(tile, _mm256_set1_epi32(TILE_SWITCH)));
+        bridge = _mm256_or_si256(bridge, _mm256_and_si256(on_switch, one));
+
+        // block_moves lookup, two 8 entry permutes
+        __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(key, _mm256_setzero_si256()),
+                                         _mm256_cmpgt_epi32(_mm256_set1_epi32(KEY_DOWN+1), key));
+        __m256i index = _mm256_and_si256(_mm256_add_epi32(_mm256_slli_epi32(s, 2), _mm256_sub_epi32(key, one)),
+                                         _mm256_set1_epi32(15));
+        __m256i entry = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(moves_lo, index),
+                                           _mm256_permutevar8x32_epi32(moves_hi, index),
+                                           _mm256_cmpgt_epi32(index, _mm256_set1_epi32(7)));
+        entry = _mm256_and_si256(entry, valid);
+
+        __m256i eight = _mm256_set1_epi32(8), nibble = _mm256_set1_epi32(15);
+        __m256i dx2 = _mm256_and_si256(_mm256_sub_epi32(_mm256_and_si256(entry, nibble), eight), valid);
+        __m256i dz2 = _mm256_and_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(entry, 4), nibble), eight), valid);
+        x2 = _mm256_add_epi32(x2, dx2);
+        z2 = _mm256_add_epi32(z2, dz2);
+        s = _mm256_blendv_epi8(s, _mm256_srli_epi32(entry, 8), valid);
+        moves = _mm256_sub_epi32(moves, valid);
+
+        // blockSupport
+        tile = gatherTiles(x2, z2, level);
+        standing = _mm256_cmpeq_epi32(s, standing_state);
+        __m256i win = _mm256_and_si256(standing, _mm256_cmpeq_epi32(tile, _mm256_set1_epi32(TILE_GOAL)));
+        __m256i fragile = _mm256_and_si256(standing, _mm256_cmpeq_epi32(tile, _mm256_set1_epi32(TILE_FRAGILE)));
+        __m256i no_bridge = _mm256_andnot_si256(_mm256_cmpgt_epi32(bridge, _mm256_setzero_si256()),
+                                                _mm256_cmpeq_epi32(tile, _mm256_set1_epi32(TILE_BRIDGE)));
+        __m256i fall = _mm256_or_si256(_mm256_cmpeq_epi32(tile, _mm256_setzero_si256()), no_bridge);
+        __m256i lose = _mm256_or_si256(fragile, fall);
+        __m256i finished = _mm256_or_si256(win, lose);
+
+        __m256 reward = _mm256_set1_ps(REWARD_STEP);
+        reward = _mm256_blendv_ps(reward, _mm256_set1_ps(REWARD_FALL), _mm256_castsi256_ps(lose));
+        reward = _mm256_blendv_ps(reward, _mm256_set1_ps(REWARD_WIN), _mm256_castsi256_ps(win));
+        _mm256_storeu_ps(&env->rewards[i], reward);
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(finished));
+        for (int k=0; k<8; k++)
+            env->done[i+k] = (mask >> k) & 1;
+
+        // auto reset of the finished games
+        x2 = _mm256_blendv_epi8(x2, _mm256_permutevar8x32_epi32(start_x2, level), finished);
+        z2 = _mm256_blendv_epi8(z2, _mm256_permutevar8x32_epi32(start_z2, level), finished);
+        s = _mm256_blendv_epi8(s, standing_state, finished);
+        bridge = _mm256_andnot_si256(finished, bridge);
+        moves = _mm256_andnot_si256(finished, moves);
+
+        _mm256_storeu_si256((__m256i*)&env->x2[i], x2);
+        _mm256_storeu_si256((__m256i*)&env->z2[i], z2);
+        _mm256_storeu_si256((__m256i*)&env->state[i], s);
+        _mm256_storeu_si256((__m256i*)&env->bridge[i], bridge);
+        _mm256_storeu_si256((__m256i*)&env->moves[i], moves);
+    }
+    stepScalar(env, i, end);
+}
+
+/* Games handled by slice t of the step */
+static void sliceBounds (const BatchEnv* env, int t, int& begin, int& end)
+{
+    int per = ((env->n + env->threads - 1) / env->threads + 7) & ~7;
+    begin = min(env->n, t * per);
+    end = min(env->n, begin + per);
+}
+
+static void stepSlice (BatchEnv* env, int t)
+{
+    int begin, end;
+    sliceBounds(env, t, begin, end);
+    if (env->simd)
+        stepAvx2(env, begin, end);
+    else
+        stepScalar(env, begin, end);
+}
+
+static void batchWorker (BatchEnv* env, int t)
+{
+    int seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> lock(env->lock);
+            env->start_cv.wait(lock, [&] { return env->quit || env->generation != seen; });
+            if (env->quit)
+                return;
+            seen = env->generation;
+        }
+        stepSlice(env, t);
+        {
+            lock_guard<mutex> lock(env->lock);
+            if (--env->remaining == 0)
+                env->done_cv.notify_one();
+        }
+    }
+}
+
+BatchEnv* batchCreate (int n, int level, int threads)
+{
+    BatchEnv* env = new BatchEnv;
+    env->n = n;
+    env->x2.resize(n);
+    env->z2.resize(n);
+    env->state.resize(n);
+    env->level.resize(n);
+    env->bridge.resize(n);
+    env->moves.resize(n);
+    for (int i=0; i<n; i++)
+        batchReset(env, i, level < 0 ? i % LEVELS : level);
+
+    env->simd = cpuHasAvx2();
+    memset(env->packed_moves, 0, sizeof(env->packed_moves));
+    for (int s=BLOCK_STANDING; s<=BLOCK_LYING_X; s++)
+        for (int k=KEY_LEFT; k<=KEY_DOWN; k++) {
+            const BlockMove& m = block_moves[s][k];
+            env->packed_moves[s*4 + k-1] = (m.dx2 + 8) | (m.dz2 + 8) << 4 | m.state << 8;
+        }
+
+    if (threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+    // no point in slices of less than a few thousand games
+    env->threads = max(1, min(threads, n / 4096));
+    env->generation = env->remaining = 0;
+    env->quit = false;
+    for (int t=1; t<env->threads; t++)
+        env->workers.push_back(thread(batchWorker, env, t));
+    return env;
+}
+
+void batchDestroy (BatchEnv* env)
+{
+    {
+        lock_guard<mutex> lock(env->lock);
+        env->quit = true;
+    }
+    env->start_cv.notify_all();
+    for (size_t i=0; i<env->workers.size(); i++)
+        env->workers[i].join();
+    delete env;
+}
+
+int batchSize (const BatchEnv* env)
+{
+    return env->n;
+}
+
+void batchStep (BatchEnv* env, const int32_t* actions, float* rewards, uint8_t* done)
+{
+    env->actions = actions;
+    env->rewards = rewards;
+    env->done = done;
+
+    if (env->threads == 1) {
+        stepSlice(env, 0);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(env->lock);
+        env->remaining = env->threads - 1;
+        env->generation++;
+    }
+    env->start_cv.notify_all();
+    stepSlice(env, 0);
+
+    unique_lock<mutex> lock(env->lock);
+    env->done_cv.wait(lock, [&] { return env->remaining == 0; });
+}
+
+BatchState batchObserve (const BatchEnv* env)
+{
+    BatchState s = { &env->x2[0], &env->z2[0], &env->state[0], &env->level[0], &env->bridge[0], &env->moves[0] };
+    return s;
+}
+
+void batchReset (BatchEnv* env, int i, int level)
+{
+    GameState g;
+    resetGame(g, level);
+    env->x2[i] = g.x2;
+    env->z2[i] = g.z2;
+    env->state[i] = g.state;
+    env->level[i] = g.level;
+    env->bridge[i] = g.bridge;
+    env->moves[i] = 0;
+}
+
+void batchSetSimd (BatchEnv* env, bool enabled)
+{
+    env->simd = enabled && cpuHasAvx2();
+}
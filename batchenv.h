@@ -0,0 +1,41 @@
+#ifndef BATCHENV_H
+#define BATCHENV_H
+
+#include <stdint.h>
+
+/* N independent games of the embedded levels (map1) advanced in lockstep,
+   for agents and level analytics. States are kept as arrays per field, a
+   step runs 8 games per AVX2 instruction when the CPU has it, and the
+   games are split over worker threads. A game that wins or falls is put
+   back on the start tile of its level. */
+
+struct BatchEnv;
+
+#define REWARD_WIN 1.0f
+#define REWARD_FALL -1.0f
+#define REWARD_STEP -0.01f
+
+/* level < 0 spreads the games over all levels, threads <= 0 uses every core */
+BatchEnv* batchCreate (int n, int level, int threads);
+void batchDestroy (BatchEnv* env);
+int batchSize (const BatchEnv* env);
+
+/* Advances every game by one action (an arrow key, KEY_LEFT .. KEY_DOWN,
+   anything else leaves the game as it is). rewards and done get n entries :
+   REWARD_WIN / REWARD_FALL and done = 1 when the episode ended (the game is
+   already reset), REWARD_STEP otherwise. */
+void batchStep (BatchEnv* env, const int32_t* actions, float* rewards, uint8_t* done);
+
+/* State of every game after the last step, same fields as GameState */
+struct BatchState {
+    const int32_t *x2, *z2, *state, *level, *bridge, *moves;
+};
+BatchState batchObserve (const BatchEnv* env);
+
+/* Puts game i back on the start of level */
+void batchReset (BatchEnv* env, int i, int level);
+
+/* Turns the SIMD path off, to compare it with the scalar rules */
+void batchSetSimd (BatchEnv* env, bool enabled);
+
+#endif
@@ -0,0 +1,71 @@
+#include <bits/stdc++.h>
+
+#include "batchenv.h"
+#include "logic.h"
+
+using namespace std;
+
+/* Checks the SIMD step against the scalar rules, then measures steps/s
+   for the scalar path, the SIMD path and the SIMD path on every core. */
+
+static bool sameStates (BatchEnv* a, BatchEnv* b, int n)
+{
+    BatchState sa = batchObserve(a), sb = batchObserve(b);
+    for (int i=0; i<n; i++)
+        if (sa.x2[i] != sb.x2[i] || sa.z2[i] != sb.z2[i] || sa.state[i] != sb.state[i]
+            || sa.bridge[i] != sb.bridge[i] || sa.moves[i] != sb.moves[i]) {
+            printf("game %d differs\n", i);
+            return false;
+        }
+    return true;
+}
+
+static double measure (BatchEnv* env, int n, int steps, vector<int32_t>& actions)
+{
+    vector<float> rewards(n);
+    vector<uint8_t> done(n);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int s=0; s<steps; s++) {
+        // shift the actions so every step sees new ones, without paying for rand
+        batchStep(env, &actions[s % 64], &rewards[0], &done[0]);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (double)n * steps / seconds;
+}
+
+int main (int argc, char** argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 65536;
+    int steps = argc > 2 ? atoi(argv[2]) : 200;
+
+    vector<int32_t> actions(n + 64);
+    unsigned int seed = 1;
+    for (size_t i=0; i<actions.size(); i++)
+        actions[i] = rand_r(&seed) % 6;    // 0 and 5 are no-ops
+
+    // same games, same actions : SIMD and scalar must agree on every step
+    BatchEnv* simd = batchCreate(n, -1, 1);
+    BatchEnv* scalar = batchCreate(n, -1, 1);
+    batchSetSimd(scalar, false);
+    vector<float> r1(n), r2(n);
+    vector<uint8_t> d1(n), d2(n);
+    for (int s=0; s<500; s++) {
+        batchStep(simd, &actions[s % 64], &r1[0], &d1[0]);
+        batchStep(scalar, &actions[s % 64], &r2[0], &d2[0]);
+        if (r1 != r2 || d1 != d2 || !sameStates(simd, scalar, n)) {
+            printf("SIMD and scalar steps differ at step %d\n", s);
+            return 1;
+        }
+    }
+    printf("SIMD matches scalar over 500 steps of %d games\n", n);
+
+    printf("scalar, 1 thread : %.1f M game steps/s\n", measure(scalar, n, steps, actions) / 1e6);
+    printf("SIMD, 1 thread   : %.1f M game steps/s\n", measure(simd, n, steps, actions) / 1e6);
+    batchDestroy(simd);
+    batchDestroy(scalar);
+
+    BatchEnv* all = batchCreate(n, -1, 0);
+    printf("SIMD, all cores  : %.1f M game steps/s\n", measure(all, n, steps, actions) / 1e6);
+    batchDestroy(all);
+    return 0;
+}
@@ -0,0 +1,416 @@
+#include <bits/stdc++.h>
+
+#include "levels.h"
+#include "logic.h"
+#include "scene.h"
+
+using namespace std;
+
+/* Microbenchmarks of the per-tick and per-frame paths of the game that
+   do not need a GL context : the moves and support checks moveBlock()
+   runs, checkBridges(), the scene (tile and block transforms) draw()
+   builds every frame, and the buffer preparation of create3DObject()
+   against a mock GL that only copies the data like a driver would.
+
+   Each benchmark is calibrated to about 10 ms per repetition, then
+   repeated; ns/op is reported as median, min and spread over the
+   repetitions, allocations/op over all of them.
+
+     bench-logic [--reps=N] [--filter=TEXT] [--json=FILE]
+
+   --json writes the results for comparing two builds. */
+
+/* Allocation counter : every operator new goes through here */
+static long allocations = 0;
+
+void* operator new (size_t size)
+{
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+void* operator new[] (size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete (void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[] (void* p, size_t) noexcept
+{
+    free(p);
+}
+
+/* Keeps the compiler from dropping a result nobody reads */
+template <class T>
+static void keep (const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/************
+ * Mock GL  *
+ ************/
+
+/* Just enough GL for create3DObject() : names are counters, glBufferData
+   copies into a store that keeps its capacity, the way a driver copies
+   the data into its own memory before the call returns */
+typedef unsigned int GLuint;
+typedef unsigned int GLenum;
+typedef float GLfloat;
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_TRIANGLES 0x0004
+#define GL_FILL 0x1B02
+
+struct MockGL {
+    GLuint names;
+    GLuint bound;
+    vector<char> stores[64];
+} mock_gl;
+
+static void glGenVertexArrays (int n, GLuint* out)
+{
+    for (int i=0; i<n; i++)
+        out[i] = ++mock_gl.names;
+}
+
+static void glGenBuffers (int n, GLuint* out)
+{
+    glGenVertexArrays(n, out);
+}
+
+static void glBindVertexArray (GLuint) {}
+
+static void glBindBuffer (GLenum, GLuint buffer)
+{
+    mock_gl.bound = buffer;
+}
+
+static void glBufferData (GLenum, size_t size, const void* data, GLenum)
+{
+    vector<char>& store = mock_gl.stores[mock_gl.bound % 64];
+    store.assign((const char*)data, (const char*)data + size);
+}
+
+static void glVertexAttribPointer (GLuint, int, GLenum, bool, int, const void*) {}
+
+struct VAO {
+    GLuint VertexArrayID;
+    GLuint VertexBuffer;
+    GLuint ColorBuffer;
+    GLenum PrimitiveMode;
+    GLenum FillMode;
+    int NumVertices;
+};
+
+/* The calls create3DObject() in main.cpp makes, in the same order */
+static VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode)
+{
+    VAO* vao = new VAO;
+    vao->PrimitiveMode = primitive_mode;
+    vao->NumVertices = numVertices;
+    vao->FillMode = fill_mode;
+    glGenVertexArrays(1, &vao->VertexArrayID);
+    glGenBuffers(1, &vao->VertexBuffer);
+    vao->ColorBuffer = 0;
+    if (color_buffer_data != NULL)
+        glGenBuffers(1, &vao->ColorBuffer);
+
+    glBindVertexArray(vao->VertexArrayID);
+    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, 0);
+    glVertexAttribPointer(0, 3, 0, false, 0, NULL);
+    if (color_buffer_data != NULL) {
+        glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+        glBufferData(GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, 0);
+        glVertexAttribPointer(1, 3, 0, false, 0, NULL);
+    }
+    return vao;
+}
+
+/* The solid color overload, its colors prepared by the same solidColors()
+   (scene.cpp) as in main.cpp */
+static VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, GLfloat red, GLfloat green, GLfloat blue, GLenum fill_mode)
+{
+    vector<GLfloat> color_buffer_data;
+    solidColors(color_buffer_data, numVertices, red, green, blue);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
+}
+
+/**************
+ * Benchmarks *
+ **************/
+
+/* Runs the operation n times */
+typedef function<void(long n)> BenchLoop;
+
+struct Benchmark {
+    const char* name;
+    BenchLoop loop;
+};
+
+struct BenchResult {
+    string name;
+    long iterations;            // per repetition
+    vector<double> ns_per_op;   // one per repetition, sorted
+    double allocs_per_op;
+};
+
+static double runOnce (const BenchLoop& loop, long n, long* allocs)
+{
+    long before = allocations;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    loop(n);
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    if (allocs != NULL)
+        *allocs += allocations - before;
+    return ns;
+}
+
+static BenchResult measure (const Benchmark& b, int reps)
+{
+    // double the iterations until one repetition takes 10 ms
+    long n = 1;
+    while (runOnce(b.loop, n, NULL) < 1e7 && n < (1L << 40))
+        n *= 2;
+
+    BenchResult r;
+    r.name = b.name;
+    r.iterations = n;
+    long allocs = 0;
+    for (int i=0; i<reps; i++)
+        r.ns_per_op.push_back(runOnce(b.loop, n, &allocs) / n);
+    sort(r.ns_per_op.begin(), r.ns_per_op.end());
+    r.allocs_per_op = (double)allocs / ((double)n * reps);
+    return r;
+}
+
+static double median (const vector<double>& sorted)
+{
+    size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/* Median absolute deviation, relative to the median : the noise of the run */
+static double spread (const vector<double>& sorted)
+{
+    double m = median(sorted);
+    vector<double> deviations;
+    for (size_t i=0; i<sorted.size(); i++)
+        deviations.push_back(fabs(sorted[i] - m));
+    sort(deviations.begin(), deviations.end());
+    return m > 0 ? median(deviations) / m : 0;
+}
+
+/* Random arrow keys, and random block positions over every level */
+static vector<int> random_keys;
+struct Probe {
+    int x2, z2, state, level;
+};
+static vector<Probe> probes;
+
+static void makeInputs ()
+{
+    unsigned int seed = 1;
+    for (int i=0; i<4096; i++)
+        random_keys.push_back(KEY_LEFT + rand_r(&seed) % 4);
+    for (int i=0; i<4096; i++) {
+        Probe p;
+        p.level = rand_r(&seed) % LEVELS;
+        p.x2 = rand_r(&seed) % (2*LEVEL_ROWS);
+        p.z2 = rand_r(&seed) % (2*LEVEL_COLS);
+        p.state = BLOCK_STANDING + rand_r(&seed) % 3;
+        probes.push_back(p);
+    }
+}
+
+static vector<Benchmark> benchmarks ()
+{
+    vector<Benchmark> list;
+
+    // moveBlock : one arrow key through the rules, a fall or a win restarts the level
+    list.push_back({ "move/stepGame", [] (long n) {
+        GameState g;
+        resetGame(g, 0);
+        for (long i=0; i<n; i++) {
+            int support = stepGame(g, random_keys[i & 4095]);
+            if (support != SUPPORT_OK)
+                resetGame(g, (g.level + 1) % LEVELS);
+        }
+        keep(g);
+    }});
+
+    // the support check moveBlock does on every tick, against map1
+    list.push_back({ "support/map1", [] (long n) {
+        int sum = 0;
+        for (long i=0; i<n; i++) {
+            const Probe& p = probes[i & 4095];
+            sum += blockSupport(&map1[p.level][0][0], LEVEL_ROWS, LEVEL_COLS, p.x2, p.z2, p.state, i & 1);
+        }
+        keep(sum);
+    }});
+
+    // checkBridges : the switch bitboard of the level
+    list.push_back({ "checkBridges", [] (long n) {
+        int sum = 0;
+        for (long i=0; i<n; i++) {
+            const Probe& p = probes[i & 4095];
+            sum += bitboardTest(level_bitboards[p.level].switches, p.x2 / 2, p.z2 / 2) && p.state == BLOCK_STANDING;
+        }
+        keep(sum);
+    }});
+
+    // draw() : the tile transforms of a level, with the bridge on
+    list.push_back({ "scene/levelInstances", [] (long n) {
+        vector<SceneInstance> tiles;
+        for (long i=0; i<n; i++) {
+            int l = i % LEVELS;
+            levelInstances(tiles, l, level_tiles[l].count);
+            keep(tiles[0]);
+        }
+    }});
+
+    list.push_back({ "scene/blockModel", [] (long n) {
+        float model[16];
+        for (long i=0; i<n; i++) {
+            const BlockMove& m = block_moves[BLOCK_STANDING + i % 3][KEY_LEFT + (i >> 2) % 4];
+            float pos[3] = { m.dx2 / 2.0f, m.y, m.dz2 / 2.0f };
+            blockModel(model, pos, m.rotation, m.axis);
+            keep(model[0]);
+        }
+    }});
+
+    // draw() : the whole scene of a frame, camera included, reusing the Scene like simulate() does
+    list.push_back({ "scene/buildScene", [] (long n) {
+        Scene scene;
+        for (long i=0; i<n; i++) {
+            int l = i % LEVELS;
+            SceneInput in = {
+                (int)(i / LEVELS) % 5,
+                { (float)initPos[l][0], 1, (float)initPos[l][1] },
+                0, { 0, 0, 1 },
+                { 8, 10, 10 }, { 0, 0, 0 },
+                l, (int)(i & 1), 1,
+            };
+            buildScene(scene, in);
+            keep(scene.view_projection.m[0]);
+        }
+    }});
+
+    // initGL : the meshes are baked then handed to create3DObject
+    list.push_back({ "mesh/bakeBlockMesh", [] (long n) {
+        for (long i=0; i<n; i++) {
+            Mesh mesh = bakeBlockMesh();
+            keep(mesh.vertices[0]);
+        }
+    }});
+
+    list.push_back({ "mesh/bakeTileMesh", [] (long n) {
+        for (long i=0; i<n; i++) {
+            Mesh mesh = bakeTileMesh();
+            keep(mesh.vertices[0]);
+        }
+    }});
+
+    list.push_back({ "mesh/solidColors", [] (long n) {
+        static const Mesh mesh = bakeTileMesh();
+        vector<float> colors;
+        for (long i=0; i<n; i++) {
+            solidColors(colors, mesh.vertices.size()/3, 1, 0.5f, 0);
+            keep(colors[0]);
+        }
+    }});
+
+    list.push_back({ "gl/create3DObject", [] (long n) {
+        static const Mesh mesh = bakeBlockMesh();
+        for (long i=0; i<n; i++) {
+            VAO* vao = create3DObject(GL_TRIANGLES, mesh.vertices.size()/3, &mesh.vertices[0], &mesh.colors[0], GL_FILL);
+            keep(vao->VertexBuffer);
+            delete vao;
+        }
+    }});
+
+    list.push_back({ "gl/create3DObject-color", [] (long n) {
+        static const Mesh mesh = bakeTileMesh();
+        for (long i=0; i<n; i++) {
+            VAO* vao = create3DObject(GL_TRIANGLES, mesh.vertices.size()/3, &mesh.vertices[0], 1, 0.5f, 0, GL_FILL);
+            keep(vao->VertexBuffer);
+            delete vao;
+        }
+    }});
+
+    return list;
+}
+
+static bool writeJson (const char* path, const vector<BenchResult>& results, int reps)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        printf("can not write %s\n", path);
+        return false;
+    }
+    fprintf(f, "{\"reps\":%d,\"benchmarks\":[", reps);
+    for (size_t i=0; i<results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(f, "%s\n{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":{\"median\":%.3f,\"min\":%.3f,\"max\":%.3f,\"mad\":%.4f},\"allocs_per_op\":%.3f,\"samples\":[",
+                i ? "," : "", r.name.c_str(), r.iterations, median(r.ns_per_op), r.ns_per_op.front(),
+                r.ns_per_op.back(), spread(r.ns_per_op), r.allocs_per_op);
+        for (size_t j=0; j<r.ns_per_op.size(); j++)
+            fprintf(f, "%s%.3f", j ? "," : "", r.ns_per_op[j]);
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
+
+int main (int argc, char** argv)
+{
+    int reps = 15;
+    const char* filter = NULL;
+    const char* json_path = NULL;
+    for (int i=1; i<argc; i++) {
+        if (strncmp(argv[i], "--reps=", 7) == 0)
+            reps = max(1, atoi(argv[i] + 7));
+        else if (strncmp(argv[i], "--filter=", 9) == 0)
+            filter = argv[i] + 9;
+        else if (strncmp(argv[i], "--json=", 7) == 0)
+            json_path = argv[i] + 7;
+        else {
+            printf("usage : %s [--reps=N] [--filter=TEXT] [--json=FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    makeInputs();
+    printf("%-26s %12s %12s %8s %10s\n", "benchmark", "median ns/op", "min ns/op", "mad", "allocs/op");
+    vector<BenchResult> results;
+    vector<Benchmark> list = benchmarks();
+    for (size_t i=0; i<list.size(); i++) {
+        if (filter != NULL && strstr(list[i].name, filter) == NULL)
+            continue;
+        BenchResult r = measure(list[i], reps);
+        printf("%-26s %12.2f %12.2f %7.1f%% %10.2f\n", r.name.c_str(), median(r.ns_per_op),
+               r.ns_per_op.front(), 100 * spread(r.ns_per_op), r.allocs_per_op);
+        results.push_back(r);
+    }
+    if (json_path != NULL && !writeJson(json_path, results, reps))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,336 @@
+#include <bits/stdc++.h>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "broadcast.h"
+
+using namespace std;
+
+#define BROADCAST_MAGIC 0x78736c62    // "blsx"
+#define RING_CAPACITY 65536
+#define MAX_RECORD 128                // header byte and up to 127 payload bytes
+#define NO_KEYFRAME (~(uint64_t)0)
+
+/* Start of the shared file, the ring bytes follow. Positions count every
+   byte written since the writer started, the ring offset is pos % capacity. */
+struct BroadcastRing {
+    atomic<uint32_t> magic;
+    uint32_t capacity;
+    atomic<uint32_t> generation;    // bumped by every new writer on the same file
+    atomic<uint64_t> head;          // end of the last complete record
+    atomic<uint64_t> keyframe;      // start of the newest keyframe
+};
+
+static uint8_t* ringData (BroadcastRing* ring)
+{
+    return (uint8_t*)(ring + 1);
+}
+
+static size_t ringFileSize ()
+{
+    return sizeof(BroadcastRing) + RING_CAPACITY;
+}
+
+/* Bit-packed payload, most significant bit first */
+struct BitWriter {
+    uint8_t bytes[MAX_RECORD - 1];
+    int bits;
+
+    void put (uint64_t value, int n)
+    {
+        for (int i=n-1; i>=0; i--) {
+            if (bits % 8 == 0)
+                bytes[bits / 8] = 0;
+            if ((value >> i) & 1)
+                bytes[bits / 8] |= 0x80 >> (bits % 8);
+            bits++;
+        }
+    }
+
+    // Exp-Golomb : value+1 in binary, after as many zeros as it has bits minus one
+    void putUnsigned (uint64_t value)
+    {
+        int n = 0;
+        while ((value + 1) >> n)
+            n++;
+        put(0, n - 1);
+        put(value + 1, n);
+    }
+
+    // zigzag : 0, -1, 1, -2 ... as 0, 1, 2, 3 ...
+    void putSigned (int64_t value)
+    {
+        putUnsigned(value < 0 ? ((uint64_t)(-(value + 1)) << 1) | 1 : (uint64_t)value << 1);
+    }
+};
+
+struct BitReader {
+    const uint8_t* bytes;
+    int bits, size;     // size in bits, reads past it return zeros
+
+    uint64_t get (int n)
+    {
+        uint64_t value = 0;
+        for (int i=0; i<n; i++, bits++) {
+            int bit = bits < size ? (bytes[bits / 8] >> (7 - bits % 8)) & 1 : 0;
+            value = (value << 1) | bit;
+        }
+        return value;
+    }
+
+    uint64_t getUnsigned ()
+    {
+        int zeros = 0;
+        while (bits < size && get(1) == 0)
+            zeros++;
+        if (zeros > 63)
+            return 0;
+        return ((uint64_t(1) << zeros) | get(zeros)) - 1;
+    }
+
+    int64_t getSigned ()
+    {
+        uint64_t v = getUnsigned();
+        return v & 1 ? -(int64_t)(v >> 1) - 1 : (int64_t)(v >> 1);
+    }
+};
+
+enum {
+    FIELD_X = 1, FIELD_Y = 2, FIELD_Z = 4, FIELD_STATE = 8,
+    FIELD_POSE = 16, FIELD_LEVEL = 32, FIELD_BRIDGE = 64, FIELD_MOVES = 128,
+};
+
+/* The fields of to that differ from from */
+static void encodeChanges (const BroadcastState& from, const BroadcastState& to, BitWriter& out)
+{
+    int mask = 0;
+    if (to.x2 != from.x2) mask |= FIELD_X;
+    if (to.y2 != from.y2) mask |= FIELD_Y;
+    if (to.z2 != from.z2) mask |= FIELD_Z;
+    if (to.state != from.state) mask |= FIELD_STATE;
+    if (to.rotation != from.rotation || to.axis != from.axis) mask |= FIELD_POSE;
+    if (to.level != from.level) mask |= FIELD_LEVEL;
+    if (to.bridge != from.bridge) mask |= FIELD_BRIDGE;
+    if (to.moves != from.moves) mask |= FIELD_MOVES;
+
+    out.bits = 0;
+    out.put(mask, 8);
+    if (mask & FIELD_X) out.putSigned((int64_t)to.x2 - from.x2);
+    if (mask & FIELD_Y) out.putSigned((int64_t)to.y2 - from.y2);
+    if (mask & FIELD_Z) out.putSigned((int64_t)to.z2 - from.z2);
+    if (mask & FIELD_STATE) out.put(to.state, 2);
+    if (mask & FIELD_POSE) {
+        out.put(to.rotation + 1, 2);
+        out.put(to.axis, 3);
+    }
+    if (mask & FIELD_LEVEL) out.putUnsigned(to.level);
+    if (mask & FIELD_BRIDGE) out.put(to.bridge, 1);
+    if (mask & FIELD_MOVES) out.putSigned((int64_t)to.moves - from.moves);
+}
+
+static void decodeChanges (BitReader& in, BroadcastState& s)
+{
+    int mask = in.get(8);
+    if (mask & FIELD_X) s.x2 += in.getSigned();
+    if (mask & FIELD_Y) s.y2 += in.getSigned();
+    if (mask & FIELD_Z) s.z2 += in.getSigned();
+    if (mask & FIELD_STATE) s.state = in.get(2);
+    if (mask & FIELD_POSE) {
+        s.rotation = (int)in.get(2) - 1;
+        s.axis = in.get(3);
+    }
+    if (mask & FIELD_LEVEL) s.level = in.getUnsigned();
+    if (mask & FIELD_BRIDGE) s.bridge = in.get(1);
+    if (mask & FIELD_MOVES) s.moves += in.getSigned();
+}
+
+/**********
+ * Writer *
+ **********/
+
+struct BroadcastWriter {
+    int fd;
+    BroadcastRing* ring;
+    BroadcastState last;
+    int since_keyframe;
+    long ticks, records, keyframes;
+    uint64_t bytes;
+};
+
+BroadcastWriter* broadcastCreate (const char* path)
+{
+    // the file is reused, not replaced : viewers that mapped it stay on it
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, ringFileSize()) != 0) {
+        printf("BROADCAST : can not create %s : %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    void* p = mmap(NULL, ringFileSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("BROADCAST : can not map %s : %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    BroadcastWriter* w = new BroadcastWriter();
+    w->fd = fd;
+    w->ring = (BroadcastRing*)p;
+    w->ring->capacity = RING_CAPACITY;
+    w->ring->keyframe.store(NO_KEYFRAME, memory_order_relaxed);
+    w->ring->head.store(0, memory_order_relaxed);
+    w->ring->generation.fetch_add(1, memory_order_release);
+    w->ring->magic.store(BROADCAST_MAGIC, memory_order_release);
+    printf("BROADCAST on %s\n", path);
+    return w;
+}
+
+void broadcastTick (BroadcastWriter* w, const BroadcastState& s)
+{
+    w->ticks++;
+    bool key = w->since_keyframe == 0;
+    w->since_keyframe = (w->since_keyframe + 1) % BROADCAST_KEYFRAME_TICKS;
+    if (!key && memcmp(&s, &w->last, sizeof(s)) == 0)
+        return;
+
+    BitWriter payload;
+    BroadcastState zero = {};
+    encodeChanges(key ? zero : w->last, s, payload);
+    w->last = s;
+
+    uint8_t record[MAX_RECORD];
+    int length = (payload.bits + 7) / 8;
+    record[0] = (key ? 0x80 : 0) | length;
+    memcpy(record + 1, payload.bytes, length);
+
+    BroadcastRing* ring = w->ring;
+    uint64_t head = ring->head.load(memory_order_relaxed);
+    uint8_t* data = ringData(ring);
+    for (int i=0; i<=length; i++)
+        data[(head + i) % RING_CAPACITY] = record[i];
+    ring->head.store(head + length + 1, memory_order_release);
+    if (key)
+        ring->keyframe.store(head, memory_order_release);
+
+    w->records++;
+    w->keyframes += key;
+    w->bytes += length + 1;
+}
+
+void broadcastClose (BroadcastWriter* w)
+{
+    printf("BROADCAST %ld ticks, %ld records (%ld keyframes), %.2f bytes per tick\n",
+           w->ticks, w->records, w->keyframes, w->ticks ? (double)w->bytes / w->ticks : 0.0);
+    munmap(w->ring, ringFileSize());
+    close(w->fd);
+    delete w;
+}
+
+/**********
+ * Reader *
+ **********/
+
+struct BroadcastReader {
+    int fd;
+    BroadcastRing* ring;
+    uint32_t generation;
+    uint64_t pos;
+    bool synced;
+    BroadcastState state;
+    vector<uint8_t> copy;
+};
+
+BroadcastReader* broadcastAttach (const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < ringFileSize()) {
+        close(fd);
+        return NULL;
+    }
+    void* p = mmap(NULL, ringFileSize(), PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    BroadcastRing* ring = (BroadcastRing*)p;
+    if (ring->magic.load(memory_order_acquire) != BROADCAST_MAGIC || ring->capacity != RING_CAPACITY) {
+        munmap(p, ringFileSize());
+        close(fd);
+        return NULL;
+    }
+
+    BroadcastReader* r = new BroadcastReader();
+    r->fd = fd;
+    r->ring = ring;
+    r->synced = false;
+    return r;
+}
+
+/* The writer never waits for the readers : bytes copied out of the ring
+   are only trusted when the writer, after the copy, is still too far
+   behind to have started overwriting them */
+static bool overwritten (const BroadcastReader* r, uint64_t head, uint32_t generation)
+{
+    return generation != r->generation || head < r->pos || head - r->pos + MAX_RECORD > RING_CAPACITY;
+}
+
+bool broadcastPoll (BroadcastReader* r, BroadcastState& s)
+{
+    BroadcastRing* ring = r->ring;
+    uint32_t generation = ring->generation.load(memory_order_acquire);
+    uint64_t head = ring->head.load(memory_order_acquire);
+
+    // new viewer, restarted writer or lapped : start over at the newest keyframe
+    if (!r->synced || overwritten(r, head, generation)) {
+        uint64_t key = ring->keyframe.load(memory_order_acquire);
+        if (key == NO_KEYFRAME)
+            return false;
+        head = ring->head.load(memory_order_acquire);
+        r->generation = generation;
+        r->pos = key;
+        r->synced = false;
+        if (overwritten(r, head, generation))
+            return false;
+    }
+    if (head == r->pos)
+        return false;
+
+    r->copy.resize(head - r->pos);
+    const uint8_t* data = ringData(ring);
+    for (size_t i=0; i<r->copy.size(); i++)
+        r->copy[i] = data[(r->pos + i) % RING_CAPACITY];
+    atomic_thread_fence(memory_order_acquire);
+    if (overwritten(r, ring->head.load(memory_order_relaxed), ring->generation.load(memory_order_relaxed))) {
+        r->synced = false;
+        return false;
+    }
+
+    size_t at = 0;
+    while (at < r->copy.size()) {
+        uint8_t header = r->copy[at];
+        int length = header & 0x7f;
+        if (header & 0x80)
+            r->state = BroadcastState();
+        BitReader in = { &r->copy[at + 1], 0, length * 8 };
+        decodeChanges(in, r->state);
+        at += length + 1;
+    }
+    r->pos = head;
+    r->synced = true;
+    s = r->state;
+    return true;
+}
+
+void broadcastDetach (BroadcastReader* r)
+{
+    munmap(r->ring, ringFileSize());
+    close(r->fd);
+    delete r;
+}
@@ -0,0 +1,49 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdint.h>
+
+/* Spectator stream : the game appends its state to a ring in a shared
+   memory file once per tick, any number of viewers map the same file and
+   read it on their own. The player's process never learns about them, a
+   tick costs it the same with one viewer or fifty.
+
+   A record is one byte (bit 7 keyframe, bits 0-6 payload length) and a
+   bit-packed payload : a byte of changed-field flags, then the changed
+   fields. Coordinates and moves go as Exp-Golomb coded differences, so a
+   move is 3 or 4 bytes; ticks where nothing changed write nothing. A
+   keyframe is the same record against an all zero state, one every
+   BROADCAST_KEYFRAME_TICKS, and where a new or lapped viewer starts. */
+
+#define BROADCAST_PATH "/dev/shm/bloxie-broadcast"
+#define BROADCAST_KEYFRAME_TICKS 120
+
+/* What a viewer needs to draw the game */
+struct BroadcastState {
+    int x2, y2, z2;     // block_pos in half tiles
+    int state;          // blockState
+    int rotation;       // blockRotation in quarter turns, -1 .. 1
+    int axis;           // rotation axis : 0 +x, 1 -x, 2 +y, 3 -y, 4 +z, 5 -z
+    int level;
+    int bridge;         // bridge_toggle
+    int moves;
+};
+
+struct BroadcastWriter;
+struct BroadcastReader;
+
+/* Creates the ring file, NULL (and a message) on failure */
+BroadcastWriter* broadcastCreate (const char* path);
+/* Appends one tick : a keyframe when one is due, else the changes */
+void broadcastTick (BroadcastWriter* w, const BroadcastState& s);
+/* Prints the bytes written per tick and unmaps the ring */
+void broadcastClose (BroadcastWriter* w);
+
+/* Maps the ring of a running game, NULL when there is none yet */
+BroadcastReader* broadcastAttach (const char* path);
+/* Reads every record since the last call into s. False until the first
+   keyframe, and when no record arrived (nothing changed). */
+bool broadcastPoll (BroadcastReader* r, BroadcastState& s);
+void broadcastDetach (BroadcastReader* r);
+
+#endif
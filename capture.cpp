@@ -0,0 +1,290 @@
+#include <bits/stdc++.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "capture.h"
+
+using namespace std;
+
+/* Frames waiting for the encoder, at most this many are kept */
+#define CAPTURE_QUEUE_MAX 8
+
+struct CaptureJob {
+    unsigned char* pixels; // NULL for a "close video" job
+    int width, height;
+    int format;
+    string path;
+};
+
+static thread capture_thread;
+static mutex capture_mutex;
+static condition_variable capture_cv;
+static deque<CaptureJob> capture_queue;
+static bool capture_running = false;
+static int capture_dropped = 0;
+
+/* Video currently being written by the worker */
+static FILE* video_file = NULL;
+static string video_path;
+static int video_width, video_height;
+
+/**********************
+ * PNG (stored zlib)  *
+ **********************/
+
+static unsigned int crc_table[256];
+
+static void makeCrcTable ()
+{
+    for (unsigned int n=0; n<256; n++) {
+        unsigned int c = n;
+        for (int k=0; k<8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static unsigned int crc32 (unsigned int crc, const unsigned char* buf, size_t len)
+{
+    crc ^= 0xffffffffu;
+    for (size_t i=0; i<len; i++)
+        crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+static void putBE32 (unsigned char* p, unsigned int v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void writeChunk (FILE* f, const char* type, const unsigned char* data, size_t len)
+{
+    unsigned char header[8];
+    putBE32(header, len);
+    memcpy(header+4, type, 4);
+    fwrite(header, 1, 8, f);
+    if (len)
+        fwrite(data, 1, len, f);
+
+    unsigned int crc = crc32(0, header+4, 4);
+    crc = crc32(crc, data, len);
+    unsigned char footer[4];
+    putBE32(footer, crc);
+    fwrite(footer, 1, 4, f);
+}
+
+/* Writes an RGB PNG using stored (uncompressed) deflate blocks, speed over size */
+bool writePNGFile (const char* path, const unsigned char* pixels, int w, int h)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "capture : cannot open %s\n", path);
+        return false;
+    }
+    if (crc_table[1] == 0)
+        makeCrcTable();
+
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    fwrite(signature, 1, 8, f);
+
+    unsigned char ihdr[13];
+    putBE32(ihdr, w);
+    putBE32(ihdr+4, h);
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 2;   // color type RGB
+    ihdr[10] = 0;  // compression
+    ihdr[11] = 0;  // filter
+    ihdr[12] = 0;  // interlace
+    writeChunk(f, "IHDR", ihdr, 13);
+
+    // Scanlines with filter byte 0, flipped since GL rows go bottom-up
+    size_t stride = 1 + 3*(size_t)w;
+    vector<unsigned char> raw(stride*h);
+    for (int y=0; y<h; y++) {
+        const unsigned char* src = pixels + 4*(size_t)w*(h-1-y);
+        unsigned char* dst = &raw[stride*y];
+        *dst++ = 0;
+        for (int x=0; x<w; x++) {
+            *dst++ = src[4*x];
+            *dst++ = src[4*x+1];
+            *dst++ = src[4*x+2];
+        }
+    }
+
+    // zlib stream made of stored blocks of at most 65535 bytes
+    vector<unsigned char> z;
+    z.reserve(raw.size() + raw.size()/65535*5 + 16);
+    z.push_back(0x78);
+    z.push_back(0x01);
+    size_t pos = 0;
+    do {
+        size_t len = min(raw.size()-pos, (size_t)65535);
+        z.push_back(pos+len == raw.size() ? 1 : 0);
+        z.push_back(len & 0xff);
+        z.push_back(len >> 8);
+        z.push_back(~len & 0xff);
+        z.push_back((~len >> 8) & 0xff);
+        z.insert(z.end(), raw.begin()+pos, raw.begin()+pos+len);
+        pos += len;
+    } while (pos < raw.size());
+
+    unsigned int a = 1, b = 0;
+    for (size_t i=0; i<raw.size(); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    unsigned char adler[4];
+    putBE32(adler, (b << 16) | a);
+    z.insert(z.end(), adler, adler+4);
+
+    writeChunk(f, "IDAT", &z[0], z.size());
+    writeChunk(f, "IEND", NULL, 0);
+    fclose(f);
+    return true;
+}
+
+/**********************
+ * Y4M (4:2:0, JPEG)  *
+ **********************/
+
+static void closeVideo ()
+{
+    if (video_file != NULL) {
+        fclose(video_file);
+        video_file = NULL;
+        printf("capture : wrote %s\n", video_path.c_str());
+    }
+}
+
+static void writeY4MFrame (const CaptureJob& job)
+{
+    int w = job.width, h = job.height;
+    if (video_file != NULL && (video_path != job.path || video_width != w || video_height != h))
+        closeVideo();   // a resized window starts a new video
+    if (video_file == NULL) {
+        video_file = fopen(job.path.c_str(), "wb");
+        if (video_file == NULL) {
+            fprintf(stderr, "capture : cannot open %s\n", job.path.c_str());
+            return;
+        }
+        video_path = job.path;
+        video_width = w;
+        video_height = h;
+        fprintf(video_file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", w, h);
+    }
+
+    int cw = (w+1)/2, ch = (h+1)/2;
+    vector<unsigned char> Y((size_t)w*h), U((size_t)cw*ch), V((size_t)cw*ch);
+
+    // Full range BT.601, rows flipped since GL rows go bottom-up
+    for (int y=0; y<h; y++) {
+        const unsigned char* src = job.pixels + 4*(size_t)w*(h-1-y);
+        for (int x=0; x<w; x++)
+            Y[(size_t)y*w+x] = (unsigned char)(0.299f*src[4*x] + 0.587f*src[4*x+1] + 0.114f*src[4*x+2] + 0.5f);
+    }
+    for (int y=0; y<ch; y++) {
+        for (int x=0; x<cw; x++) {
+            float r = 0, g = 0, b = 0;
+            int n = 0;
+            for (int dy=0; dy<2 && 2*y+dy<h; dy++)
+                for (int dx=0; dx<2 && 2*x+dx<w; dx++) {
+                    const unsigned char* p = job.pixels + 4*((size_t)w*(h-1-(2*y+dy)) + 2*x+dx);
+                    r += p[0]; g += p[1]; b += p[2];
+                    n++;
+                }
+            r /= n; g /= n; b /= n;
+            U[(size_t)y*cw+x] = (unsigned char)max(0.0f, min(255.0f, 128.0f - 0.168736f*r - 0.331264f*g + 0.5f*b + 0.5f));
+            V[(size_t)y*cw+x] = (unsigned char)max(0.0f, min(255.0f, 128.0f + 0.5f*r - 0.418688f*g - 0.081312f*b + 0.5f));
+        }
+    }
+
+    fputs("FRAME\n", video_file);
+    fwrite(&Y[0], 1, Y.size(), video_file);
+    fwrite(&U[0], 1, U.size(), video_file);
+    fwrite(&V[0], 1, V.size(), video_file);
+}
+
+static void captureWorker ()
+{
+    unique_lock<mutex> lock(capture_mutex);
+    while (true) {
+        capture_cv.wait(lock, [] { return !capture_queue.empty() || !capture_running; });
+        if (capture_queue.empty() && !capture_running)
+            break;
+
+        CaptureJob job = capture_queue.front();
+        capture_queue.pop_front();
+        lock.unlock();
+
+        if (job.pixels == NULL) {
+            if (video_path == job.path)
+                closeVideo();
+        }
+        else if (job.format == CAPTURE_PNG) {
+            writePNGFile(job.path.c_str(), job.pixels, job.width, job.height);
+            printf("capture : wrote %s\n", job.path.c_str());
+        }
+        else
+            writeY4MFrame(job);
+        delete[] job.pixels;
+
+        lock.lock();
+    }
+    closeVideo();
+}
+
+void startCaptureWorker ()
+{
+    if (capture_running)
+        return;
+    makeCrcTable();
+    capture_running = true;
+    capture_thread = thread(captureWorker);
+}
+
+void stopCaptureWorker ()
+{
+    {
+        lock_guard<mutex> lock(capture_mutex);
+        if (!capture_running)
+            return;
+        capture_running = false;
+    }
+    capture_cv.notify_one();
+    capture_thread.join();
+}
+
+bool queueCaptureFrame (unsigned char* pixels, int width, int height, int format, const char* path)
+{
+    CaptureJob job = { pixels, width, height, format, path };
+    {
+        lock_guard<mutex> lock(capture_mutex);
+        if (!capture_running || capture_queue.size() >= CAPTURE_QUEUE_MAX) {
+            capture_dropped++;
+            delete[] pixels;
+            return false;
+        }
+        capture_queue.push_back(job);
+    }
+    capture_cv.notify_one();
+    return true;
+}
+
+void closeCaptureVideo (const char* path)
+{
+    CaptureJob job = { NULL, 0, 0, CAPTURE_Y4M, path };
+    {
+        lock_guard<mutex> lock(capture_mutex);
+        if (!capture_running)
+            return;
+        capture_queue.push_back(job);
+    }
+    capture_cv.notify_one();
+}
+
+int captureDroppedFrames ()
+{
+    lock_guard<mutex> lock(capture_mutex);
+    return capture_dropped;
+}
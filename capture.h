@@ -0,0 +1,32 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/* Frame capture encoder : frames read back from the GPU are handed to a
+   worker thread which writes them out as PNG files or as a raw Y4M video,
+   so the frame loop never waits on disk or on the encoder. */
+
+enum CaptureFormat {
+    CAPTURE_PNG,
+    CAPTURE_Y4M,
+};
+
+void startCaptureWorker ();
+/* Finishes the queued frames, closes any open video and joins the worker */
+void stopCaptureWorker ();
+
+/* Queues a bottom-up RGBA frame (as returned by glReadPixels). PNG frames
+   are written to path, Y4M frames are appended to the video at path, which
+   is opened on its first frame. The worker takes ownership of pixels
+   (allocated with new[]). Returns false and frees pixels if the queue is
+   full, the frame is dropped rather than stalling the caller. */
+bool queueCaptureFrame (unsigned char* pixels, int width, int height, int format, const char* path);
+/* Closes the Y4M video at path once its queued frames are written */
+void closeCaptureVideo (const char* path);
+
+/* Number of frames dropped because the encoder fell behind */
+int captureDroppedFrames ();
+
+/* Writes a bottom-up RGBA image as a PNG right away, on the calling thread */
+bool writePNGFile (const char* path, const unsigned char* pixels, int width, int height);
+
+#endif
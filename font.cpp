@@ -0,0 +1,99 @@
+#include <cctype>
+
+#include "font.h"
+
+using namespace std;
+
+/* Rows top to bottom, bit 4 is the left column */
+struct Glyph {
+    char c;
+    unsigned char rows[FONT_GLYPH_H];
+};
+
+static const Glyph glyphs[] = {
+    { '0', {0x0E,0x11,0x13,0x15,0x19,0x11,0x0E} },
+    { '1', {0x04,0x0C,0x04,0x04,0x04,0x04,0x0E} },
+    { '2', {0x0E,0x11,0x01,0x02,0x04,0x08,0x1F} },
+    { '3', {0x1F,0x02,0x04,0x02,0x01,0x11,0x0E} },
+    { '4', {0x02,0x06,0x0A,0x12,0x1F,0x02,0x02} },
+    { '5', {0x1F,0x10,0x1E,0x01,0x01,0x11,0x0E} },
+    { '6', {0x06,0x08,0x10,0x1E,0x11,0x11,0x0E} },
+    { '7', {0x1F,0x01,0x02,0x04,0x08,0x08,0x08} },
+    { '8', {0x0E,0x11,0x11,0x0E,0x11,0x11,0x0E} },
+    { '9', {0x0E,0x11,0x11,0x0F,0x01,0x02,0x0C} },
+    { 'A', {0x0E,0x11,0x11,0x11,0x1F,0x11,0x11} },
+    { 'B', {0x1E,0x11,0x11,0x1E,0x11,0x11,0x1E} },
+    { 'C', {0x0E,0x11,0x10,0x10,0x10,0x11,0x0E} },
+    { 'D', {0x1C,0x12,0x11,0x11,0x11,0x12,0x1C} },
+    { 'E', {0x1F,0x10,0x10,0x1E,0x10,0x10,0x1F} },
+    { 'F', {0x1F,0x10,0x10,0x1E,0x10,0x10,0x10} },
+    { 'G', {0x0E,0x11,0x10,0x17,0x11,0x11,0x0F} },
+    { 'H', {0x11,0x11,0x11,0x1F,0x11,0x11,0x11} },
+    { 'I', {0x0E,0x04,0x04,0x04,0x04,0x04,0x0E} },
+    { 'J', {0x07,0x02,0x02,0x02,0x02,0x12,0x0C} },
+    { 'K', {0x11,0x12,0x14,0x18,0x14,0x12,0x11} },
+    { 'L', {0x10,0x10,0x10,0x10,0x10,0x10,0x1F} },
+    { 'M', {0x11,0x1B,0x15,0x15,0x11,0x11,0x11} },
+    { 'N', {0x11,0x11,0x19,0x15,0x13,0x11,0x11} },
+    { 'O', {0x0E,0x11,0x11,0x11,0x11,0x11,0x0E} },
+    { 'P', {0x1E,0x11,0x11,0x1E,0x10,0x10,0x10} },
+    { 'Q', {0x0E,0x11,0x11,0x11,0x15,0x12,0x0D} },
+    { 'R', {0x1E,0x11,0x11,0x1E,0x14,0x12,0x11} },
+    { 'S', {0x0F,0x10,0x10,0x0E,0x01,0x01,0x1E} },
+    { 'T', {0x1F,0x04,0x04,0x04,0x04,0x04,0x04} },
+    { 'U', {0x11,0x11,0x11,0x11,0x11,0x11,0x0E} },
+    { 'V', {0x11,0x11,0x11,0x11,0x11,0x0A,0x04} },
+    { 'W', {0x11,0x11,0x11,0x15,0x15,0x15,0x0A} },
+    { 'X', {0x11,0x11,0x0A,0x04,0x0A,0x11,0x11} },
+    { 'Y', {0x11,0x11,0x11,0x0A,0x04,0x04,0x04} },
+    { 'Z', {0x1F,0x01,0x02,0x04,0x08,0x10,0x1F} },
+    { ':', {0x00,0x0C,0x0C,0x00,0x0C,0x0C,0x00} },
+    { '.', {0x00,0x00,0x00,0x00,0x00,0x0C,0x0C} },
+    { ',', {0x00,0x00,0x00,0x00,0x0C,0x04,0x08} },
+    { '-', {0x00,0x00,0x00,0x1F,0x00,0x00,0x00} },
+    { '+', {0x00,0x04,0x04,0x1F,0x04,0x04,0x00} },
+    { '/', {0x00,0x01,0x02,0x04,0x08,0x10,0x00} },
+    { '(', {0x02,0x04,0x08,0x08,0x08,0x04,0x02} },
+    { ')', {0x08,0x04,0x02,0x02,0x02,0x04,0x08} },
+    { '%', {0x18,0x19,0x02,0x04,0x08,0x13,0x03} },
+    { '!', {0x04,0x04,0x04,0x04,0x04,0x00,0x04} },
+    { '?', {0x0E,0x11,0x01,0x02,0x04,0x00,0x04} },
+};
+
+vector<unsigned char> bakeFontAtlas ()
+{
+    vector<unsigned char> atlas(FONT_ATLAS_W * FONT_ATLAS_H, 0);
+    for (size_t g=0; g<sizeof(glyphs)/sizeof(glyphs[0]); g++) {
+        int index = glyphs[g].c - FONT_FIRST;
+        int cx = (index % FONT_COLUMNS) * FONT_CELL_W, cy = (index / FONT_COLUMNS) * FONT_CELL_H;
+        for (int y=0; y<FONT_GLYPH_H; y++)
+            for (int x=0; x<FONT_GLYPH_W; x++)
+                if (glyphs[g].rows[y] & (0x10 >> x))
+                    atlas[(cy + y) * FONT_ATLAS_W + cx + x] = 255;
+    }
+    return atlas;
+}
+
+float layoutText (vector<float>& out, const char* text, float x, float y, float scale, const float color[3])
+{
+    float w = FONT_CELL_W * scale, h = FONT_CELL_H * scale;
+    for (const char* p=text; *p; p++, x+=w) {
+        int index = toupper((unsigned char)*p) - FONT_FIRST;
+        if (index <= 0 || index >= FONT_GLYPHS)
+            continue;   // spaces and anything the font does not have
+
+        float u0 = (float)(index % FONT_COLUMNS) * FONT_CELL_W / FONT_ATLAS_W;
+        float v0 = (float)(index / FONT_COLUMNS) * FONT_CELL_H / FONT_ATLAS_H;
+        float u1 = u0 + (float)FONT_CELL_W / FONT_ATLAS_W;
+        float v1 = v0 + (float)FONT_CELL_H / FONT_ATLAS_H;
+        float corners[6][4] = {
+            {x, y, u0, v0}, {x+w, y, u1, v0}, {x+w, y+h, u1, v1},
+            {x, y, u0, v0}, {x+w, y+h, u1, v1}, {x, y+h, u0, v1},
+        };
+        for (int i=0; i<6; i++) {
+            out.insert(out.end(), corners[i], corners[i] + 4);
+            out.insert(out.end(), color, color + 3);
+        }
+    }
+    return x;
+}
@@ -0,0 +1,28 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <vector>
+
+/* 5x7 bitmap font for the HUD, printable ASCII (lower case is drawn as
+   upper case). The glyphs are baked into one atlas of 16x6 cells, each
+   cell a glyph with a one texel gap on the right and at the bottom. */
+
+#define FONT_GLYPH_W 5
+#define FONT_GLYPH_H 7
+#define FONT_CELL_W 6
+#define FONT_CELL_H 8
+#define FONT_COLUMNS 16
+#define FONT_FIRST 32
+#define FONT_GLYPHS 96
+#define FONT_ATLAS_W (FONT_COLUMNS * FONT_CELL_W)
+#define FONT_ATLAS_H ((FONT_GLYPHS / FONT_COLUMNS) * FONT_CELL_H)
+
+/* One byte per texel, 255 where a glyph is set, top row first */
+std::vector<unsigned char> bakeFontAtlas ();
+
+/* Appends two triangles per character of text, as x, y (pixels from the
+   top left), u, v (atlas) and r, g, b, 7 floats per vertex. scale is the
+   size of a font pixel on screen. Returns the x after the text. */
+float layoutText (std::vector<float>& out, const char* text, float x, float y, float scale, const float color[3]);
+
+#endif
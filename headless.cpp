@@ -0,0 +1,94 @@
+#include <bits/stdc++.h>
+
+#include "capture.h"
+#include "logic.h"
+#include "scene.h"
+#include "softrast.h"
+
+using namespace std;
+
+/* Renders the game without a GPU : plays a sequence of arrow keys with the
+   game rules, builds the frame the game would show and rasterizes it on
+   the CPU, to a PNG and/or a timing loop. */
+
+int main (int argc, char** argv)
+{
+    int width = 600, height = 600;
+    int level = 0, view = 0, threads = 0, frames = 1;
+    const char* keys = "";
+    const char* out = "frame.png";
+
+    for (int i=1; i<argc; i++) {
+        if (sscanf(argv[i], "--size=%dx%d", &width, &height) == 2)
+            continue;
+        if (strncmp(argv[i], "--level=", 8) == 0)
+            level = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--view=", 7) == 0)
+            view = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--frames=", 9) == 0)
+            frames = max(1, atoi(argv[i] + 9));
+        else if (strncmp(argv[i], "--keys=", 7) == 0)
+            keys = argv[i] + 7;
+        else if (strncmp(argv[i], "--out=", 6) == 0)
+            out = argv[i] + 6;
+        else {
+            printf("usage: %s [--size=WxH] [--level=N] [--view=N] [--keys=LRUD...] [--threads=N] [--frames=N] [--out=FILE.png]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (level < 0 || level >= LEVELS) {
+        printf("No level %d\n", level);
+        return 1;
+    }
+
+    // the block pose moveBlock leaves after the last key
+    GameState g;
+    resetGame(g, level);
+    g.moves = 0;
+    SceneInput in = { view, {0, 1, 0}, 0, {0, 0, 1}, {8, 10, 10}, {0, 0, 0}, level, 0, (float)width / height };
+    for (const char* k=keys; *k; k++) {
+        const char* names = "LRUD";
+        const char* found = strchr(names, toupper(*k));
+        if (!found)
+            continue;
+        int key = KEY_LEFT + (found - names);
+        const BlockMove& m = block_moves[g.state][key];
+        GameState before = g;
+        int support = stepGame(g, key);
+        if (support != SUPPORT_OK && support != SUPPORT_GOAL) {
+            // drawn where it was, the key is not applied
+            printf("Key %d makes the block fall, drawn after %d keys\n", before.moves + 1, before.moves);
+            g = before;
+            break;
+        }
+        in.block_pos[1] = m.y;
+        in.block_rotation = m.rotation;
+        memcpy(in.axis, m.axis, sizeof(in.axis));
+        if (support == SUPPORT_GOAL) {
+            printf("The block reaches the goal after %d keys\n", g.moves);
+            break;
+        }
+    }
+    in.block_pos[0] = g.x2 / 2.0f;
+    in.block_pos[2] = g.z2 / 2.0f;
+    in.bridge = g.bridge;
+
+    Scene scene;
+    buildScene(scene, in);
+
+    SoftRasterizer* r = softCreate(width, height, threads);
+    softSetMeshes(r, bakeBlockMesh(), bakeTileMesh());
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int f=0; f<frames; f++)
+        softRender(r, scene);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+    printf("%dx%d, %zu tiles : %.2f ms/frame (%.0f fps)\n", width, height, scene.tiles.size(), ms, 1000 / ms);
+
+    if (out[0] && writePNGFile(out, softPixels(r), width, height))
+        printf("Wrote %s\n", out);
+    softDestroy(r);
+    return 0;
+}
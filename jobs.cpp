@@ -0,0 +1,277 @@
+#include <bits/stdc++.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "jobs.h"
+
+using namespace std;
+
+struct JobTask {
+    Job job;
+    int flags;
+    // unfinished dependencies, plus one held by the submitter until all are registered
+    atomic<int> waiting;
+    atomic<bool> done;
+    mutex lock;
+    vector<JobHandle> dependents;   // queued when this one is done
+};
+
+struct JobQueue {
+    mutex lock;
+    deque<JobHandle> jobs;
+    // utilisation of the thread(s) popping from this deque
+    atomic<long> run;
+    atomic<long long> busy_ns;
+};
+
+struct JobPool {
+    int threads;
+    // one deque per worker, the last one takes jobs from outside the pool
+    vector<JobQueue*> queues;
+    vector<thread> workers;
+    atomic<long> pending;
+    // jobs on the deques, counted once pushed and until popped : never more
+    // than there are. Raised under sleep_lock, so a worker that saw 0 there
+    // is already waiting when the notify comes.
+    atomic<long> queued;
+    atomic<long> steals;
+    atomic<bool> quit;
+    mutex sleep_lock;
+    condition_variable work;    // idle workers, one per queued job
+    condition_variable wake;    // jobsWait and jobsWaitFor, when pending drops to 0
+    chrono::steady_clock::time_point created;
+};
+
+// deque of the worker running on this thread, -1 outside of any pool
+static thread_local JobPool* current_pool = NULL;
+static thread_local int current_queue = -1;
+
+static bool popJob (JobPool* pool, int own, JobHandle& task)
+{
+    // own deque first, newest job (still hot in the cache)
+    if (own >= 0) {
+        JobQueue* q = pool->queues[own];
+        lock_guard<mutex> lock(q->lock);
+        if (!q->jobs.empty()) {
+            task = move(q->jobs.back());
+            q->jobs.pop_back();
+            pool->queued--;
+            return true;
+        }
+    }
+
+    // then the oldest job of another deque, starting after our own so the
+    // thieves spread out; a thread outside the pool passes the blocking ones
+    int count = pool->queues.size();
+    for (int i=1; i<=count; i++) {
+        int victim = (own + i + count) % count;
+        if (victim == own)
+            continue;
+        JobQueue* q = pool->queues[victim];
+        lock_guard<mutex> lock(q->lock);
+        for (size_t j=0; j<q->jobs.size(); j++) {
+            if (own < 0 && (q->jobs[j]->flags & JOB_BLOCKING))
+                continue;
+            task = move(q->jobs[j]);
+            q->jobs.erase(q->jobs.begin() + j);
+            pool->queued--;
+            if (own >= 0 && victim < pool->threads)
+                pool->steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Puts a job whose dependencies are all done on a deque */
+static void queueJob (JobPool* pool, JobHandle task)
+{
+    int index = current_pool == pool ? current_queue : pool->threads;
+    {
+        JobQueue* q = pool->queues[index];
+        lock_guard<mutex> lock(q->lock);
+        q->jobs.push_back(move(task));
+    }
+    lock_guard<mutex> lock(pool->sleep_lock);
+    pool->queued++;
+    pool->work.notify_one();
+}
+
+static void runJob (JobPool* pool, JobHandle& task)
+{
+    int index = current_pool == pool ? current_queue : pool->threads;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    task->job();
+    task->job = Job();
+    JobQueue* q = pool->queues[index];
+    q->busy_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    q->run++;
+
+    vector<JobHandle> ready;
+    {
+        lock_guard<mutex> lock(task->lock);
+        task->done = true;
+        ready.swap(task->dependents);
+    }
+    for (size_t i=0; i<ready.size(); i++)
+        if (--ready[i]->waiting == 0)
+            queueJob(pool, ready[i]);
+    task.reset();
+
+    // the waiters poll, only the last job of a batch wakes them at once
+    if (--pool->pending == 0) {
+        lock_guard<mutex> lock(pool->sleep_lock);
+        pool->wake.notify_all();
+    }
+}
+
+static void jobWorker (JobPool* pool, int index)
+{
+    current_pool = pool;
+    current_queue = index;
+
+    JobHandle task;
+    while (!pool->quit) {
+        if (popJob(pool, index, task)) {
+            runJob(pool, task);
+            continue;
+        }
+        unique_lock<mutex> lock(pool->sleep_lock);
+        pool->work.wait(lock, [pool] { return pool->queued > 0 || pool->quit; });
+    }
+}
+
+JobPool* jobsCreate (int threads)
+{
+    if (threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+
+    JobPool* pool = new JobPool;
+    pool->threads = threads;
+    pool->pending = 0;
+    pool->queued = 0;
+    pool->steals = 0;
+    pool->quit = false;
+    pool->created = chrono::steady_clock::now();
+    for (int i=0; i<=threads; i++) {
+        JobQueue* q = new JobQueue;
+        q->run = 0;
+        q->busy_ns = 0;
+        pool->queues.push_back(q);
+    }
+    for (int i=0; i<threads; i++)
+        pool->workers.push_back(thread(jobWorker, pool, i));
+    return pool;
+}
+
+void jobsDestroy (JobPool* pool)
+{
+    {
+        lock_guard<mutex> lock(pool->sleep_lock);
+        pool->quit = true;
+        pool->work.notify_all();
+    }
+    for (size_t i=0; i<pool->workers.size(); i++)
+        pool->workers[i].join();
+    for (size_t i=0; i<pool->queues.size(); i++)
+        delete pool->queues[i];
+    delete pool;
+}
+
+int jobsThreadCount (const JobPool* pool)
+{
+    return pool->threads;
+}
+
+JobHandle jobsSubmit (JobPool* pool, Job job, int flags)
+{
+    return jobsSubmitAfter(pool, move(job), vector<JobHandle>(), flags);
+}
+
+JobHandle jobsSubmitAfter (JobPool* pool, Job job, const vector<JobHandle>& deps, int flags)
+{
+    JobHandle task = make_shared<JobTask>();
+    task->job = move(job);
+    task->flags = flags;
+    task->waiting = 1;
+    task->done = false;
+    pool->pending++;
+
+    for (size_t i=0; i<deps.size(); i++) {
+        if (!deps[i])
+            continue;
+        lock_guard<mutex> lock(deps[i]->lock);
+        if (!deps[i]->done) {
+            task->waiting++;
+            deps[i]->dependents.push_back(task);
+        }
+    }
+    // the dependencies may all have finished while they were registered
+    if (--task->waiting == 0)
+        queueJob(pool, task);
+    return task;
+}
+
+bool jobsDone (const JobHandle& handle)
+{
+    return !handle || handle->done;
+}
+
+void jobsWait (JobPool* pool)
+{
+    int own = current_pool == pool ? current_queue : -1;
+    JobHandle task;
+    while (pool->pending > 0) {
+        if (popJob(pool, own, task)) {
+            runJob(pool, task);
+            continue;
+        }
+        unique_lock<mutex> lock(pool->sleep_lock);
+        if (pool->pending > 0)
+            pool->wake.wait_for(lock, chrono::milliseconds(1));
+    }
+}
+
+void jobsWaitFor (JobPool* pool, const JobHandle& handle)
+{
+    int own = current_pool == pool ? current_queue : -1;
+    JobHandle task;
+    while (!jobsDone(handle)) {
+        if (popJob(pool, own, task)) {
+            runJob(pool, task);
+            continue;
+        }
+        unique_lock<mutex> lock(pool->sleep_lock);
+        if (!jobsDone(handle))
+            pool->wake.wait_for(lock, chrono::milliseconds(1));
+    }
+}
+
+int jobsRunUntil (JobPool* pool, chrono::steady_clock::time_point deadline)
+{
+    int own = current_pool == pool ? current_queue : -1;
+    int count = 0;
+    JobHandle task;
+    while (chrono::steady_clock::now() < deadline && popJob(pool, own, task)) {
+        runJob(pool, task);
+        count++;
+    }
+    return count;
+}
+
+long jobsSteals (const JobPool* pool)
+{
+    return pool->steals;
+}
+
+JobWorkerStats jobsWorkerStats (const JobPool* pool, int i)
+{
+    const JobQueue* q = pool->queues[i];
+    JobWorkerStats s;
+    s.jobs = q->run;
+    s.busy_ms = q->busy_ns / 1e6;
+    s.alive_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - pool->created).count();
+    return s;
+}
@@ -0,0 +1,67 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/* Work-stealing job pool. Every worker owns a deque : jobs submitted from
+   a worker go on the back of its own deque and it pops from the back, an
+   idle worker steals from the front of the others. Jobs submitted from
+   outside the pool go on a shared deque. A job can wait for others, it
+   is only queued once the last of them has finished. */
+
+struct JobPool;
+struct JobTask;
+
+typedef std::function<void()> Job;
+
+/* Flags of a submitted job */
+enum {
+    // may block for a long time (a child process, a slow disk) : only the
+    // pool's workers run it, never a thread in jobsWait or jobsRunUntil
+    JOB_BLOCKING = 1,
+};
+
+/* A submitted job, to poll it, wait for it or run other jobs after it */
+typedef std::shared_ptr<JobTask> JobHandle;
+
+/* threads <= 0 uses every core */
+JobPool* jobsCreate (int threads);
+void jobsDestroy (JobPool* pool);
+int jobsThreadCount (const JobPool* pool);
+
+JobHandle jobsSubmit (JobPool* pool, Job job, int flags = 0);
+/* Runs job once every job of deps is done, empty handles are ignored */
+JobHandle jobsSubmitAfter (JobPool* pool, Job job, const std::vector<JobHandle>& deps, int flags = 0);
+
+/* True once the job has run, and for an empty handle */
+bool jobsDone (const JobHandle& handle);
+
+/* Runs jobs on the calling thread too until every submitted job is done,
+   not to be called from inside a job. Outside the pool, JOB_BLOCKING jobs
+   are left to the workers here and in jobsRunUntil. */
+void jobsWait (JobPool* pool);
+/* Same until the given job is done */
+void jobsWaitFor (JobPool* pool, const JobHandle& handle);
+
+/* Runs ready jobs on the calling thread until the deadline or until none
+   is left, for a thread with time to spare before its next frame. A job
+   is never interrupted, so one that starts just before the deadline
+   overruns it. Returns the number of jobs run. */
+int jobsRunUntil (JobPool* pool, std::chrono::steady_clock::time_point deadline);
+
+/* Jobs a worker took from another deque, since the pool was created */
+long jobsSteals (const JobPool* pool);
+
+/* Utilisation of worker i since the pool was created. i == jobsThreadCount
+   counts the jobs run by threads outside the pool (jobsWait, jobsRunUntil),
+   its alive_ms is the age of the pool too. */
+struct JobWorkerStats {
+    long jobs;
+    double busy_ms, alive_ms;
+};
+JobWorkerStats jobsWorkerStats (const JobPool* pool, int i);
+
+#endif
@@ -0,0 +1,253 @@
+#include <bits/stdc++.h>
+#include <atomic>
+#include <mutex>
+
+#include "jobs.h"
+#include "logic.h"
+
+using namespace std;
+
+/* Generates random boards the size of the game levels, keeps the ones
+   solveBoard proves solvable within a band of optimal move counts and
+   writes them as a level pack :
+
+       level ROWS COLS STARTX STARTZ MOVES
+       ROWS lines of COLS tile digits (map1 values)
+
+   Candidates are seeded by their index, so a run with the same options
+   writes the same pack whatever the thread count. */
+
+struct GenOptions {
+    int count;          // levels to keep
+    int min_moves;      // difficulty band, optimal solution length
+    int max_moves;
+    int threads;
+    unsigned int seed;
+    const char* out;
+};
+
+struct GeneratedLevel {
+    long candidate;
+    int start_x, start_z;
+    int moves;
+    int tiles[LEVEL_ROWS][LEVEL_COLS];
+};
+
+static GenOptions opts = { 1000, 8, 30, 0, 1, "levels.txt" };
+static JobPool* pool;
+static mutex found_lock;
+static vector<GeneratedLevel> found;
+static atomic<long> kept(0), tried(0), unsolvable(0), out_of_band(0);
+
+static int randomInt (unsigned int& state, int n)
+{
+    // xorshift, rand() would serialise the workers on its lock
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % n;
+}
+
+static bool inside (int x, int z)
+{
+    return x >= 0 && z >= 0 && x < LEVEL_ROWS && z < LEVEL_COLS;
+}
+
+/* Lays a path by rolling the block around with the game rules and paving
+   every tile it is checked on, then adds some noise, the goal, fragile
+   tiles and maybe a switch and bridge. */
+static void generateBoard (unsigned int rng, GeneratedLevel& level)
+{
+    memset(level.tiles, 0, sizeof(level.tiles));
+    level.start_x = 1 + randomInt(rng, LEVEL_ROWS-2);
+    level.start_z = 1 + randomInt(rng, LEVEL_COLS-2);
+    level.tiles[level.start_x][level.start_z] = TILE_NORMAL;
+
+    GameState g = { 2*level.start_x, 2*level.start_z, BLOCK_STANDING, 0, 1, 0 };
+    vector<pair<int,int> > standing;
+    int walk = 15 + randomInt(rng, 40);
+    for (int i=0; i<walk; i++) {
+        GameState next = g;
+        stepBoard(&level.tiles[0][0], LEVEL_ROWS, LEVEL_COLS, next, KEY_LEFT + randomInt(rng, 4));
+        int x = next.x2/2, z = next.z2/2;
+        if (next.x2 < 0 || next.z2 < 0 || !inside(x, z))
+            continue;
+        level.tiles[x][z] = TILE_NORMAL;
+        g = next;
+        if (g.state == BLOCK_STANDING && (x != level.start_x || z != level.start_z))
+            standing.push_back(make_pair(x, z));
+    }
+    if (standing.empty())
+        return;
+
+    // a few tiles around the path, so the way is not drawn on the board
+    int noise = randomInt(rng, 20);
+    for (int i=0; i<noise; i++) {
+        int x = randomInt(rng, LEVEL_ROWS), z = randomInt(rng, LEVEL_COLS);
+        for (int d=0; d<4; d++) {
+            int nx = x + (d == 0) - (d == 1), nz = z + (d == 2) - (d == 3);
+            if (inside(nx, nz) && level.tiles[nx][nz] != TILE_EMPTY) {
+                level.tiles[x][z] = TILE_NORMAL;
+                break;
+            }
+        }
+    }
+
+    // goal on the last standing place of the walk, the furthest one in moves
+    pair<int,int> goal = standing.back();
+    level.tiles[goal.first][goal.second] = TILE_GOAL;
+
+    vector<pair<int,int> > plain;
+    for (int x=0; x<LEVEL_ROWS; x++)
+        for (int z=0; z<LEVEL_COLS; z++)
+            if (level.tiles[x][z] == TILE_NORMAL && (x != level.start_x || z != level.start_z))
+                plain.push_back(make_pair(x, z));
+    if (plain.size() < 4)
+        return;
+
+    int fragile = randomInt(rng, plain.size() / 6 + 1);
+    for (int i=0; i<fragile; i++) {
+        pair<int,int> t = plain[randomInt(rng, plain.size())];
+        level.tiles[t.first][t.second] = TILE_FRAGILE;
+    }
+
+    // a switch, and a short run of bridge tiles from a random tile
+    if (randomInt(rng, 2)) {
+        pair<int,int> s = plain[randomInt(rng, plain.size())];
+        pair<int,int> b = plain[randomInt(rng, plain.size())];
+        if (level.tiles[s.first][s.second] == TILE_NORMAL && s != b) {
+            level.tiles[s.first][s.second] = TILE_SWITCH;
+            int horizontal = randomInt(rng, 2), length = 1 + randomInt(rng, 3);
+            for (int i=0; i<length; i++) {
+                int x = b.first + (horizontal ? 0 : i), z = b.second + (horizontal ? i : 0);
+                if (inside(x, z) && level.tiles[x][z] == TILE_NORMAL)
+                    level.tiles[x][z] = TILE_BRIDGE;
+            }
+        }
+    }
+}
+
+static void tryCandidate (long candidate)
+{
+    tried++;
+
+    GeneratedLevel level;
+    level.candidate = candidate;
+    // never 0, xorshift would stay there
+    generateBoard(((opts.seed * 2654435761u) ^ (unsigned int)(candidate * 40503)) | 1, level);
+
+    level.moves = solveBoard(&level.tiles[0][0], LEVEL_ROWS, LEVEL_COLS, 2*level.start_x, 2*level.start_z);
+    if (level.moves < 0) {
+        unsolvable++;
+        return;
+    }
+    if (level.moves < opts.min_moves || level.moves > opts.max_moves) {
+        out_of_band++;
+        return;
+    }
+
+    kept++;
+    lock_guard<mutex> lock(found_lock);
+    found.push_back(level);
+}
+
+/* Candidates [begin, end), halved until small so idle workers have
+   something to steal */
+static void generateRange (long begin, long end)
+{
+    while (end - begin > 64) {
+        long mid = begin + (end - begin) / 2;
+        jobsSubmit(pool, [mid, end] { generateRange(mid, end); });
+        end = mid;
+    }
+    for (long c=begin; c<end; c++)
+        tryCandidate(c);
+}
+
+static void savePack (const char* path, vector<GeneratedLevel>& levels)
+{
+    vector<Board> boards(levels.size());
+    for (size_t i=0; i<levels.size(); i++) {
+        const GeneratedLevel& l = levels[i];
+        Board& b = boards[i];
+        b.rows = LEVEL_ROWS;
+        b.cols = LEVEL_COLS;
+        b.start_x = l.start_x;
+        b.start_z = l.start_z;
+        b.moves = l.moves;
+        b.tiles.assign(&l.tiles[0][0], &l.tiles[0][0] + LEVEL_ROWS*LEVEL_COLS);
+    }
+    if (!writePack(path, boards)) {
+        printf("Cannot write %s\n", path);
+        exit(1);
+    }
+}
+
+int main (int argc, char** argv)
+{
+    for (int i=1; i<argc; i++) {
+        if (strncmp(argv[i], "--count=", 8) == 0)
+            opts.count = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--min-moves=", 12) == 0)
+            opts.min_moves = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--max-moves=", 12) == 0)
+            opts.max_moves = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            opts.threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--seed=", 7) == 0)
+            opts.seed = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--out=", 6) == 0)
+            opts.out = argv[i] + 6;
+        else {
+            printf("usage: %s [--count=N] [--min-moves=N] [--max-moves=N] [--threads=N] [--seed=N] [--out=FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    pool = jobsCreate(opts.threads);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // whole rounds of candidates until enough levels made it through the
+    // band, so the pack does not depend on which worker got where
+    long next = 0, round = 4096;
+    while (kept < opts.count) {
+        long begin = next, end = next + round;
+        jobsSubmit(pool, [begin, end] { generateRange(begin, end); });
+        jobsWait(pool);
+        next = end;
+        if (next > 1000L * round) {
+            printf("Giving up, the band %d-%d is too narrow\n", opts.min_moves, opts.max_moves);
+            break;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // the first count candidates in index order, whatever the thread timing
+    sort(found.begin(), found.end(), [](const GeneratedLevel& a, const GeneratedLevel& b) {
+        return a.candidate < b.candidate;
+    });
+    if ((int)found.size() > opts.count)
+        found.resize(opts.count);
+    savePack(opts.out, found);
+
+    int histogram[64] = {0};
+    for (size_t i=0; i<found.size(); i++)
+        histogram[min(63, found[i].moves)]++;
+    printf("%zu levels written to %s\n", found.size(), opts.out);
+    printf("%ld candidates : %ld unsolvable, %ld outside %d-%d moves\n",
+           (long)tried, (long)unsolvable, (long)out_of_band, opts.min_moves, opts.max_moves);
+    printf("%.2f s on %d threads (%ld steals), %.0f levels/min\n",
+           seconds, jobsThreadCount(pool), jobsSteals(pool), found.size() * 60 / seconds);
+    for (int t=0; t<=jobsThreadCount(pool); t++) {
+        JobWorkerStats w = jobsWorkerStats(pool, t);
+        if (w.jobs > 0)
+            printf("  %s %2d : %6ld jobs, %5.1f%% busy\n", t < jobsThreadCount(pool) ? "worker" : "main  ",
+                   t, w.jobs, 100 * w.busy_ms / w.alive_ms);
+    }
+    for (int m=opts.min_moves; m<=min(63, opts.max_moves); m++)
+        if (histogram[m])
+            printf("  %2d moves : %d\n", m, histogram[m]);
+
+    jobsDestroy(pool);
+    return 0;
+}
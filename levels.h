@@ -0,0 +1,182 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <stdint.h>
+
+#include "logic.h"
+
+/* Everything derived from map1, computed by the compiler : the checks
+   below turn a broken level into a build error, and the tile lists and
+   bitboards are tables in the binary, so entering a level parses and
+   allocates nothing. */
+
+/* Tiles drawn for a level, bridges last so they can be left out by
+   drawing only the first `solid` entries until the switch is pressed */
+struct LevelTile {
+    int x, z;
+    int type;
+};
+
+struct LevelTiles {
+    int count;      // tiles to draw once the bridge is on
+    int solid;      // tiles to draw before, everything but the bridges
+    LevelTile tiles[LEVEL_ROWS*LEVEL_COLS];
+};
+
+/* One bit per tile, bit x*LEVEL_COLS + z */
+#define BITBOARD_WORDS ((LEVEL_ROWS*LEVEL_COLS + 63) / 64)
+
+struct Bitboard {
+    uint64_t bits[BITBOARD_WORDS];
+};
+
+struct LevelBitboards {
+    Bitboard floor;     // anything the block can be over
+    Bitboard fragile;
+    Bitboard bridge;
+    Bitboard switches;
+    Bitboard goal;
+};
+
+constexpr bool bitboardTest (const Bitboard& b, int x, int z)
+{
+    return x >= 0 && z >= 0 && x < LEVEL_ROWS && z < LEVEL_COLS
+        && (b.bits[(x*LEVEL_COLS + z) / 64] >> ((x*LEVEL_COLS + z) % 64)) & 1;
+}
+
+constexpr int countTiles (int level, int type)
+{
+    int count = 0;
+    for (int x=0; x<LEVEL_ROWS; x++)
+        for (int z=0; z<LEVEL_COLS; z++)
+            if (map1[level][x][z] == type)
+                count++;
+    return count;
+}
+
+constexpr LevelTiles bakeLevelTiles (int level)
+{
+    LevelTiles t {};
+    // goal tiles are holes, nothing to draw
+    const int order[4] = { TILE_NORMAL, TILE_FRAGILE, TILE_SWITCH, TILE_BRIDGE };
+    for (int i=0; i<4; i++) {
+        if (order[i] == TILE_BRIDGE)
+            t.solid = t.count;
+        for (int x=0; x<LEVEL_ROWS; x++)
+            for (int z=0; z<LEVEL_COLS; z++)
+                if (map1[level][x][z] == order[i]) {
+                    t.tiles[t.count].x = x;
+                    t.tiles[t.count].z = z;
+                    t.tiles[t.count].type = order[i];
+                    t.count++;
+                }
+    }
+    return t;
+}
+
+constexpr Bitboard bakeBitboard (int level, int type)
+{
+    Bitboard b {};
+    for (int i=0; i<LEVEL_ROWS*LEVEL_COLS; i++) {
+        int tile = map1[level][i / LEVEL_COLS][i % LEVEL_COLS];
+        if (type < 0 ? tile != TILE_EMPTY : tile == type)
+            b.bits[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    return b;
+}
+
+constexpr LevelBitboards bakeLevelBitboards (int level)
+{
+    return LevelBitboards {
+        bakeBitboard(level, -1),
+        bakeBitboard(level, TILE_FRAGILE),
+        bakeBitboard(level, TILE_BRIDGE),
+        bakeBitboard(level, TILE_SWITCH),
+        bakeBitboard(level, TILE_GOAL),
+    };
+}
+
+/* solveBoard for an embedded level, in a constant expression : fewest
+   arrow keys from the start to a win, -1 if there is no way */
+constexpr int solveLevel (int level)
+{
+    // a flat copy : walking map1[level] row to row with one pointer is not
+    // allowed in a constant expression
+    int tiles[LEVEL_ROWS*LEVEL_COLS] {};
+    for (int i=0; i<LEVEL_ROWS*LEVEL_COLS; i++)
+        tiles[i] = map1[level][i / LEVEL_COLS][i % LEVEL_COLS];
+
+    // x2 in [-1, 2*LEVEL_ROWS), z2 in [-1, 2*LEVEL_COLS), see solveBoard
+    const int w = 2*LEVEL_ROWS + 1, h = 2*LEVEL_COLS + 1;
+    bool seen[w*h*4*2] {};
+    GameState queue[w*h*4*2] {};
+
+    GameState start { 2*initPos[level][0], 2*initPos[level][1], BLOCK_STANDING, level, 0, 0 };
+    if (blockSupport(tiles, LEVEL_ROWS, LEVEL_COLS, start.x2, start.z2, BLOCK_STANDING, 0) != SUPPORT_OK)
+        return -1;
+    seen[(((start.x2+1)*h + start.z2+1)*4 + BLOCK_STANDING)*2] = true;
+    queue[0] = start;
+
+    int tail = 1;
+    for (int head=0; head<tail; head++) {
+        for (int key=KEY_LEFT; key<=KEY_DOWN; key++) {
+            GameState g = queue[head];
+            int support = stepBoard(tiles, LEVEL_ROWS, LEVEL_COLS, g, key);
+            if (support == SUPPORT_GOAL)
+                return g.moves;
+            if (support != SUPPORT_OK)
+                continue;
+            int index = (((g.x2+1)*h + g.z2+1)*4 + g.state)*2 + g.bridge;
+            if (seen[index])
+                continue;
+            seen[index] = true;
+            queue[tail++] = g;
+        }
+    }
+    return -1;
+}
+
+/* The start tile holds a standing block : not a hole, a fragile tile or
+   a bridge that is still off */
+constexpr bool startIsSolid (int level)
+{
+    int tile = map1[level][initPos[level][0]][initPos[level][1]];
+    return tile == TILE_NORMAL || tile == TILE_SWITCH;
+}
+
+/* Bridges only ever appear through a switch, and a switch has a bridge */
+constexpr bool bridgesHaveSwitch (int level)
+{
+    return (countTiles(level, TILE_BRIDGE) > 0) == (countTiles(level, TILE_SWITCH) > 0);
+}
+
+constexpr bool startInside (int level)
+{
+    return initPos[level][0] >= 0 && initPos[level][0] < LEVEL_ROWS
+        && initPos[level][1] >= 0 && initPos[level][1] < LEVEL_COLS;
+}
+
+static_assert(startInside(0) && startInside(1) && startInside(2),
+              "a level starts outside of the board (initPos)");
+static_assert(startIsSolid(0) && startIsSolid(1) && startIsSolid(2),
+              "a level starts on a tile that can not hold a standing block");
+static_assert(bridgesHaveSwitch(0) && bridgesHaveSwitch(1) && bridgesHaveSwitch(2),
+              "a level has bridges without a switch, or a switch without bridges");
+static_assert(countTiles(0, TILE_GOAL) == 1 && countTiles(1, TILE_GOAL) == 1 && countTiles(2, TILE_GOAL) == 1,
+              "every level needs exactly one goal");
+static_assert(LEVELS == 3, "the checks above and the tables below list every level");
+
+/* Optimal solutions, the goal check is that they exist at all */
+static constexpr int level_solutions[LEVELS] = { solveLevel(0), solveLevel(1), solveLevel(2) };
+static_assert(level_solutions[0] > 0 && level_solutions[1] > 0 && level_solutions[2] > 0,
+              "the goal of a level can not be reached");
+
+static constexpr LevelTiles level_tiles[LEVELS] = {
+    bakeLevelTiles(0), bakeLevelTiles(1), bakeLevelTiles(2),
+};
+
+static constexpr LevelBitboards level_bitboards[LEVELS] = {
+    bakeLevelBitboards(0), bakeLevelBitboards(1), bakeLevelBitboards(2),
+};
+
+#endif
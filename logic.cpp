@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "logic.h"
+
+void resetGame (GameState& g, int level)
+{
+    g.level = level;
+    g.x2 = 2*initPos[level][0];
+    g.z2 = 2*initPos[level][1];
+    g.state = BLOCK_STANDING;
+    g.bridge = 0;
+}
+
+int stepGame (GameState& g, int key)
+{
+    return stepBoard(&map1[g.level][0][0], LEVEL_ROWS, LEVEL_COLS, g, key);
+}
+
+int solveBoard (const int* tiles, int rows, int cols, int x2, int z2)
+{
+    // every state the block can rest in without falling has x2 in [-1, 2*rows)
+    // and z2 in [-1, 2*cols) (-1 truncates to tile 0), so they index a flat
+    // visited table
+    int w = 2*rows + 1, h = 2*cols + 1;
+    std::vector<unsigned char> seen(w*h*4*2, 0);
+    std::vector<GameState> queue;
+    queue.reserve(64);
+
+    GameState start = { x2, z2, BLOCK_STANDING, 0, 0, 0 };
+    if (blockSupport(tiles, rows, cols, x2, z2, BLOCK_STANDING, 0) != SUPPORT_OK)
+        return -1;
+    seen[(((x2+1)*h + z2+1)*4 + BLOCK_STANDING)*2] = 1;
+    queue.push_back(start);
+
+    for (size_t head=0; head<queue.size(); head++) {
+        for (int key=KEY_LEFT; key<=KEY_DOWN; key++) {
+            GameState g = queue[head];
+            int support = stepBoard(tiles, rows, cols, g, key);
+            if (support == SUPPORT_GOAL)
+                return g.moves;
+            if (support != SUPPORT_OK)
+                continue;
+            int index = (((g.x2+1)*h + g.z2+1)*4 + g.state)*2 + g.bridge;
+            if (seen[index])
+                continue;
+            seen[index] = 1;
+            queue.push_back(g);
+        }
+    }
+    return -1;
+}
+
+/* bits 0-7 x2 and 8-15 z2 (offset by 128), 16-17 state, 18-19 level,
+   20 bridge, 21 falling, 22-24 key, 25-26 from_state, 32-63 moves */
+Snapshot packSnapshot (const SnapshotInfo& info)
+{
+    const GameState& g = info.game;
+    return (Snapshot)((g.x2 + 128) & 0xff)
+        | (Snapshot)((g.z2 + 128) & 0xff) << 8
+        | (Snapshot)(g.state & 3) << 16
+        | (Snapshot)(g.level & 3) << 18
+        | (Snapshot)(g.bridge & 1) << 20
+        | (Snapshot)info.falling << 21
+        | (Snapshot)(info.key & 7) << 22
+        | (Snapshot)(info.from_state & 3) << 25
+        | (Snapshot)(uint32_t)g.moves << 32;
+}
+
+SnapshotInfo unpackSnapshot (Snapshot s)
+{
+    SnapshotInfo info;
+    info.game.x2 = (int)(s & 0xff) - 128;
+    info.game.z2 = (int)(s >> 8 & 0xff) - 128;
+    info.game.state = s >> 16 & 3;
+    info.game.level = s >> 18 & 3;
+    info.game.bridge = s >> 20 & 1;
+    info.falling = s >> 21 & 1;
+    info.key = s >> 22 & 7;
+    info.from_state = s >> 25 & 3;
+    info.game.moves = (int)(uint32_t)(s >> 32);
+    return info;
+}
+
+void historyClear (History& h)
+{
+    h.newest = 0;
+    h.count = 0;
+}
+
+void historyPush (History& h, Snapshot s)
+{
+    h.newest = (h.newest + 1) % HISTORY_SIZE;
+    h.ring[h.newest] = s;
+    if (h.count < HISTORY_SIZE)
+        h.count++;
+}
+
+void historyMarkFalling (History& h)
+{
+    if (h.count > 0)
+        h.ring[h.newest] |= (Snapshot)1 << 21;
+}
+
+Snapshot historyRewind (History& h, int n)
+{
+    n = std::max(0, std::min(n, (int)h.count - 1));
+    h.newest = (h.newest + HISTORY_SIZE - n) % HISTORY_SIZE;
+    h.count -= n;
+    // the state the block fell from is only there to be rewound past
+    if (h.count > 1 && unpackSnapshot(h.ring[h.newest]).falling) {
+        h.newest = (h.newest + HISTORY_SIZE - 1) % HISTORY_SIZE;
+        h.count--;
+    }
+    return h.ring[h.newest];
+}
+
+void buildDistanceField (const int* tiles, int rows, int cols, DistanceField& field)
+{
+    field.rows = rows;
+    field.cols = cols;
+    int size = (2*rows+1) * (2*cols+1) * 4 * 2;
+    field.dist.assign(size, DISTANCE_UNREACHABLE);
+
+    // the moves between resting states, reversed : for each state the
+    // states one key press before it, in one flat array
+    std::vector<int> from, to, first(size+1, 0), before;
+    std::vector<int> queue;
+    for (int x2=-1; x2<2*rows; x2++)
+        for (int z2=-1; z2<2*cols; z2++)
+            for (int state=BLOCK_STANDING; state<=BLOCK_LYING_X; state++)
+                for (int bridge=0; bridge<2; bridge++) {
+                    if (blockSupport(tiles, rows, cols, x2, z2, state, bridge) != SUPPORT_OK)
+                        continue;
+                    int index = distanceIndex(cols, x2, z2, state, bridge);
+                    for (int key=KEY_LEFT; key<=KEY_DOWN; key++) {
+                        GameState g = { x2, z2, state, 0, bridge, 0 };
+                        int support = stepBoard(tiles, rows, cols, g, key);
+                        if (support == SUPPORT_GOAL && field.dist[index] != 1) {
+                            field.dist[index] = 1;
+                            queue.push_back(index);
+                        }
+                        else if (support == SUPPORT_OK) {
+                            from.push_back(index);
+                            to.push_back(distanceIndex(cols, g.x2, g.z2, g.state, g.bridge));
+                            first[to.back()+1]++;
+                        }
+                    }
+                }
+    for (int i=0; i<size; i++)
+        first[i+1] += first[i];
+    before.resize(from.size());
+    std::vector<int> fill(first.begin(), first.end() - 1);
+    for (size_t e=0; e<from.size(); e++)
+        before[fill[to[e]]++] = from[e];
+
+    for (size_t head=0; head<queue.size(); head++) {
+        int index = queue[head];
+        int next = std::min(DISTANCE_UNREACHABLE - 1, field.dist[index] + 1);
+        for (int e=first[index]; e<first[index+1]; e++)
+            if (field.dist[before[e]] == DISTANCE_UNREACHABLE) {
+                field.dist[before[e]] = next;
+                queue.push_back(before[e]);
+            }
+    }
+}
+
+int distanceToGoal (const DistanceField& field, const GameState& g)
+{
+    if (g.x2 < -1 || g.z2 < -1 || g.x2 >= 2*field.rows || g.z2 >= 2*field.cols)
+        return DISTANCE_UNREACHABLE;
+    return field.dist[distanceIndex(field.cols, g.x2, g.z2, g.state, g.bridge)];
+}
+
+int hintMove (const int* tiles, const DistanceField& field, const GameState& g)
+{
+    int best = KEY_NONE, best_distance = DISTANCE_UNREACHABLE;
+    for (int key=KEY_LEFT; key<=KEY_DOWN; key++) {
+        GameState next = g;
+        int support = stepBoard(tiles, field.rows, field.cols, next, key);
+        if (support == SUPPORT_GOAL)
+            return key;
+        if (support != SUPPORT_OK)
+            continue;
+        int distance = distanceToGoal(field, next);
+        if (distance < best_distance) {
+            best = key;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+bool readPack (const char* path, std::vector<Board>& boards)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+    Board b;
+    bool ok = true;
+    while (fscanf(f, " level %d %d %d %d %d", &b.rows, &b.cols, &b.start_x, &b.start_z, &b.moves) == 5) {
+        if (b.rows <= 0 || b.cols <= 0) {
+            ok = false;
+            break;
+        }
+        b.tiles.assign((size_t)b.rows * b.cols, TILE_EMPTY);
+        for (size_t i=0; i<b.tiles.size() && ok; i++) {
+            int c = fgetc(f);
+            while (c == '\n' || c == '\r' || c == ' ')
+                c = fgetc(f);
+            if (c < '0' || c > '0' + TILE_SWITCH)
+                ok = false;
+            b.tiles[i] = c - '0';
+        }
+        if (!ok)
+            break;
+        boards.push_back(b);
+    }
+    fclose(f);
+    return ok && !boards.empty();
+}
+
+bool writePack (const char* path, const std::vector<Board>& boards)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return false;
+    for (size_t i=0; i<boards.size(); i++) {
+        const Board& b = boards[i];
+        fprintf(f, "level %d %d %d %d %d\n", b.rows, b.cols, b.start_x, b.start_z, b.moves);
+        for (int x=0; x<b.rows; x++) {
+            for (int z=0; z<b.cols; z++)
+                fputc('0' + b.tiles[(size_t)x*b.cols + z], f);
+            fputc('\n', f);
+        }
+    }
+    return fclose(f) == 0;
+}
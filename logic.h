@@ -0,0 +1,270 @@
+#ifndef LOGIC_H
+#define LOGIC_H
+
+/* Game rules shared by the game (moveBlock) and the headless tools.
+   Positions are counted in half tiles, a lying block sits between two
+   tiles, and only the tile under (int)block_pos.x, (int)block_pos.z
+   is checked for support, as the game always did. The rules are
+   constexpr so levels.h can check the embedded levels while compiling. */
+
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#define LEVELS 3
+#define LEVEL_ROWS 11
+#define LEVEL_COLS 15
+
+/* map1 values */
+enum {
+    TILE_EMPTY = 0,
+    TILE_NORMAL = 1,
+    TILE_GOAL = 2,
+    TILE_FRAGILE = 3,
+    TILE_BRIDGE = 4,
+    TILE_SWITCH = 5,
+};
+
+/* arrow_key values */
+enum {
+    KEY_NONE = 0,
+    KEY_LEFT = 1,
+    KEY_RIGHT = 2,
+    KEY_UP = 3,
+    KEY_DOWN = 4,
+};
+
+/* blockState values */
+enum {
+    BLOCK_STANDING = 1,
+    BLOCK_LYING_Z = 2,
+    BLOCK_LYING_X = 3,
+};
+
+/* Result of blockSupport() */
+enum {
+    SUPPORT_OK,
+    SUPPORT_GOAL,     // standing on the goal
+    SUPPORT_FRAGILE,  // standing on a fragile tile
+    SUPPORT_FALL,     // nothing (or a bridge that is not switched on) below
+};
+
+constexpr int map1[LEVELS][LEVEL_ROWS][LEVEL_COLS] = {
+    {
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,1,1,1,0,0,0,0,0,0,0,0,0,0,0},
+        {0,1,1,1,1,1,1,0,0,0,0,0,0,0,0},
+        {0,1,1,1,1,1,1,1,0,0,0,0,0,0,0},
+        {0,0,1,1,1,1,1,1,1,0,0,0,0,0,0},
+        {0,0,0,0,1,1,2,1,1,0,0,0,0,0,0},
+        {0,0,0,0,0,1,3,1,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    },
+    {
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,1,1,1,1,1,3,3,0,0},
+        {1,1,1,1,0,0,1,1,1,0,0,3,3,0,0},
+        {1,1,1,1,4,4,1,1,1,1,1,3,3,1,1},
+        {1,5,1,1,4,4,1,1,1,1,1,3,3,2,1},
+        {1,1,1,1,0,0,0,0,0,0,0,1,1,1,1},
+        {0,0,0,0,0,0,0,0,0,0,0,0,1,1,1},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    },
+    {
+        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+        {0,0,0,0,0,1,1,1,1,1,1,0,0,0,0},
+        {0,0,0,0,0,1,1,1,1,1,1,0,0,0,0},
+        {0,0,0,0,0,1,1,1,1,1,1,1,1,0,0},
+        {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1},
+        {0,0,0,0,1,1,1,1,1,1,1,1,1,2,1},
+        {0,0,0,0,1,1,1,0,0,0,0,0,1,1,1},
+        {0,0,0,0,0,0,1,0,0,1,1,0,0,0,0},
+        {0,0,0,0,0,0,1,1,1,1,1,0,0,0,0},
+        {0,0,0,0,0,0,1,1,1,1,1,0,0,0,0},
+        {0,0,0,0,0,0,0,1,1,1,0,0,0,0,0},
+    },
+};
+constexpr int initPos[LEVELS][2] = {
+    {2,2},
+    {4,1},
+    {4,0},
+};
+
+/* How an arrow key moves the block, indexed [blockState][arrow_key] */
+struct BlockMove {
+    int dx2, dz2;       // position change, in half tiles
+    int state;          // blockState after the move
+    float y;            // block_pos.y after the move
+    float rotation;     // blockRotation after the move
+    float axis[3];      // rotation axis after the move
+};
+constexpr BlockMove block_moves[4][5] = {
+    {},
+    // standing
+    {
+        {},
+        { -3, 0, BLOCK_LYING_X, 0.5, M_PI/2, {0,0,1} },
+        { 3, 0, BLOCK_LYING_X, 0.5, M_PI/2, {0,0,1} },
+        { 0, -3, BLOCK_LYING_Z, 0.5, M_PI/2, {1,0,0} },
+        { 0, 3, BLOCK_LYING_Z, 0.5, -M_PI/2, {-1,0,0} },
+    },
+    // lying along z
+    {
+        {},
+        { -2, 0, BLOCK_LYING_Z, 0.5, M_PI/2, {1,0,0} },
+        { 2, 0, BLOCK_LYING_Z, 0.5, M_PI/2, {1,0,0} },
+        { 0, -3, BLOCK_STANDING, 1, M_PI/2, {0,-1,0} },
+        { 0, 3, BLOCK_STANDING, 1, M_PI/2, {0,1,0} },
+    },
+    // lying along x
+    {
+        {},
+        { -3, 0, BLOCK_STANDING, 1, M_PI/2, {0,1,0} },
+        { 3, 0, BLOCK_STANDING, 0.5, M_PI, {0,0,1} },
+        { 0, -2, BLOCK_LYING_X, 0.5, M_PI/2, {0,0,1} },
+        { 0, 2, BLOCK_LYING_X, 0.5, M_PI/2, {0,0,1} },
+    },
+};
+
+/* Tile at x, z of a rows x cols board, empty outside of it */
+constexpr int tileAt (const int* tiles, int rows, int cols, int x, int z)
+{
+    if (x < 0 || z < 0 || x >= rows || z >= cols)
+        return TILE_EMPTY;
+    return tiles[x*cols + z];
+}
+
+/* What the block at x2, z2 (half tiles) rests on */
+constexpr int blockSupport (const int* tiles, int rows, int cols, int x2, int z2, int state, int bridge)
+{
+    // (int) of a half tile position, truncated towards zero like the float cast
+    int x = x2 / 2, z = z2 / 2;
+    int tile = tileAt(tiles, rows, cols, x, z);
+
+    if (tile == TILE_GOAL && state == BLOCK_STANDING)
+        return SUPPORT_GOAL;
+    if (tile == TILE_FRAGILE && state == BLOCK_STANDING)
+        return SUPPORT_FRAGILE;
+    if (tile == TILE_EMPTY || (tile == TILE_BRIDGE && !bridge) || x < 0 || z < 0)
+        return SUPPORT_FALL;
+    return SUPPORT_OK;
+}
+
+/* Compact state of one game of the embedded levels */
+struct GameState {
+    int x2, z2;     // block_pos.x and block_pos.z in half tiles
+    int state;      // blockState
+    int level;
+    int bridge;     // bridge_toggle
+    int moves;
+};
+
+/* Puts the block back on the start tile of level, moves are kept */
+void resetGame (GameState& g, int level);
+
+/* Applies one arrow key : the switch check done on key press, the move,
+   then the support check moveBlock does on the next frame. The level is
+   not changed, the caller decides what a win or a fall leads to. */
+int stepGame (GameState& g, int key);
+
+/* stepGame on any rows x cols board, g.level is not used */
+constexpr int stepBoard (const int* tiles, int rows, int cols, GameState& g, int key)
+{
+    // checkBridges : standing on the switch turns the bridge on
+    if (g.state == BLOCK_STANDING && tileAt(tiles, rows, cols, g.x2/2, g.z2/2) == TILE_SWITCH)
+        g.bridge = 1;
+
+    if (key < KEY_LEFT || key > KEY_DOWN)
+        return blockSupport(tiles, rows, cols, g.x2, g.z2, g.state, g.bridge);
+
+    const BlockMove& m = block_moves[g.state][key];
+    g.x2 += m.dx2;
+    g.z2 += m.dz2;
+    g.state = m.state;
+    g.moves++;
+
+    return blockSupport(tiles, rows, cols, g.x2, g.z2, g.state, g.bridge);
+}
+
+/* One step of the undo history packed in 64 bits : the game state, the
+   move that led to it (for the block pose, see block_moves) and whether
+   the block fell off or broke through a fragile tile there */
+typedef uint64_t Snapshot;
+
+struct SnapshotInfo {
+    GameState game;
+    int key;            // arrow key of the move into this state, KEY_NONE at the start
+    int from_state;     // blockState before that move
+    bool falling;
+};
+
+Snapshot packSnapshot (const SnapshotInfo& info);
+SnapshotInfo unpackSnapshot (Snapshot s);
+
+/* Ring of the last HISTORY_SIZE snapshots, the oldest drop off. Pushing
+   and rewinding any number of moves only move an index. */
+#define HISTORY_SIZE 1024
+
+struct History {
+    Snapshot ring[HISTORY_SIZE];
+    unsigned int newest;    // slot of the newest snapshot
+    unsigned int count;
+};
+
+void historyClear (History& h);
+void historyPush (History& h, Snapshot s);
+/* Flags the newest snapshot as a state the block fell from */
+void historyMarkFalling (History& h);
+/* Drops the newest n moves (never the oldest snapshot), landing before a
+   fall rather than on it, and returns the snapshot that is newest now */
+Snapshot historyRewind (History& h, int n);
+
+/* Fewest arrow keys from a standing block at x2, z2 to a win on the board,
+   by a breadth first search over (position, blockState, bridge), -1 if the
+   goal can not be reached */
+int solveBoard (const int* tiles, int rows, int cols, int x2, int z2);
+
+/* Moves left to a win from every state of a board, filled by a breadth
+   first search backwards from the goal. The bridge flag is part of the
+   state, so one field covers the board before and after the switch. */
+#define DISTANCE_UNREACHABLE 255
+
+struct DistanceField {
+    int rows, cols;
+    std::vector<uint8_t> dist;      // indexed by distanceIndex
+};
+
+constexpr int distanceIndex (int cols, int x2, int z2, int state, int bridge)
+{
+    // x2 in [-1, 2*rows), z2 in [-1, 2*cols), see solveBoard
+    return (((x2+1)*(2*cols+1) + z2+1)*4 + state)*2 + bridge;
+}
+
+void buildDistanceField (const int* tiles, int rows, int cols, DistanceField& field);
+
+/* Moves left from g, DISTANCE_UNREACHABLE if it can not win any more */
+int distanceToGoal (const DistanceField& field, const GameState& g);
+
+/* The arrow key that gets closest to the goal, KEY_NONE if there is none */
+int hintMove (const int* tiles, const DistanceField& field, const GameState& g);
+
+/* A board of any size that is not built in : levelgen packs, the editor */
+struct Board {
+    int rows, cols;
+    int start_x, start_z;       // tile the block starts standing on
+    int moves;                  // shortest solution, -1 when unsolvable
+    std::vector<int> tiles;     // rows*cols tile types, row major
+};
+
+/* Level pack : per level a line "level ROWS COLS STARTX STARTZ MOVES"
+   then ROWS lines of COLS tile digits */
+bool readPack (const char* path, std::vector<Board>& boards);
+bool writePack (const char* path, const std::vector<Board>& boards);
+
+#endif
@@ -1,5 +1,9 @@
 #include <bits/stdc++.h>
 #include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -10,6 +14,17 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "broadcast.h"
+#include "capture.h"
+#include "font.h"
+#include "jobs.h"
+#include "levels.h"
+#include "logic.h"
+#include "scene.h"
+#include "softrast.h"
+#include "stats.h"
+#include "triplebuffer.h"
+
 using namespace std;
 
 struct VAO {
@@ -24,42 +39,45 @@ struct VAO {
 typedef struct VAO VAO;
 
 struct GLMatrices {
-    glm::mat4 projectionO, projectionP;
     glm::mat4 model;
-    glm::mat4 view;
     GLuint MatrixID;
 } Matrices;
 
 GLuint programID;
 
+/* Reads a shader source file, empty if it cannot be opened */
+/* Safe to call from any thread, it does not touch GL */
+std::string readShaderFile(const char * file_path) {
+    std::string ShaderCode;
+    std::ifstream ShaderStream(file_path, std::ios::in);
+    if(ShaderStream.is_open())
+	{
+	    std::string Line = "";
+	    while(getline(ShaderStream, Line))
+		ShaderCode += "\n" + Line;
+	    ShaderStream.close();
+	}
+    return ShaderCode;
+}
+
+/* Without fragment code the program has a vertex shader only. The named
+   feedback varyings are captured interleaved by transform feedback. */
+GLuint CompileShaders(const std::string& VertexShaderCode, const std::string& FragmentShaderCode,
+                      const char* const* FeedbackVaryings = NULL, int FeedbackCount = 0);
+
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+    return CompileShaders(readShaderFile(vertex_file_path), readShaderFile(fragment_file_path));
+}
+
+/* Compile and link already loaded shader sources */
+GLuint CompileShaders(const std::string& VertexShaderCode, const std::string& FragmentShaderCode,
+                      const char* const* FeedbackVaryings, int FeedbackCount) {
 
     // Create the shaders
     GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
     GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-    // Read the Vertex Shader code from the file
-    std::string VertexShaderCode;
-    std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-    if(VertexShaderStream.is_open())
-	{
-	    std::string Line = "";
-	    while(getline(VertexShaderStream, Line))
-		VertexShaderCode += "\n" + Line;
-	    VertexShaderStream.close();
-	}
-
-    // Read the Fragment Shader code from the file
-    std::string FragmentShaderCode;
-    std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-    if(FragmentShaderStream.is_open()){
-	std::string Line = "";
-	while(getline(FragmentShaderStream, Line))
-	    FragmentShaderCode += "\n" + Line;
-	FragmentShaderStream.close();
-    }
-
     GLint Result = GL_FALSE;
     int InfoLogLength;
 
@@ -75,19 +93,25 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
 
     // Compile Fragment Shader
-    char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-    glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-    glCompileShader(FragmentShaderID);
-
-    // Check Fragment Shader
-    glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-    glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+    if (!FragmentShaderCode.empty()) {
+        char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+        glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+        glCompileShader(FragmentShaderID);
+
+        // Check Fragment Shader
+        glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
+        glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+        std::vector<char> FragmentShaderErrorMessage(max(InfoLogLength, int(1)));
+        glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+    }
 
     GLuint ProgramID = glCreateProgram();
     glAttachShader(ProgramID, VertexShaderID);
-    glAttachShader(ProgramID, FragmentShaderID);
+    if (!FragmentShaderCode.empty())
+        glAttachShader(ProgramID, FragmentShaderID);
+    // has to be set before linking
+    if (FeedbackCount > 0)
+        glTransformFeedbackVaryings(ProgramID, FeedbackCount, FeedbackVaryings, GL_INTERLEAVED_ATTRIBS);
     glLinkProgram(ProgramID);
 
     // Check the program
@@ -107,8 +131,16 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
+void finishCapture ();
+void stopRenderThread ();
+void stopLevelLoader ();
+
 void quit(GLFWwindow *window)
 {
+    // takes the GL context back from the render thread
+    stopRenderThread();
+    stopLevelLoader();
+    finishCapture();
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -124,6 +156,7 @@ void initGLEW(void){
 }
 
 /* Generate VAO, VBOs and return VAO handle */
+/* color_buffer_data may be NULL for objects colored in the shader (floor tiles) */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
     struct VAO* vao = new struct VAO;
@@ -135,11 +168,14 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     // Should be done after CreateWindow and before any other GL calls
     glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
     glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
+    vao->ColorBuffer = 0;
+    if (color_buffer_data != NULL)
+        glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
 
     glBindVertexArray (vao->VertexArrayID); // Bind the VAO
     glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+    statAdd(STAT_BUFFER_BYTES, 3*numVertices*sizeof(GLfloat));
     glVertexAttribPointer(
                           0,                  // attribute 0. Vertices
                           3,                  // size (x,y,z)
@@ -149,8 +185,12 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
                           (void*)0            // array buffer offset
                           );
 
+    if (vao->ColorBuffer == 0)
+        return vao;
+
     glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+    statAdd(STAT_BUFFER_BYTES, 3*numVertices*sizeof(GLfloat));
     glVertexAttribPointer(
                           1,                  // attribute 1. Color
                           3,                  // size (r,g,b)
@@ -166,15 +206,10 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat[3*numVertices];
-    for (int i=0; i<numVertices; i++)
-    {
-        color_buffer_data [3*i] = red;
-        color_buffer_data [3*i + 1] = green;
-        color_buffer_data [3*i + 2] = blue;
-    }
-
-    return create3DObject (primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    // glBufferData copies the colors, they go away with the vector
+    vector<GLfloat> color_buffer_data;
+    solidColors(color_buffer_data, numVertices, red, green, blue);
+    return create3DObject (primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
 }
 
 /* Render the VBOs handled by VAO */
@@ -185,19 +220,343 @@ void draw3DObject (struct VAO* vao)
 
     // Bind the VAO to use
     glBindVertexArray (vao->VertexArrayID);
+    statAdd(STAT_VAO_BINDS);
 
     // Enable Vertex Attribute 0 - 3d Vertices
     glEnableVertexAttribArray(0);
     // Bind the VBO to use
     glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    // Enable Vertex Attribute 1 - Color, unless the shader colors this object
+    if (vao->ColorBuffer != 0) {
+        glEnableVertexAttribArray(1);
+        // Bind the VBO to use
+        glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    }
 
     // Draw the geometry !
     glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+    statAdd(STAT_DRAW_CALLS);
+}
+
+/*****************************
+ * Per-frame streaming data  *
+ *****************************/
+
+/* Per-instance data read by Sample_GL.vert (attributes 2 to 6) */
+struct InstanceData {
+    GLfloat model[16];  // model matrix, column major
+    GLfloat type;       // map1 tile type, 0 for vertex colored objects
+    GLfloat pad[3];
+};
+
+/* Ring of regions for data rewritten every frame, STREAM_FRAMES to start
+   with. With glBufferStorage the whole ring stays mapped (persistent +
+   coherent) and is written with plain stores, a fence per region tells
+   when the GPU is done with it. Without it the frame is staged in memory
+   and uploaded into an orphaned buffer. */
+#define STREAM_FRAMES 3
+#define STREAM_MAX_FRAMES 12
+#define STREAM_FRAME_SIZE (256*1024)
+
+struct StreamBuffer {
+    GLuint buffer;
+    unsigned char* mapped;   // persistent mapping of all regions, NULL when orphaning
+    unsigned char* staging;  // frame data waiting for streamFlush when orphaning
+    vector<GLsync> fences;   // one per region
+    int frame;               // region written this frame
+    GLsizeiptr used;         // bytes allocated in it
+    GLsizeiptr uploaded;     // bytes already sent when orphaning
+    int stalls;              // times the GPU still had the next region, the ring grew
+} stream;
+
+/* A new persistently mapped ring of regions regions in stream.buffer,
+   false when the mapping fails */
+bool mapStreamRing (int regions)
+{
+    GLsizeiptr size = regions * (GLsizeiptr)STREAM_FRAME_SIZE;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    stream.mapped = (unsigned char*) glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (stream.mapped == NULL) {
+        // immutable storage cannot be respecified, the caller starts over
+        glDeleteBuffers(1, &stream.buffer);
+        stream.buffer = 0;
+        return false;
+    }
+    stream.fences.assign(regions, 0);
+    stream.frame = 0;
+    return true;
+}
+
+/* Staging memory and a buffer orphaned every frame */
+void startStreamOrphaning ()
+{
+    stream.staging = new unsigned char[STREAM_FRAME_SIZE];
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glBufferData(GL_ARRAY_BUFFER, STREAM_FRAME_SIZE, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void initStreamBuffer ()
+{
+    stream.mapped = stream.staging = NULL;
+    stream.frame = 0;
+    stream.used = stream.uploaded = 0;
+    stream.stalls = 0;
+    if (!GLEW_ARB_buffer_storage || !mapStreamRing(STREAM_FRAMES)) {
+        fprintf(stderr, "persistent mapping not available, orphaning stream buffers\n");
+        startStreamOrphaning();
+    }
+}
+
+/* Every region is still in flight : a ring twice the size instead of a
+   wait. The old buffer is deleted right away, GL keeps its storage until
+   the draws that read it are done. Past STREAM_MAX_FRAMES it orphans. */
+void growStreamRing ()
+{
+    int regions = stream.fences.size() * 2;
+    for (size_t i=0; i<stream.fences.size(); i++)
+        if (stream.fences[i])
+            glDeleteSync(stream.fences[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(1, &stream.buffer);
+    stream.mapped = NULL;
+    stream.fences.clear();
+
+    if (regions <= STREAM_MAX_FRAMES && mapStreamRing(regions))
+        printf("stream buffer : the GPU is %d frames behind, ring grown to %d regions\n", regions / 2, regions);
+    else {
+        printf("stream buffer : the GPU is too far behind, orphaning stream buffers\n");
+        startStreamOrphaning();
+    }
+}
+
+/* Moves to the next region of the ring, never waits for the GPU */
+void streamBeginFrame ()
+{
+    stream.used = 0;
+    stream.uploaded = 0;
+
+    if (stream.mapped != NULL) {
+        stream.frame = (stream.frame + 1) % stream.fences.size();
+        GLsync fence = stream.fences[stream.frame];
+        if (fence == 0)
+            return;
+        // the swap chain keeps fewer frames in flight than the ring has
+        // regions, the region is only busy if the driver queued more than that
+        if (glClientWaitSync(fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+            glDeleteSync(fence);
+            stream.fences[stream.frame] = 0;
+            return;
+        }
+        stream.stalls++;
+        growStreamRing();
+        if (stream.mapped != NULL)
+            return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glBufferData(GL_ARRAY_BUFFER, STREAM_FRAME_SIZE, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* Returns memory for bytes of this frame's data, offset is its position in stream.buffer */
+/* NULL when the frame region is full */
+void* streamAlloc (GLsizeiptr bytes, GLsizeiptr* offset)
+{
+    bytes = (bytes + 15) & ~(GLsizeiptr)15;
+    if (stream.used + bytes > STREAM_FRAME_SIZE)
+        return NULL;
+
+    unsigned char* ptr;
+    if (stream.mapped != NULL) {
+        *offset = stream.frame * STREAM_FRAME_SIZE + stream.used;
+        ptr = stream.mapped + *offset;
+    }
+    else {
+        *offset = stream.used;
+        ptr = stream.staging + stream.used;
+    }
+    stream.used += bytes;
+    statAdd(STAT_STREAM_BYTES, bytes);
+    return ptr;
+}
+
+/* Makes the data written so far visible to the draws that follow */
+void streamFlush ()
+{
+    // coherent mapping : the stores are already visible
+    if (stream.mapped != NULL || stream.used == stream.uploaded)
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, stream.uploaded, stream.used - stream.uploaded, stream.staging + stream.uploaded);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    stream.uploaded = stream.used;
+}
+
+/* Fences the region once the frame's draws are submitted */
+void streamEndFrame ()
+{
+    if (stream.mapped != NULL)
+        stream.fences[stream.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* Render count instances of the VAO, their InstanceData is at offset in buffer */
+void draw3DObjectInstancedFrom (struct VAO* vao, GLuint buffer, GLsizeiptr offset, int count)
+{
+    if (count == 0)
+        return;
+
+    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    glBindVertexArray (vao->VertexArrayID);
+    statAdd(STAT_VAO_BINDS);
+
+    // Attributes 2-5 - model matrix columns, 6 - tile type, one per instance
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (int c=0; c<4; c++) {
+        glEnableVertexAttribArray(2+c);
+        glVertexAttribPointer(2+c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + c*4*sizeof(GLfloat)));
+        glVertexAttribDivisor(2+c, 1);
+    }
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + 16*sizeof(GLfloat)));
+    glVertexAttribDivisor(6, 1);
+
+    glDrawArraysInstanced(vao->PrimitiveMode, 0, vao->NumVertices, count);
+    statAdd(STAT_DRAW_CALLS);
+}
+
+/* Same with the InstanceData at offset in the stream buffer */
+void draw3DObjectInstanced (struct VAO* vao, GLsizeiptr offset, int count)
+{
+    draw3DObjectInstancedFrom(vao, stream.buffer, offset, count);
+}
+
+/****************************
+ * Level upload prefetching *
+ ****************************/
+
+/* The tiles of a level live in a static instance buffer, uploaded ahead of
+   time by a loader thread through a hidden context that shares objects
+   with the main one. The loader fences the upload and publishes the level
+   in level_gpu[]; the renderer adopts it once the fence has passed, so a
+   level switch is a pointer swap. Until then, or without a shared context,
+   the tiles are streamed every frame. Uploaded levels stay for the session. */
+struct LevelGPU {
+    int level;
+    GLuint buffer;      // InstanceData of every tile, bridges last (levels.h)
+    GLsync fence;       // upload done, cleared by the renderer
+};
+
+atomic<LevelGPU*> level_gpu[LEVELS];
+LevelGPU* resident_level = NULL;   // renderer : where the tiles of the frame come from
+
+GLFWwindow* loader_window = NULL;
+thread loader_thread;
+mutex loader_lock;
+condition_variable loader_wake;
+deque<int> loader_requests;
+bool loader_quit = false;
+
+/* Bakes and uploads the tiles of level l, on the loader thread */
+void uploadLevel (int l)
+{
+    vector<SceneInstance> tiles;
+    levelInstances(tiles, l, level_tiles[l].count);
+    vector<InstanceData> data(tiles.size());
+    for (size_t i=0; i<tiles.size(); i++) {
+        memcpy(data[i].model, tiles[i].model, sizeof(data[i].model));
+        data[i].type = tiles[i].type;
+    }
+
+    LevelGPU* gpu = new LevelGPU;
+    gpu->level = l;
+    glGenBuffers(1, &gpu->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, gpu->buffer);
+    glBufferData(GL_ARRAY_BUFFER, data.size()*sizeof(InstanceData), data.empty() ? NULL : &data[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gpu->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // the fence has to reach the GPU before the other context can see it pass
+    glFlush();
+    level_gpu[l].store(gpu, memory_order_release);
+}
+
+void loaderLoop ()
+{
+    glfwMakeContextCurrent(loader_window);
+    for (;;) {
+        unique_lock<mutex> lock(loader_lock);
+        loader_wake.wait(lock, [] { return loader_quit || !loader_requests.empty(); });
+        if (loader_quit)
+            break;
+        int l = loader_requests.front();
+        loader_requests.pop_front();
+        lock.unlock();
+        if (level_gpu[l].load(memory_order_acquire) == NULL)
+            uploadLevel(l);
+    }
+    glfwMakeContextCurrent(NULL);
+}
+
+/* Creates the hidden shared context and the loader thread, on the main thread */
+void startLevelLoader (GLFWwindow* window)
+{
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    loader_window = glfwCreateWindow(1, 1, "loader", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (loader_window == NULL) {
+        fprintf(stderr, "no shared context, the tiles are streamed every frame\n");
+        return;
+    }
+    loader_thread = thread(loaderLoop);
+}
+
+void stopLevelLoader ()
+{
+    if (!loader_thread.joinable())
+        return;
+    {
+        lock_guard<mutex> lock(loader_lock);
+        loader_quit = true;
+        loader_wake.notify_one();
+    }
+    loader_thread.join();
+}
+
+/* Asks for the tiles of level l to be uploaded in the background */
+void prefetchLevel (int l)
+{
+    if (l < 0 || l >= LEVELS || loader_window == NULL)
+        return;
+    lock_guard<mutex> lock(loader_lock);
+    loader_requests.push_back(l);
+    loader_wake.notify_one();
+}
+
+/* The resident tiles of level l, NULL while they are not on the GPU yet */
+LevelGPU* levelTilesGPU (int l)
+{
+    if (resident_level != NULL && resident_level->level == l)
+        return resident_level;
+    LevelGPU* gpu = level_gpu[l].load(memory_order_acquire);
+    if (gpu == NULL)
+        return NULL;
+    if (gpu->fence) {
+        GLenum status = glClientWaitSync(gpu->fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return NULL;
+        glDeleteSync(gpu->fence);
+        gpu->fence = 0;
+    }
+    resident_level = gpu;
+    return gpu;
 }
 
 /**************************
@@ -214,111 +573,703 @@ int jump = 0;
 glm::vec3 block_pos(2,1,2), axis (0,0,1);
 glm::vec3 camera_pos(8,10,10), target_pos(0,0,0);
 double last_update_time, current_time;
+double level_start_time = 0;
+double key_event_time = -1;  // glfwGetTime() of the pending arrow key event
+double applied_key_time = -1, applied_key_ms = 0;  // last key moveBlock() applied, sent with the snapshots
+double frame_key_time = -1;  // renderer : key event of the move this frame shows first, -1 if none
+
+/* Send MVP to the "MVP" uniform of the bound program */
+void uploadMVP ()
+{
+    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    statAdd(STAT_UNIFORM_UPLOADS);
+}
 
-int initPos[3][2] = {
-    {2,2},
-    {4,1},
-    {4,0},
-};
 int bridgeCheck,bridge_toggle=0;
-int eyeX, eyeY, eyeZ;
-int targetX, targetY, targetZ;
 
-int map1[3][11][15] = {
-    {
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,1,1,1,0,0,0,0,0,0,0,0,0,0,0},
-        {0,1,1,1,1,1,1,0,0,0,0,0,0,0,0},
-        {0,1,1,1,1,1,1,1,0,0,0,0,0,0,0},
-        {0,0,1,1,1,1,1,1,1,0,0,0,0,0,0},
-        {0,0,0,0,1,1,2,1,1,0,0,0,0,0,0},
-        {0,0,0,0,0,1,3,1,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    },
-    {
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,1,1,1,1,1,3,3,0,0},
-        {1,1,1,1,0,0,1,1,1,0,0,3,3,0,0},
-        {1,1,1,1,4,4,1,1,1,1,1,3,3,1,1},
-        {1,5,1,1,4,4,1,1,1,1,1,3,3,2,1},
-        {1,1,1,1,0,0,0,0,0,0,0,1,1,1,1},
-        {0,0,0,0,0,0,0,0,0,0,0,0,1,1,1},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    },
-    {
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-        {0,0,0,0,0,1,1,1,1,1,1,0,0,0,0},
-        {0,0,0,0,0,1,1,1,1,1,1,0,0,0,0},
-        {0,0,0,0,0,1,1,1,1,1,1,1,1,0,0},
-        {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1},
-        {0,0,0,0,1,1,1,1,1,1,1,1,1,2,1},
-        {0,0,0,0,1,1,1,0,0,0,0,0,1,1,1},
-        {0,0,0,0,0,0,1,0,0,1,1,0,0,0,0},
-        {0,0,0,0,0,0,1,1,1,1,1,0,0,0,0},
-        {0,0,0,0,0,0,1,1,1,1,1,0,0,0,0},
-        {0,0,0,0,0,0,0,1,1,1,0,0,0,0,0},
-    },
-};
 int heliViewFlag = 0;
+int stats_overlay = 0;
+int hud_enabled = 1;
+int screenshot_requests = 0, capture_toggles = 0;  // F12, F11 : counted, the renderer acts on the change
+
+/* Anti-aliasing presets (F4, --fxaa=), see drawFxaa() */
+enum { FXAA_OFF, FXAA_LOW, FXAA_MEDIUM, FXAA_HIGH, FXAA_PRESETS };
+
+struct FxaaPreset {
+    const char* name;
+    float edge_threshold, edge_threshold_min;
+    float subpixel;
+    int search_steps;
+};
+
+static const FxaaPreset fxaa_presets[FXAA_PRESETS] = {
+    { "off", 0, 0, 0, 0 },
+    { "low", 0.25f, 0.0833f, 0.5f, 4 },
+    { "medium", 0.166f, 0.0625f, 0.75f, 8 },
+    { "high", 0.125f, 0.0312f, 1.0f, 12 },
+};
+
+int fxaa_preset = FXAA_OFF;
+
+void cycleFxaa ()
+{
+    fxaa_preset = (fxaa_preset + 1) % FXAA_PRESETS;
+    printf("FXAA %s\n", fxaa_presets[fxaa_preset].name);
+}
+
+/* Size of the buffer the scene is drawn into, see beginScene() */
+int render_width = 600, render_height = 600;
+
+/* Capture state, the readback itself happens in captureFrame() */
+int screenshot_requested = 0;
+int capture_continuous = 0;
+int capture_format = CAPTURE_Y4M;
+int capture_close_pending = 0;
+int screenshot_count = 0, capture_frame_count = 0;
+char capture_video_path[64];
+
+/* F11 : start or stop continuous capture */
+void toggleContinuousCapture ()
+{
+    capture_continuous ^= 1;
+    if (capture_continuous) {
+        snprintf(capture_video_path, sizeof(capture_video_path), "capture-%ld.y4m", (long)time(NULL));
+        capture_close_pending = 0;
+        printf("capture started\n");
+    }
+    else {
+        // the video is closed once the readbacks still in flight are encoded
+        capture_close_pending = (capture_format == CAPTURE_Y4M);
+        printf("capture stopped\n");
+    }
+}
+
+/* Sounds are decoded to WAV once, one job each at startup (see
+   startAssetLoading), and played with aplay. Until they are ready, or
+   without aplay, mpg123 decodes them every time they are played. */
+enum { SOUND_TICK, SOUND_CHEER, SOUND_LOSE, SOUND_COUNT };
+
+struct Sound {
+    const char* file;
+    int frames;             // mpg123 -n
+    char wav[64];
+    atomic<bool> decoded;
+};
+
+Sound sounds[SOUND_COUNT] = {
+    { "tick.mp3", 30 },
+    { "cheer.mp3", 100 },
+    { "lose.mp3", 100 },
+};
+
+bool have_aplay = false;
+
+void findAplay ()
+{
+    have_aplay = system("command -v aplay > /dev/null 2>&1") == 0;
+}
+
+/* Runs after findAplay */
+void decodeSound (int i)
+{
+    if (!have_aplay)
+        return;
+    char cmd[192];
+    snprintf(sounds[i].wav, sizeof(sounds[i].wav), "/tmp/bloxie-%d-%d.wav", (int)getpid(), i);
+    snprintf(cmd, sizeof(cmd), "mpg123 -q -n %d -w %s %s", sounds[i].frames, sounds[i].wav, sounds[i].file);
+    if (system(cmd) == 0)
+        sounds[i].decoded = true;
+}
+
+void removeDecodedSounds ()
+{
+    for (int i=0; i<SOUND_COUNT; i++)
+        if (sounds[i].decoded)
+            unlink(sounds[i].wav);
+}
+
+void playSound (int id)
+{
+    char cmd[192];
+    if (sounds[id].decoded)
+        snprintf(cmd, sizeof(cmd), "aplay -q %s &", sounds[id].wav);
+    else
+        snprintf(cmd, sizeof(cmd), "mpg123 -n %d -q %s &", sounds[id].frames, sounds[id].file);
+    system(cmd);
+}
+
+/* Particle bursts (see Particles), moveBlock() records them here and the
+   snapshots carry the last PARTICLE_EVENTS to the renderer, which emits
+   the ones it has not seen yet */
+enum { PARTICLE_FALL, PARTICLE_FRAGILE, PARTICLE_WIN, PARTICLE_KINDS };
+#define PARTICLE_EVENTS 8
+
+struct ParticleEvent {
+    int kind;
+    float origin[3];
+};
+
+ParticleEvent particle_events[PARTICLE_EVENTS];
+int particle_event_count = 0;
+
+void emitParticles (int kind, float x, float y, float z)
+{
+    ParticleEvent& e = particle_events[particle_event_count % PARTICLE_EVENTS];
+    e.kind = kind;
+    e.origin[0] = x;
+    e.origin[1] = y;
+    e.origin[2] = z;
+    particle_event_count++;
+}
+
+/* Rolls : a move puts the block on its new tiles at once, the vertex
+   shader (Sample_GL.vert) then shows it rolling there over ROLL_SECONDS
+   from what moveBlock() leaves here, set once per move. Until the roll is
+   over moveBlock() waits, and the arrow keys queue up in key_queue. */
+#define ROLL_SECONDS 0.18
+#define KEY_QUEUE 4
+
+struct BlockRoll {
+    int id;                   // changes with every roll, the renderer uploads it then
+    float from[16];           // block model before the move
+    float pivot[3], axis[3];  // the bottom edge the block turns around
+    float angle;              // signed, radians
+    float offset[3];          // where the turn alone does not land on the new pose
+    double start, duration;   // glfwGetTime(), seconds, 0 for no roll
+};
+
+BlockRoll block_roll;
+int key_queue[KEY_QUEUE];
+double key_queue_time[KEY_QUEUE];
+int key_queue_count = 0;
+
+bool blockRolling ()
+{
+    return glfwGetTime() < block_roll.start + block_roll.duration;
+}
+
+/* A key pressed while the queue is full is dropped, false then */
+bool queueArrowKey (int key)
+{
+    if (key_queue_count == KEY_QUEUE)
+        return false;
+    key_queue[key_queue_count] = key;
+    key_queue_time[key_queue_count] = glfwGetTime();
+    key_queue_count++;
+    return true;
+}
+
+/* True when moveBlock() would apply a key now */
+bool arrowKeyReady ()
+{
+    return key_queue_count > 0 && !blockRolling();
+}
+
+/* The block jumped (undo, restart), nothing to roll from */
+void cancelRoll ()
+{
+    block_roll.id++;
+    block_roll.duration = 0;
+    key_queue_count = 0;
+}
+
+/* Roll of a move by key from the pose given, block_pos is the pose after it */
+void startRoll (int key, int from_state, glm::vec3 from_pos, float from_rotation, glm::vec3 from_axis)
+{
+    BlockRoll& r = block_roll;
+    float pos[3] = { from_pos.x, from_pos.y, from_pos.z };
+    float axis_from[3] = { from_axis.x, from_axis.y, from_axis.z };
+    blockModel(r.from, pos, from_rotation, axis_from);
+
+    // half the footprint, the pivot is the bottom edge on the side of the move
+    float half_x = from_state == BLOCK_LYING_X ? 1 : 0.5f;
+    float half_z = from_state == BLOCK_LYING_Z ? 1 : 0.5f;
+    glm::vec3 pivot(from_pos.x, from_pos.y - (from_state == BLOCK_STANDING ? 1 : 0.5f), from_pos.z);
+    glm::vec3 turn(0, 0, 0);
+    float angle = M_PI/2;
+    if (key == KEY_LEFT) { pivot.x -= half_x; turn.z = 1; }
+    if (key == KEY_RIGHT) { pivot.x += half_x; turn.z = 1; angle = -angle; }
+    if (key == KEY_UP) { pivot.z -= half_z; turn.x = 1; angle = -angle; }
+    if (key == KEY_DOWN) { pivot.z += half_z; turn.x = 1; }
+
+    // the turn lands on the new pose, but for the few moves of
+    // block_moves that leave the block half sunk into the floor
+    glm::vec3 landed = pivot + glm::vec3(glm::rotate(angle, turn) * glm::vec4(from_pos - pivot, 0));
+    glm::vec3 offset = block_pos - landed;
+
+    for (int i=0; i<3; i++) {
+        r.pivot[i] = pivot[i];
+        r.axis[i] = turn[i];
+        r.offset[i] = offset[i];
+    }
+    r.angle = angle;
+    r.start = glfwGetTime();
+    r.duration = ROLL_SECONDS;
+    r.id++;
+}
+
+/* Undo history : one snapshot per move, Backspace steps back one move,
+   Page Up ten, Home to the oldest one kept */
+History history;
+
+void pushHistory (int key, int from_state)
+{
+    SnapshotInfo s;
+    s.game.x2 = (int)floor(block_pos.x*2 + 0.5f);
+    s.game.z2 = (int)floor(block_pos.z*2 + 0.5f);
+    s.game.state = blockState;
+    s.game.level = level;
+    s.game.bridge = bridge_toggle;
+    s.game.moves = moves;
+    s.key = key;
+    s.from_state = from_state;
+    s.falling = false;
+    historyPush(history, packSnapshot(s));
+}
+
+void rewindMoves (int n)
+{
+    SnapshotInfo s = unpackSnapshot(historyRewind(history, n));
+    level = s.game.level;
+    block_pos.x = s.game.x2 / 2.0f;
+    block_pos.z = s.game.z2 / 2.0f;
+    blockState = s.game.state;
+    bridge_toggle = bridgeCheck = s.game.bridge;
+    moves = s.game.moves;
+
+    // the pose moveBlock left after the move into this state
+    if (s.key == KEY_NONE) {
+        block_pos.y = 1;
+        blockRotation = 0;
+        axis = glm::vec3(0, 0, 1);
+    }
+    else {
+        const BlockMove& m = block_moves[s.from_state][s.key];
+        block_pos.y = m.y;
+        blockRotation = m.rotation;
+        axis = glm::vec3(m.axis[0], m.axis[1], m.axis[2]);
+    }
+    arrow_key = 0;
+    jump = 0;
+    cancelRoll();
+    printf("REWIND TO MOVE %d\n", moves);
+}
+
+/* Background work of the game (asset loading, hint fields) goes to this
+   pool, the main thread helps between its ticks (jobsRunUntil) */
+JobPool* engine_jobs;
+
+/* Hints (Tab) : the distance field of a level is built on a worker, the
+   next level's while this one is played, each frame the hint is a lookup
+   of the neighbours of the current state. The bridge is part of the
+   field, switching it on does not need a rebuild. */
+int show_hint = 0;
+DistanceField level_fields[LEVELS];   // each written by its job only
+JobHandle level_field_jobs[LEVELS];
+const DistanceField* hint_field = NULL;
+int hint_field_level = -1;
+
+/* Starts building the field of level l, once */
+void prefetchLevelField (int l)
+{
+    if (l >= LEVELS || level_field_jobs[l])
+        return;
+    DistanceField* field = &level_fields[l];
+    level_field_jobs[l] = jobsSubmit(engine_jobs, [l, field] {
+        buildDistanceField(&map1[l][0][0], LEVEL_ROWS, LEVEL_COLS, *field);
+    });
+}
+
+/* Switches to the current level's field once it is built */
+void updateHintField ()
+{
+    prefetchLevelField(level);
+    prefetchLevelField(level + 1);
+    if (hint_field_level != level && jobsDone(level_field_jobs[level])) {
+        hint_field = &level_fields[level];
+        hint_field_level = level;
+    }
+}
+
+/* Current state for the rules in logic.h */
+GameState currentGameState ()
+{
+    GameState g = {
+        (int)floor(block_pos.x*2 + 0.5f),
+        (int)floor(block_pos.z*2 + 0.5f),
+        blockState, level, bridge_toggle, moves,
+    };
+    return g;
+}
+
+/* Puts the block pose of the best next move into scene.hint */
+void addHint (Scene& scene)
+{
+    // nothing to hint while a move is pending or the block falls
+    if (!show_hint || hint_field_level != level || arrow_key != 0 || key_queue_count > 0 || blockRolling() || block_pos.y < 0.5f)
+        return;
+
+    GameState g = currentGameState();
+    int key = hintMove(&map1[level][0][0], *hint_field, g);
+    if (key == KEY_NONE)
+        return;
+
+    const BlockMove& m = block_moves[g.state][key];
+    float pos[3] = { (g.x2 + m.dx2) / 2.0f, m.y, (g.z2 + m.dz2) / 2.0f };
+    blockModel(scene.hint.model, pos, m.rotation, m.axis);
+    scene.hint.type = 0;
+    scene.show_hint = true;
+}
+
+void toggleHint ()
+{
+    show_hint ^= 1;
+    if (!show_hint)
+        return;
+    if (hint_field_level != level) {
+        printf("HINT : still thinking\n");
+        return;
+    }
+    static const char* names[] = { "none", "left", "right", "up", "down" };
+    GameState g = currentGameState();
+    int distance = distanceToGoal(*hint_field, g);
+    if (distance == DISTANCE_UNREACHABLE)
+        printf("HINT : the goal can not be reached from here, rewind (Backspace)\n");
+    else
+        printf("HINT : %s, %d moves to go\n", names[hintMove(&map1[level][0][0], *hint_field, g)], distance);
+}
 
 int checkBridges()
 {
   int boardX1 = block_pos.x;
   int boardY1 = block_pos.z;
-  if(map1[level][boardX1][boardY1]==5 && blockState==1)
+  if(bitboardTest(level_bitboards[level].switches, boardX1, boardY1) && blockState==1)
   {
     bridge_toggle=1;
   }
   return bridge_toggle;
 }
+/****************
+ * Level editor *
+ ****************/
+
+/* F2 : edits a copy of the current level, or the first board of the
+   --edit file. Left button paints the brush, right button clears, middle
+   button moves the start, the wheel picks the brush and F5 writes the
+   board back in the levelgen pack format. The cell under the cursor comes
+   from a ray through the inverse view projection walked over the grid
+   (pickTile). The board is drawn in EDIT_CHUNK x EDIT_CHUNK chunks with a
+   slot each in one instance buffer : an edit rebakes its chunk on the main
+   thread and the renderer uploads only that slot. The editor has its own
+   camera over the board : the arrow keys pan it, + and - zoom. */
+#define EDIT_CHUNK 16
+#define EDIT_CHUNK_CELLS (EDIT_CHUNK*EDIT_CHUNK)
+
+int editor_enabled = 0;
+const char* edit_path = "edit.txt";   // --edit=FILE
+int edit_new_rows = 0, edit_new_cols = 0;   // --edit-size=RxC : a blank board instead
+Board edit_board;
+int edit_brush = TILE_NORMAL;
+int edit_painting = -1;               // type painted while a button is held
+int edit_cursor_x = -1, edit_cursor_z = -1;
+Mat4 edit_view_projection;            // of the last snapshot, for picking
+float edit_camera_x, edit_camera_z;   // board point in the middle of the screen
+float edit_camera_height;
+
+/* Chunks baked on the main thread, waiting for the renderer. chunk -1
+   starts a new board of rows x cols. */
+struct EditUpdate {
+    int chunk;
+    int rows, cols;
+    vector<InstanceData> instances;
+};
+
+mutex edit_lock;
+vector<EditUpdate> edit_updates;
+
+int editChunksX (const Board& b) { return (b.rows + EDIT_CHUNK - 1) / EDIT_CHUNK; }
+int editChunksZ (const Board& b) { return (b.cols + EDIT_CHUNK - 1) / EDIT_CHUNK; }
+
+/* The drawn tiles of one chunk, goals are holes */
+void postEditChunk (int chunk)
+{
+    EditUpdate u;
+    u.chunk = chunk;
+    u.rows = edit_board.rows;
+    u.cols = edit_board.cols;
+    int x0 = chunk / editChunksZ(edit_board) * EDIT_CHUNK, z0 = chunk % editChunksZ(edit_board) * EDIT_CHUNK;
+    for (int x=x0; x<min(x0 + EDIT_CHUNK, edit_board.rows); x++)
+        for (int z=z0; z<min(z0 + EDIT_CHUNK, edit_board.cols); z++) {
+            int type = edit_board.tiles[(size_t)x*edit_board.cols + z];
+            if (type == TILE_EMPTY || type == TILE_GOAL)
+                continue;
+            InstanceData d;
+            Mat4 m = matTranslate(x, 0, z);
+            memcpy(d.model, m.m, sizeof(d.model));
+            d.type = type;
+            u.instances.push_back(d);
+        }
+    lock_guard<mutex> lock(edit_lock);
+    edit_updates.push_back(move(u));
+}
+
+void postEditBoard ()
+{
+    {
+        lock_guard<mutex> lock(edit_lock);
+        edit_updates.clear();
+        EditUpdate reset = { -1, edit_board.rows, edit_board.cols };
+        edit_updates.push_back(reset);
+    }
+    for (int c=0; c<editChunksX(edit_board)*editChunksZ(edit_board); c++)
+        postEditChunk(c);
+}
+
+float clampEditHeight (float height)
+{
+    return min(max(height, 3.0f), max(edit_board.rows, edit_board.cols) * 1.5f + 3);
+}
+
+/* Looks down at the board from above edit_camera_x, edit_camera_z, tilted
+   so the up arrow pans along -x */
+Mat4 editViewProjection (float aspect)
+{
+    float h = edit_camera_height;
+    float eye[3] = { edit_camera_x + h/2, h, edit_camera_z };
+    float target[3] = { edit_camera_x, 0, edit_camera_z };
+    float up[3] = { 0, 1, 0 };
+    // the far edge of the screen is about 3.2 heights away
+    Mat4 projection = matPerspective(M_PI/2, aspect, max(0.05f, h/50), h*4 + 10);
+    return matMultiply(projection, matLookAt(eye, target, up));
+}
+
+/* Arrow keys pan by an eighth of the view, + and - zoom */
+bool moveEditCamera (int key)
+{
+    float step = max(1.0f, edit_camera_height / 8);
+    switch (key) {
+    case GLFW_KEY_UP:    edit_camera_x -= step; break;
+    case GLFW_KEY_DOWN:  edit_camera_x += step; break;
+    case GLFW_KEY_LEFT:  edit_camera_z += step; break;
+    case GLFW_KEY_RIGHT: edit_camera_z -= step; break;
+    case GLFW_KEY_EQUAL: edit_camera_height = clampEditHeight(edit_camera_height / 1.25f); break;
+    case GLFW_KEY_MINUS: edit_camera_height = clampEditHeight(edit_camera_height * 1.25f); break;
+    default:
+        return false;
+    }
+    edit_camera_x = min(max(edit_camera_x, 0.0f), (float)edit_board.rows - 1);
+    edit_camera_z = min(max(edit_camera_z, 0.0f), (float)edit_board.cols - 1);
+    return true;
+}
+
+void toggleEditor ()
+{
+    editor_enabled ^= 1;
+    edit_painting = -1;
+    if (!editor_enabled) {
+        printf("EDITOR off\n");
+        return;
+    }
+    if (edit_board.tiles.empty()) {
+        vector<Board> boards;
+        if (edit_new_rows > 0) {
+            edit_board.rows = edit_new_rows;
+            edit_board.cols = edit_new_cols;
+            edit_board.start_x = edit_board.start_z = 0;
+            edit_board.moves = -1;
+            edit_board.tiles.assign((size_t)edit_new_rows * edit_new_cols, TILE_EMPTY);
+        }
+        else if (readPack(edit_path, boards))
+            edit_board = boards[0];
+        else {
+            edit_board.rows = LEVEL_ROWS;
+            edit_board.cols = LEVEL_COLS;
+            edit_board.start_x = initPos[level][0];
+            edit_board.start_z = initPos[level][1];
+            edit_board.moves = level_solutions[level];
+            edit_board.tiles.assign(&map1[level][0][0], &map1[level][0][0] + LEVEL_ROWS*LEVEL_COLS);
+        }
+        postEditBoard();
+        // the whole board in view
+        edit_camera_x = (edit_board.rows - 1) / 2.0f;
+        edit_camera_z = (edit_board.cols - 1) / 2.0f;
+        edit_camera_height = clampEditHeight(max(edit_board.rows, edit_board.cols) * 0.6f + 2);
+    }
+    printf("EDITOR on, %dx%d board, brush %d (wheel), F5 saves to %s\n",
+           edit_board.rows, edit_board.cols, edit_brush, edit_path);
+}
+
+void paintCell (int x, int z, int type)
+{
+    int& tile = edit_board.tiles[(size_t)x*edit_board.cols + z];
+    if (tile == type)
+        return;
+    tile = type;
+    postEditChunk(x / EDIT_CHUNK * editChunksZ(edit_board) + z / EDIT_CHUNK);
+}
+
+/* The cell under the mouse, with the camera of the last snapshot */
+void updateEditCursor (GLFWwindow* window)
+{
+    double mx, my;
+    int width, height;
+    glfwGetCursorPos(window, &mx, &my);
+    glfwGetWindowSize(window, &width, &height);
+    if (width <= 0 || height <= 0 ||
+        !pickTile(&edit_board.tiles[0], edit_board.rows, edit_board.cols, edit_view_projection,
+                  2 * mx / width - 1, 1 - 2 * my / height, &edit_cursor_x, &edit_cursor_z))
+        edit_cursor_x = edit_cursor_z = -1;
+}
+
+void mouseButton (GLFWwindow* window, int button, int action, int mods)
+{
+    if (!editor_enabled)
+        return;
+    if (action == GLFW_RELEASE) {
+        edit_painting = -1;
+        return;
+    }
+    updateEditCursor(window);
+    if (edit_cursor_x < 0)
+        return;
+    if (button == GLFW_MOUSE_BUTTON_MIDDLE) {
+        edit_board.start_x = edit_cursor_x;
+        edit_board.start_z = edit_cursor_z;
+        printf("EDITOR start at %d,%d\n", edit_cursor_x, edit_cursor_z);
+        return;
+    }
+    edit_painting = button == GLFW_MOUSE_BUTTON_LEFT ? edit_brush : TILE_EMPTY;
+    paintCell(edit_cursor_x, edit_cursor_z, edit_painting);
+}
+
+/* Dragging keeps painting */
+void cursorMoved (GLFWwindow* window, double x, double y)
+{
+    if (!editor_enabled)
+        return;
+    updateEditCursor(window);
+    if (edit_painting >= 0 && edit_cursor_x >= 0)
+        paintCell(edit_cursor_x, edit_cursor_z, edit_painting);
+}
+
+void scroll_callback (GLFWwindow* window, double xoffset, double yoffset)
+{
+    static const int brushes[] = { TILE_NORMAL, TILE_FRAGILE, TILE_SWITCH, TILE_BRIDGE, TILE_GOAL };
+    static const char* names[] = { "normal", "fragile", "switch", "bridge", "goal" };
+    if (!editor_enabled || yoffset == 0)
+        return;
+    int i = 0;
+    while (brushes[i] != edit_brush)
+        i++;
+    i = (i + (yoffset > 0 ? 1 : 4)) % 5;
+    edit_brush = brushes[i];
+    printf("EDITOR brush %s\n", names[i]);
+}
+
+/* F5 : solves and writes a copy of the board on the engine pool */
+void saveEditBoard ()
+{
+    if (edit_board.tiles.empty())
+        return;
+    Board* b = new Board(edit_board);
+    const char* path = edit_path;
+    jobsSubmit(engine_jobs, [b, path] {
+        b->moves = solveBoard(&b->tiles[0], b->rows, b->cols, 2*b->start_x, 2*b->start_z);
+        if (writePack(path, vector<Board>(1, *b)))
+            printf("EDITOR saved %s, %s\n", path, b->moves < 0 ? "unsolvable" : "solvable");
+        else
+            fprintf(stderr, "EDITOR cannot write %s\n", path);
+        delete b;
+    }, JOB_BLOCKING);
+}
+
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 {
   bridgeCheck = checkBridges();
+    // the game waits while the editor is open : only the editor keys work
+    if (editor_enabled) {
+        if (action == GLFW_RELEASE || moveEditCamera(key) || action != GLFW_PRESS)
+            return;
+        if (key == GLFW_KEY_F2)
+            toggleEditor();
+        else if (key == GLFW_KEY_F5)
+            saveEditBoard();
+        else if (key == GLFW_KEY_ESCAPE)
+            exit(1);
+        return;
+    }
      // Function is called first on GLFW_PRESS.
+    // held down, Backspace keeps rewinding
+    if (action == GLFW_REPEAT && key == GLFW_KEY_BACKSPACE)
+        rewindMoves(1);
+
     if (action == GLFW_PRESS)
         switch (key) {
           case GLFW_KEY_LEFT:
-              arrow_key = 1;
-              moves++;
-              system("mpg123 -n 30 -q tick.mp3 &");
+              if (queueArrowKey(1))
+                  playSound(SOUND_TICK);
               break;
           case GLFW_KEY_RIGHT:
-              arrow_key = 2;
-              moves++;
-              system("mpg123 -n 30 -q tick.mp3 &");
+              if (queueArrowKey(2))
+                  playSound(SOUND_TICK);
               break;
           case GLFW_KEY_DOWN:
-          arrow_key = 4;
-              moves++;
-              system("mpg123 -n 30 -q tick.mp3 &");
+              if (queueArrowKey(4))
+                  playSound(SOUND_TICK);
               break;
           case GLFW_KEY_UP:
-          arrow_key = 3;
-              moves++;
-              system("mpg123 -n 30 -q tick.mp3 &");
+              if (queueArrowKey(3))
+                  playSound(SOUND_TICK);
               break;
           case GLFW_KEY_ESCAPE:
               exit(1);
               break;
-          case GLFW_KEY_0:
-              view = 0;
+          case GLFW_KEY_BACKSPACE:
+              rewindMoves(1);
               break;
-          case GLFW_KEY_1:
-              view = 1;
+          case GLFW_KEY_PAGE_UP:
+              rewindMoves(10);
               break;
-          case GLFW_KEY_2:
-              view = 2;
+          case GLFW_KEY_HOME:
+              rewindMoves(HISTORY_SIZE);
               break;
-          case GLFW_KEY_3:
-              view = 3;
+          case GLFW_KEY_TAB:
+              toggleHint();
+              break;
+          case GLFW_KEY_F12:
+              screenshot_requests++;
+              break;
+          case GLFW_KEY_F11:
+              capture_toggles++;
+              break;
+          case GLFW_KEY_F1:
+              hud_enabled ^= 1;
+              break;
+          case GLFW_KEY_F2:
+              toggleEditor();
+              break;
+          case GLFW_KEY_F5:
+              saveEditBoard();
+              break;
+          case GLFW_KEY_F3:
+              stats_overlay ^= 1;
+              break;
+          case GLFW_KEY_F4:
+              cycleFxaa();
+              break;
+          case GLFW_KEY_0:
+              view = 0;
+              break;
+          case GLFW_KEY_1:
+              view = 1;
+              break;
+          case GLFW_KEY_2:
+              view = 2;
+              break;
+          case GLFW_KEY_3:
+              view = 3;
               break;
           case GLFW_KEY_4:
               view = 4;
@@ -367,6 +1318,9 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 /* Executed for character input (like in text boxes) */
 void keyboardChar (GLFWwindow* window, unsigned int key)
 {
+    // the editor has its own camera, only quitting goes through
+    if (editor_enabled && key != 'q' && key != 'Q')
+        return;
     switch (key)
     {
 	    case 'Q':
@@ -439,679 +1393,95 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 }
 
 /* Executed when window is resized to 'width' and 'height' */
-/* Modify the Field of View in glm::Perspective */
+/* The Field of View is in buildScene (scene.cpp). The framebuffer size goes
+   to the renderer with the next snapshot, which sets the viewport every frame,
+   so there is nothing to do here : the GL context may belong to the render thread. */
 void reshapeWindow (GLFWwindow* window, int width, int height)
 {
-    int fbwidth=width, fbheight=height;
-    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
-
-    GLfloat fov = M_PI/2;
-
-    // sets the viewport of openGL renderer
-    glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
-
-    // Store the projection matrix in a variable for future use
-    // Perspective projection for 3D views
-    Matrices.projectionP = glm::perspective(fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.05f, 25.05f);
-}
-
-VAO *block, *brick, *orange_brick, *bridge_brick;
-
-// Creates the cube object used in this sample code
-void createBlock ()
-{
-  GLfloat vertex_buffer_data [] = {
-    -0.5, 1, 0.5,
-    -0.5, -1, 0.5,
-    0.5, -1, 0.5,
-    -0.5, 1, 0.5,
-    0.5, -1, 0.5,
-    0.5, 1, 0.5,
-    0.5, 1, 0.5,
-    0.5, -1, 0.5,
-    0.5, -1, -0.5,
-    0.5, 1, 0.5,
-    0.5, -1, -0.5,
-    0.5, 1, -0.5,
-    0.5, 1, -0.5,
-    0.5, -1, -0.5,
-    -0.5, -1, -0.5,
-    0.5, 1, -0.5,
-    -0.5, -1, -0.5,
-    -0.5, 1, -0.5,
-    -0.5, 1, -0.5,
-    -0.5, -1, -0.5,
-    -0.5, -1, 0.5,
-    -0.5, 1, -0.5,
-    -0.5, -1, 0.5,
-    -0.5, 1, 0.5,
-    -0.5, 1, -0.5,
-    -0.5, 1, 0.5,
-    0.5, 1, 0.5,
-    -0.5, 1, -0.5,
-    0.5, 1, 0.5,
-    0.5, 1, -0.5,
-    -0.5, -1, 0.5,
-    -0.5, -1, -0.5,
-    0.5, -1, -0.5,
-    -0.5, -1, 0.5,
-    0.5, -1, -0.5,
-    0.5, -1, 0.5,
-  };
-
-  GLfloat color_buffer_data [] = {
-    1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-            1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f,
-            0.0f, 0.0f, 0.0f,
-
-  };
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    block = create3DObject(GL_TRIANGLES, 36, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
-
-void createBrick ()
-{
-    // GL3 accepts only Triangles. Quads are not supported
-    static const GLfloat vertex_buffer_data [] = {
-        -0.5, 0.1, 0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, -0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.25, -0.5,
-    };
-
-    static const GLfloat color_buffer_data [] = {
-        1.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        1.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, 1.0f,
-
-        1.0f, 0.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0.0f, 1.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0.0f, 1.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        1.0f, 0.0f, 0.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        1.0f, 0.0f, 0.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0.0f, 0.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0.0f, 0.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        0.0f, 0.0f, 0.0f,
-
-        0, 0, 0,
-        0, 0, 0,
-        1, 1, 1,
-    };
-
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    brick = create3DObject(GL_TRIANGLES, 13*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
-
-void createOrangeBrick ()
-{
-    // GL3 accepts only Triangles. Quads are not supported
-    static const GLfloat vertex_buffer_data [] = {
-        -0.5, 0.1, 0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, -0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.25, -0.5,
-    };
-
-    static const GLfloat color_buffer_data [] = {
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-          1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-          1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-      1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0,
-
-        1,0.5,0,
-        1,1,1,
-        1,0.5,0
-    };
-
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    orange_brick = create3DObject(GL_TRIANGLES, 13*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
-
-void createBridgeBrick ()
-{
-    // GL3 accepts only Triangles. Quads are not supported
-    static const GLfloat vertex_buffer_data [] = {
-        -0.5, 0.1, 0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, -0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.25, -0.5,
-    };
-
-    static const GLfloat color_buffer_data [] = {
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-    };
-
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    bridge_brick = create3DObject(GL_TRIANGLES, 13*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
-VAO* switch_brick;
-void createSwitchBrick ()
-{
-    // GL3 accepts only Triangles. Quads are not supported
-    static const GLfloat vertex_buffer_data [] = {
-        -0.5, 0.1, 0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, 0.5,
-        -0.5, 0.1, -0.5,
-        0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        -0.5, -0.1, -0.5,
-        0.5, -0.1, -0.5,
-        -0.5, -0.1, 0.5,
-        0.5, -0.1, -0.5,
-        0.5, -0.1, 0.5,
-        -0.5, 0.1, 0.5,
-        0.5, 0.1, -0.5,
-        0.5, 0.25, -0.5,
-    };
-
-    static const GLfloat color_buffer_data [] = {
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
+}
 
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
+VAO *block, *tile, *axes;
+
+/* Everything the renderer needs of one simulation tick. The main thread
+   (input, moveBlock) fills one and publishes it through frame_snapshots,
+   the render thread draws the newest one; they share nothing else. */
+#define SIM_TIMES 16          // ticks a snapshot remembers the time of
+
+struct FrameSnapshot {
+    Scene scene;              // camera, block, tiles and hint, see buildScene()
+    int fbwidth, fbheight;    // window framebuffer
+    char hud[128];            // HUD line, empty when the HUD is off
+    int overlay;              // F3
+    int fxaa;                 // F4, preset
+    int screenshot_requests, capture_toggles;
+    long tick;                // ticks simulated so far, this one included
+    float sim_ms[SIM_TIMES];  // moveBlock() time of the last ticks, by tick % SIM_TIMES
+    double key_time, key_ms;  // last applied key event and its key -> apply time
+    BlockRoll roll;
+    ParticleEvent particle_events[PARTICLE_EVENTS];
+    int particle_event_count;
+    int editing;              // F2, the editor board replaces the level tiles
+    int edit_cursor_x, edit_cursor_z;
+};
 
-        0.2,0.2,0,
-        1,1,1,
-        0.2,0.2,0,
-    };
+TripleBuffer<FrameSnapshot> frame_snapshots;
 
+/* Upload a mesh into a new VAO, on the GL thread */
+VAO* uploadMesh (const Mesh& mesh)
+{
     // create3DObject creates and returns a handle to a VAO that can be used later
-switch_brick = create3DObject(GL_TRIANGLES, 13*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+    return create3DObject(GL_TRIANGLES, mesh.vertices.size()/3, &mesh.vertices[0],
+                          mesh.colors.empty() ? NULL : &mesh.colors[0], GL_FILL);
 }
 
 void moveBlock()
 {
-  int boardX = block_pos.x;
-  int boardY = block_pos.z;
-  if (blockState == 1 && arrow_key==1)
-  {
-    blockRotation = M_PI/2;
-    axis.x = 0;
-    axis.y = 0;
-    axis.z = 1;
-    block_pos.x -= 1.5;
-    block_pos.y = 0.5;
-    blockState = 3;
-    arrow_key = 0;
+  // the rules wait for the roll on screen, then take the next queued key
+  if (blockRolling())
+      return;
+  if (arrow_key == 0 && key_queue_count > 0) {
+      // a move counts when it is played, not when its key is queued
+      arrow_key = key_queue[0];
+      moves++;
+      key_event_time = key_queue_time[0];
+      key_queue_count--;
+      memmove(key_queue, key_queue + 1, key_queue_count * sizeof(key_queue[0]));
+      memmove(key_queue_time, key_queue_time + 1, key_queue_count * sizeof(key_queue_time[0]));
   }
-  else if (blockState == 2 && arrow_key==1)
-  {
-    blockRotation = M_PI/2;
-    axis.x = 1;
-    axis.y = 0;
-    axis.z = 0;
-    block_pos.x -= 1;
-    //    block_pos.z = 0.25;
-    block_pos.y =0.5;
-    blockState = 2;
-    arrow_key=0;
-  }
-  else if (blockState == 3 && arrow_key==1)
-  {
-    blockRotation = M_PI/2;
-    axis.x = 0;
-    axis.y = 1;
-    axis.z = 0;
-    block_pos.y =1;
-  //  block_pos.y = 1;
-    block_pos.x -= 1.5;
-    blockState = 1;
-    arrow_key=0;
-  }
-  else if (blockState == 1 && arrow_key==2)
+
+  // position in half tiles, blockSupport() looks at the tile under (int)x, (int)z
+  int x2 = (int)floor(block_pos.x*2 + 0.5f);
+  int z2 = (int)floor(block_pos.z*2 + 0.5f);
+  int support = blockSupport(&map1[level][0][0], LEVEL_ROWS, LEVEL_COLS, x2, z2, blockState, bridge_toggle);
+  if (arrow_key >= KEY_LEFT && arrow_key <= KEY_DOWN)
   {
-    blockRotation = M_PI/2;
-    axis.x = 0;
-    axis.y = 0;
-    axis.z = 1;
-    block_pos.x += 1.5;
-    block_pos.y = 0.5;
-    blockState = 3;
-    arrow_key=0;
+    // the rules for each state and key live in block_moves (logic.h)
+    const BlockMove& m = block_moves[blockState][arrow_key];
+    int from_state = blockState;
+    glm::vec3 from_pos = block_pos, from_axis = axis;
+    float from_rotation = blockRotation;
+    blockRotation = m.rotation;
+    axis.x = m.axis[0];
+    axis.y = m.axis[1];
+    axis.z = m.axis[2];
+    block_pos.x += m.dx2 / 2.0f;
+    block_pos.z += m.dz2 / 2.0f;
+    block_pos.y = m.y;
+    blockState = m.state;
+    startRoll(arrow_key, from_state, from_pos, from_rotation, from_axis);
+    pushHistory(arrow_key, from_state);
+    arrow_key = 0;
+    if (key_event_time >= 0) {
+        applied_key_time = key_event_time;
+        applied_key_ms = (glfwGetTime() - key_event_time) * 1000;
+        key_event_time = -1;
+    }
   }
-  else if (blockState == 2 && arrow_key==2)
-  {
-    blockRotation = M_PI/2;
-    axis.x = 1;
-    axis.y = 0;
-    axis.z = 0;
-    block_pos.x += 1;
-    block_pos.y =0.5;
-    //    block_pos.z = 0.25;
-    blockState = 2;
-    arrow_key=0;
-  }
-  else if (blockState == 3 && arrow_key==2)
-	{
-		blockRotation = M_PI;
-		axis.x = 0;
-		axis.y = 0;
-		axis.z = 1;
-		block_pos.x += 1.5;
-    block_pos.y =0.5;
-	//	block_pos.z = 1.25;
-		blockState = 1;
-    arrow_key=0;
-	}
-  else if (blockState == 1 && arrow_key==3)
-	{
-		blockRotation = M_PI/2;
-		axis.x = 1;
-		axis.y = 0;
-		axis.z = 0;
-		block_pos.y = 0.5;
-  		block_pos.z -= 1.5;
-		blockState = 2;
-    arrow_key=0;
-	}
-	else if (blockState == 2 && arrow_key==3)
-	{
-		blockRotation = M_PI/2;
-		axis.x = 0;
-		axis.y = -1;
-		axis.z = 0;
-		block_pos.z -= 1.5;
-		blockState = 1;
-    block_pos.y =1;
-    arrow_key=0;
-	}
-  else if (blockState == 3 && arrow_key==3)
-	{
-		blockRotation = M_PI/2;
-		axis.x = 0;
-		axis.y = 0;
-		axis.z = 1;
-	//	block_pos.y += 1;
-  block_pos.y =0.5;
-		block_pos.z -= 1;
-		blockState = 3;
-    arrow_key=0;
-	}
-	else if (blockState == 1 && arrow_key==4)
-	{
-		blockRotation = -M_PI/2;
-		axis.x = -1;
-		axis.y = 0;
-		axis.z = 0;
-		block_pos.z += 1.5;
-    block_pos.y = 0.5;
-		blockState = 2;
-		arrow_key=0;
-	}
-	else if (blockState == 2 && arrow_key==4)
-	{
-		blockRotation = M_PI/2;
-		axis.x = 0;
-		axis.y = 1;
-		axis.z = 0;
-		//block_pos.y -= 2;
-    block_pos.y =1;
-		block_pos.z += 1.5;
-		blockState = 1;
-    arrow_key=0;
-	}
-	else if (blockState == 3 && arrow_key==4)
-	{
-		blockRotation = M_PI/2;
-		axis.x = 0;
-		axis.y = 0;
-		axis.z = 1;
-		block_pos.z += 1;
-    block_pos.y =0.5;
-	//	block_pos.y = 0.75;
-		blockState = 3;
-    arrow_key=0;
-	}
-  else if(map1[level][boardX][boardY]==2 && blockState==1)
+  else if(support == SUPPORT_GOAL)
   {
     printf("you win\n");
-    system("mpg123 -n 100 -q cheer.mp3 &");
+    playSound(SOUND_CHEER);
+    emitParticles(PARTICLE_WIN, block_pos.x, 0, block_pos.z);
     block_pos.y -= 1;
     if(level<2)
     {
@@ -1121,6 +1491,12 @@ void moveBlock()
       block_pos.y = 1;
       bridge_toggle = 0;
       jump = 0;
+      level_start_time = glfwGetTime();
+      // already resident if the loader kept up, start on the one after
+      prefetchLevel(level + 1);
+      // no rewinding into the previous level
+      historyClear(history);
+      pushHistory(KEY_NONE, BLOCK_STANDING);
     }
     else if(level==2)
     {
@@ -1128,18 +1504,25 @@ void moveBlock()
       exit(0);
     }
   }
-  else if(map1[level][boardX][boardY]==3 && blockState==1)
+  else if(support == SUPPORT_FRAGILE)
   {
     printf("you are on a fragile tile\n");
-    system("mpg123 -n 100 -q lose.mp3 &");
+    // the branch runs on every tick of the fall, burst on the first one
+    if (block_pos.y >= 0.5f)
+        emitParticles(PARTICLE_FRAGILE, block_pos.x, 0, block_pos.z);
+    historyMarkFalling(history);
+    playSound(SOUND_LOSE);
     block_pos.y -= 1;
     bridge_toggle = 0;
     jump = 0;
   }
-  else if(map1[level][boardX][boardY]==0 || (map1[level][boardX][boardY]==4 && bridge_toggle==0) || boardX < 0 || boardY < 0)
+  else if(support == SUPPORT_FALL)
   {
     printf("you fell\n");
-    system("mpg123 -n 100 -q lose.mp3 &");
+    if (block_pos.y >= 0.5f)
+        emitParticles(PARTICLE_FALL, block_pos.x, 0, block_pos.z);
+    historyMarkFalling(history);
+    playSound(SOUND_LOSE);
     block_pos.y -= 1;
     bridge_toggle = 0;
     jump = 0;
@@ -1157,8 +1540,11 @@ printf("JUMP %d\n", jump);
     axis.y = 0;
     axis.z = 1;
     arrow_key=0;
+    cancelRoll();
     bridge_toggle = 0;
     jump = 0;
+    // kept after the fall, the undo keys can still go back before it
+    pushHistory(KEY_NONE, BLOCK_STANDING);
   }
   printf("LEVEL %d\n", level);
   printf("CURRENT TIME %f\n",current_time);
@@ -1167,205 +1553,1332 @@ printf("JUMP %d\n", jump);
   printf("BLOCKPOS: %f,%f,%f\n", block_pos.x,block_pos.y,block_pos.z);
 }
 
-void drawAxis()
+/* The three axes as one GL_LINES object, built once by initGL */
+VAO* createAxes ()
 {
-    static const GLfloat X [] = {
+    static const GLfloat vertices [] = {
         10, 0, 0,		-10, 0, 0,
+        0, 10, 0,		0, -10, 0,
+        0, 0, 10,		0, 0, -10,
     };
-    static const GLfloat Y [] = {
-        0, 10, 0,		0, -10, 0
-    };
-    static const GLfloat Z [] = {
-        0, 0, 10,		0, 0, -10
-    };
-    static const GLfloat colX [] = {
-        1, 1, 1,		1, 1, 1
+    static const GLfloat colors [] = {
+        1, 1, 1,		1, 1, 1,
+        0, 1, 0,		0, 1, 0,
+        1, 0, 0,		1, 0, 0,
     };
-    static const GLfloat colY [] = {
-        0, 1, 0,		0, 1, 0
-    };
-    static const GLfloat colZ [] = {
-        1, 0, 0,		1, 0, 0
-    };
-    VAO* line1= create3DObject(GL_LINE_STRIP,2, X, colX, GL_FILL);
-    VAO* line2= create3DObject(GL_LINE_STRIP,2, Y, colY, GL_FILL);
-    VAO* line3= create3DObject(GL_LINE_STRIP,2, Z, colZ, GL_FILL);
+    return create3DObject(GL_LINES, 6, vertices, colors, GL_FILL);
+}
+
+void drawAxis()
+{
     Matrices.model = glm::mat4(1.0);
     MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(line1);
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(line2);
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(line3);
+    uploadMVP();
+    draw3DObject(axes);
+}
+
+/* The GL renderer for a Scene : the block and the tiles as two instanced
+   draws, MVP only holds the view projection and the model matrices are
+   written straight into the stream buffer */
+/* Roll uniforms of the Sample_GL program */
+struct RollUniforms {
+    GLint rolling, from, pivot, axis, offset, angle, duration, elapsed;
+} roll_uniforms;
+
+void initRoll ()
+{
+    RollUniforms& u = roll_uniforms;
+    u.rolling = glGetUniformLocation(programID, "rolling");
+    u.from = glGetUniformLocation(programID, "rollFrom");
+    u.pivot = glGetUniformLocation(programID, "rollPivot");
+    u.axis = glGetUniformLocation(programID, "rollAxis");
+    u.offset = glGetUniformLocation(programID, "rollOffset");
+    u.angle = glGetUniformLocation(programID, "rollAngle");
+    u.duration = glGetUniformLocation(programID, "rollDuration");
+    u.elapsed = glGetUniformLocation(programID, "rollElapsed");
+}
+
+/* The roll goes up once per move, then only its elapsed time each frame,
+   taken in double : glfwGetTime() as a float loses milliseconds after a few
+   hours. With the program bound. */
+void uploadRoll (const BlockRoll& roll)
+{
+    static int uploaded = -1;
+    RollUniforms& u = roll_uniforms;
+    if (roll.id != uploaded) {
+        glUniformMatrix4fv(u.from, 1, GL_FALSE, roll.from);
+        glUniform3fv(u.pivot, 1, roll.pivot);
+        glUniform3fv(u.axis, 1, roll.axis);
+        glUniform3fv(u.offset, 1, roll.offset);
+        glUniform1f(u.angle, roll.angle);
+        glUniform1f(u.duration, roll.duration);
+        statAdd(STAT_UNIFORM_UPLOADS, 6);
+        uploaded = roll.id;
+    }
+    glUniform1f(u.elapsed, (float)(glfwGetTime() - roll.start));
+    statAdd(STAT_UNIFORM_UPLOADS);
+}
+
+void drawSceneGL (const Scene& scene, bool levelTiles)
+{
+    // like the tiles and the hint, the block is skipped when the region is full
+    GLsizeiptr blockOffset = 0;
+    InstanceData* blockInstance = (InstanceData*) streamAlloc(sizeof(InstanceData), &blockOffset);
+    if (blockInstance != NULL) {
+        memcpy(blockInstance->model, scene.block.model, sizeof(blockInstance->model));
+        blockInstance->type = scene.block.type;
+    }
+
+    // resident tiles : the first tileCount of the level's buffer, the same prefix as scene.tiles
+    int tileCount = levelTiles ? scene.tiles.size() : 0;
+    GLsizeiptr tileOffset = 0;
+    LevelGPU* tilesGPU = levelTiles ? levelTilesGPU(scene.level) : NULL;
+    if (tilesGPU == NULL) {
+        InstanceData* tileInstances = (InstanceData*) streamAlloc(tileCount*sizeof(InstanceData), &tileOffset);
+        if (tileInstances == NULL)
+            tileCount = 0;
+        for (int i=0; i<tileCount; i++) {
+            memcpy(tileInstances[i].model, scene.tiles[i].model, sizeof(tileInstances[i].model));
+            tileInstances[i].type = scene.tiles[i].type;
+        }
+    }
+
+    GLsizeiptr hintOffset = 0;
+    InstanceData* hintInstance = NULL;
+    if (scene.show_hint) {
+        hintInstance = (InstanceData*) streamAlloc(sizeof(InstanceData), &hintOffset);
+        if (hintInstance != NULL) {
+            memcpy(hintInstance->model, scene.hint.model, sizeof(hintInstance->model));
+            hintInstance->type = scene.hint.type;
+        }
+    }
+    streamFlush();
+
+    MVP = VP;
+    uploadMVP();
+    // only the block rolls, not the hint ghost drawn from the same mesh
+    if (blockInstance != NULL) {
+        glUniform1i(roll_uniforms.rolling, 1);
+        draw3DObjectInstanced(block, blockOffset, 1);
+        glUniform1i(roll_uniforms.rolling, 0);
+        statAdd(STAT_UNIFORM_UPLOADS, 2);
+    }
+    if (tilesGPU != NULL)
+        draw3DObjectInstancedFrom(tile, tilesGPU->buffer, 0, tileCount);
+    else
+        draw3DObjectInstanced(tile, tileOffset, tileCount);
+
+    // the hint is the block again, as a wireframe ghost
+    if (hintInstance != NULL) {
+        block->FillMode = GL_LINE;
+        draw3DObjectInstanced(block, hintOffset, 1);
+        block->FillMode = GL_FILL;
+    }
+}
+
+/* Editor board on the GPU, renderer side. Each chunk's slot holds just
+   its tiles, packed in chunk order : a chunk that grows moves to a new
+   slot at the end, and the buffer is repacked in chunk order when it is
+   full or the slots left behind (and the room erased tiles leave) waste a
+   quarter of it. Slots that follow
+   each other without a gap are drawn in one call. Sizes in instances. */
+struct EditorGPU {
+    GLuint buffer;
+    int size, end;          // allocated, handed out to slots
+    int live;               // tiles drawn, end - live is wasted
+    vector<int> offsets, capacity, counts;   // slot and tiles drawn, per chunk
+} editor_gpu;
+
+/* A buffer with room for extra more instances, the slots copied into it
+   in chunk order and shrunk to their tiles */
+void repackEditBuffer (int extra)
+{
+    EditorGPU& e = editor_gpu;
+    int live = 0;
+    for (size_t c=0; c<e.counts.size(); c++)
+        live += e.counts[c];
+    int size = max(2 * (live + extra), EDIT_CHUNK_CELLS);
+
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)size * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+    if (e.buffer != 0)
+        glBindBuffer(GL_COPY_READ_BUFFER, e.buffer);
+
+    // one copy per run of slots that were already back to back
+    int at = 0, run_from = 0, run_to = 0, run_count = 0;
+    for (size_t c=0; c<=e.counts.size(); c++) {
+        bool last = c == e.counts.size();
+        if (!last && e.counts[c] == 0) {
+            e.offsets[c] = at;
+            e.capacity[c] = 0;
+            continue;
+        }
+        if (run_count > 0 && (last || e.offsets[c] != run_from + run_count)) {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLsizeiptr)run_from * sizeof(InstanceData),
+                                (GLsizeiptr)run_to * sizeof(InstanceData), (GLsizeiptr)run_count * sizeof(InstanceData));
+            run_count = 0;
+        }
+        if (last)
+            break;
+        if (run_count == 0) {
+            run_from = e.offsets[c];
+            run_to = at;
+        }
+        run_count += e.counts[c];
+        e.offsets[c] = at;
+        e.capacity[c] = e.counts[c];
+        at += e.counts[c];
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (e.buffer != 0)
+        glDeleteBuffers(1, &e.buffer);
+    e.buffer = buffer;
+    e.size = size;
+    e.end = e.live = at;
+}
+
+/* Uploads the chunks the main thread rebaked. Only tries the lock : the
+   updates wait for the next frame rather than the frame for the editor. */
+void applyEditUpdates ()
+{
+    vector<EditUpdate> updates;
+    if (!edit_lock.try_lock())
+        return;
+    updates.swap(edit_updates);
+    edit_lock.unlock();
+
+    EditorGPU& e = editor_gpu;
+    for (size_t i=0; i<updates.size(); i++) {
+        const EditUpdate& u = updates[i];
+        if (u.chunk < 0) {
+            // a new board starts empty, its chunks follow
+            int chunks = ((u.rows + EDIT_CHUNK - 1) / EDIT_CHUNK) * ((u.cols + EDIT_CHUNK - 1) / EDIT_CHUNK);
+            e.offsets.assign(chunks, 0);
+            e.capacity.assign(chunks, 0);
+            e.counts.assign(chunks, 0);
+            if (e.buffer != 0)
+                glDeleteBuffers(1, &e.buffer);
+            e.buffer = 0;
+            e.size = e.end = e.live = 0;
+            continue;
+        }
+        if (u.chunk >= (int)e.counts.size())
+            continue;
+
+        int c = u.chunk, n = u.instances.size();
+        e.live -= e.counts[c];
+        e.counts[c] = 0;
+        if (n > e.capacity[c]) {
+            // the old slot is left behind, the next repack reclaims it
+            e.capacity[c] = 0;
+            if (e.end + n > e.size)
+                repackEditBuffer(n);
+            e.offsets[c] = e.end;
+            e.capacity[c] = n;
+            e.end += n;
+        }
+        if (n > 0) {
+            glBindBuffer(GL_ARRAY_BUFFER, e.buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, (GLsizeiptr)e.offsets[c] * sizeof(InstanceData), n * sizeof(InstanceData), &u.instances[0]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            statAdd(STAT_BUFFER_BYTES, n * sizeof(InstanceData));
+        }
+        e.counts[c] = n;
+        e.live += n;
+    }
+    if (e.end - e.live > e.live / 4 + EDIT_CHUNK_CELLS)
+        repackEditBuffer(0);
+}
+
+/* The edited board instead of the level tiles, and the cursor as a wireframe tile */
+void drawEditor (const FrameSnapshot& frame)
+{
+    applyEditUpdates();
+    const EditorGPU& e = editor_gpu;
+    int run_from = 0, run_count = 0;
+    for (size_t c=0; c<e.counts.size(); c++) {
+        if (e.counts[c] == 0)
+            continue;
+        if (run_count > 0 && e.offsets[c] == run_from + run_count) {
+            run_count += e.counts[c];
+            continue;
+        }
+        draw3DObjectInstancedFrom(tile, e.buffer, (GLsizeiptr)run_from * sizeof(InstanceData), run_count);
+        run_from = e.offsets[c];
+        run_count = e.counts[c];
+    }
+    draw3DObjectInstancedFrom(tile, e.buffer, (GLsizeiptr)run_from * sizeof(InstanceData), run_count);
+
+    if (frame.edit_cursor_x < 0)
+        return;
+    GLsizeiptr offset;
+    InstanceData* cursor = (InstanceData*) streamAlloc(sizeof(InstanceData), &offset);
+    if (cursor == NULL)
+        return;
+    // a little larger than the tile, so the lines are not hidden by it
+    Mat4 m = matTranslate(frame.edit_cursor_x, 0, frame.edit_cursor_z);
+    m.m[0] = m.m[5] = m.m[10] = 1.05f;
+    memcpy(cursor->model, m.m, sizeof(cursor->model));
+    cursor->type = 0;
+    streamFlush();
+    tile->FillMode = GL_LINE;
+    draw3DObjectInstanced(tile, offset, 1);
+    tile->FillMode = GL_FILL;
+}
+
+/*************
+ * Particles *
+ *************/
+
+/* Bursts when the block falls, breaks a fragile tile or wins. The state
+   of PARTICLE_COUNT particles lives in two buffers the GPU ping-pongs
+   between with transform feedback (Particle_Update.vert); a burst is a
+   range of the ring respawned by the update, set with uniforms. The CPU
+   only issues the update and one point draw per frame, and nothing at
+   all once every burst has died out. */
+#define PARTICLE_COUNT 32768
+#define PARTICLE_FLOATS 11      // position, velocity, life (left, at birth), color
+
+struct ParticleBurst {
+    int count;
+    float velocity[3];
+    float spread, life;
+    float color[3];
+};
+
+static const ParticleBurst particle_bursts[PARTICLE_KINDS] = {
+    { 3000, { 0, 1.5f, 0 }, 1.5f, 1.2f, { 0.6f, 0.6f, 0.55f } },   // dust of the fall
+    { 4000, { 0, 2.5f, 0 }, 2.5f, 1.5f, { 0.9f, 0.5f, 0.15f } },   // shards of the fragile tile
+    { 12000, { 0, 7, 0 }, 4, 3, { 1, 0.85f, 0.2f } },             // fireworks
+};
+
+struct ParticleSystem {
+    GLuint update_program, draw_program;
+    GLuint buffers[2], vaos[2];
+    int current;            // buffer with the latest state
+    int next_slot;          // where the next burst starts in the ring
+    int events_seen;
+    double alive_until;     // glfwGetTime() when the last burst is over
+    double last_time;
+    GLint dt, gravity, emit_start, emit_count, particle_count, emit_origin;
+    GLint emit_velocity, emit_spread, emit_life, emit_color, seed;
+    GLint view_projection, viewport_height;
+} particles;
+
+void initParticles (const string& updateShader, const string& vertexShader, const string& fragmentShader)
+{
+    static const char* varyings[] = { "outPosition", "outVelocity", "outLife", "outColor" };
+    ParticleSystem& p = particles;
+    p.update_program = CompileShaders(updateShader, "", varyings, 4);
+    p.draw_program = CompileShaders(vertexShader, fragmentShader);
+    p.dt = glGetUniformLocation(p.update_program, "dt");
+    p.gravity = glGetUniformLocation(p.update_program, "gravity");
+    p.emit_start = glGetUniformLocation(p.update_program, "emitStart");
+    p.emit_count = glGetUniformLocation(p.update_program, "emitCount");
+    p.particle_count = glGetUniformLocation(p.update_program, "particleCount");
+    p.emit_origin = glGetUniformLocation(p.update_program, "emitOrigin");
+    p.emit_velocity = glGetUniformLocation(p.update_program, "emitVelocity");
+    p.emit_spread = glGetUniformLocation(p.update_program, "emitSpread");
+    p.emit_life = glGetUniformLocation(p.update_program, "emitLife");
+    p.emit_color = glGetUniformLocation(p.update_program, "emitColor");
+    p.seed = glGetUniformLocation(p.update_program, "seed");
+    p.view_projection = glGetUniformLocation(p.draw_program, "VP");
+    p.viewport_height = glGetUniformLocation(p.draw_program, "viewportHeight");
+
+    // all dead : life 0
+    vector<GLfloat> zero(PARTICLE_COUNT * PARTICLE_FLOATS, 0);
+    GLsizei stride = PARTICLE_FLOATS * sizeof(GLfloat);
+    glGenBuffers(2, p.buffers);
+    glGenVertexArrays(2, p.vaos);
+    for (int i=0; i<2; i++) {
+        glBindVertexArray(p.vaos[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, p.buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, zero.size() * sizeof(GLfloat), &zero[0], GL_DYNAMIC_COPY);
+        statAdd(STAT_BUFFER_BYTES, zero.size() * sizeof(GLfloat));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3*sizeof(GLfloat)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6*sizeof(GLfloat)));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(8*sizeof(GLfloat)));
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    p.current = 0;
+    p.next_slot = 0;
+    p.events_seen = 0;
+    p.alive_until = 0;
+    p.last_time = glfwGetTime();
+}
+
+/* One transform feedback step from the current buffer into the other,
+   respawning a burst of e when it is not NULL */
+void particlePass (float dt, const ParticleEvent* e)
+{
+    ParticleSystem& p = particles;
+    glUseProgram(p.update_program);
+    glUniform1f(p.dt, dt);
+    glUniform3f(p.gravity, 0, -9.8f, 0);
+    glUniform1i(p.particle_count, PARTICLE_COUNT);
+    if (e != NULL) {
+        const ParticleBurst& b = particle_bursts[e->kind];
+        glUniform1i(p.emit_start, p.next_slot);
+        glUniform1i(p.emit_count, b.count);
+        glUniform3fv(p.emit_origin, 1, e->origin);
+        glUniform3fv(p.emit_velocity, 1, b.velocity);
+        glUniform1f(p.emit_spread, b.spread);
+        glUniform1f(p.emit_life, b.life);
+        glUniform3fv(p.emit_color, 1, b.color);
+        glUniform1f(p.seed, (float)(p.events_seen % 1000) * 7.31f);
+        p.next_slot = (p.next_slot + b.count) % PARTICLE_COUNT;
+        p.alive_until = max(p.alive_until, glfwGetTime() + b.life);
+    }
+    else
+        glUniform1i(p.emit_count, 0);
+    statAdd(STAT_UNIFORM_UPLOADS, e != NULL ? 11 : 4);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(p.vaos[p.current]);
+    statAdd(STAT_VAO_BINDS);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, p.buffers[1 - p.current]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, PARTICLE_COUNT);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    statAdd(STAT_DRAW_CALLS);
+    p.current = 1 - p.current;
+}
+
+/* Emits the bursts of the snapshot the renderer has not seen and steps the simulation */
+void updateParticles (const FrameSnapshot& frame)
+{
+    ParticleSystem& p = particles;
+    double now = glfwGetTime();
+    float dt = min(0.05, now - p.last_time);
+    p.last_time = now;
+
+    // older events were overwritten in the ring, they are lost
+    p.events_seen = max(p.events_seen, frame.particle_event_count - PARTICLE_EVENTS);
+    bool stepped = false;
+    for (; p.events_seen < frame.particle_event_count; p.events_seen++) {
+        // the first burst rides on the step, the others get a step of their own without time
+        particlePass(stepped ? 0 : dt, &frame.particle_events[p.events_seen % PARTICLE_EVENTS]);
+        stepped = true;
+    }
+    if (!stepped && now < p.alive_until)
+        particlePass(dt, NULL);
+}
+
+/* Additive points over the scene, depth tested but not written */
+void drawParticles (const FrameSnapshot& frame)
+{
+    ParticleSystem& p = particles;
+    if (glfwGetTime() >= p.alive_until)
+        return;
+    glUseProgram(p.draw_program);
+    glUniformMatrix4fv(p.view_projection, 1, GL_FALSE, frame.scene.view_projection.m);
+    glUniform1f(p.viewport_height, render_height);
+    statAdd(STAT_UNIFORM_UPLOADS, 2);
+
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(p.vaos[p.current]);
+    statAdd(STAT_VAO_BINDS);
+    glDrawArrays(GL_POINTS, 0, PARTICLE_COUNT);
+    statAdd(STAT_DRAW_CALLS);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    glDisable(GL_PROGRAM_POINT_SIZE);
 }
 
 /* Render the scene with openGL */
 /* Edit this function according to your assignment */
-void draw (GLFWwindow* window, float x, float y, float w, float h)
+/* Runs on the render thread, the game state is only seen through the snapshot */
+void draw (const FrameSnapshot& frame, float x, float y, float w, float h)
 {
-    int fbwidth, fbheight;
-    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    // size of the target bound by beginScene(), smaller than the window when scaled down
+    int fbwidth = render_width, fbheight = render_height;
     glViewport((int)(x*fbwidth), (int)(y*fbheight), (int)(w*fbwidth), (int)(h*fbheight));
 
     // use the loaded shader program
     // Don't change unless you know what you are doing
     glUseProgram(programID);
 
-if(view==0)
-{//normal
-  eyeX = 8;
-  eyeY = 10;
-  eyeZ = 10;
-  targetX = 0;
-  targetY = 0;
-  targetZ = 0;
-}
-else if(view==1)
-{//block
-  eyeX = block_pos.x-1;
-  eyeY = 3;
-  eyeZ = block_pos.z;
-  targetX = block_pos.x+5;
-  targetY = 0;
-  targetZ = block_pos.z+5;
-}
-else if(view==2)
-{//top
-  eyeX = 0;
-  eyeY = 12;
-  eyeZ = 0;
-  targetX = 1;
-  targetY = 1;
-  targetZ = 1;
-}
-else if(view==3)
-{//tower
-  eyeX = 7;
-  eyeY = 15;
-  eyeZ = 7;
-  targetX = 1;
-  targetY = 1;
-  targetZ = 1;
-}
-else if(view==4)
-{//follow camera actor mode
-  eyeX = block_pos.x-5;
-  eyeY = 5;
-  eyeZ = block_pos.z;
-  targetX = block_pos.x+5;
-  targetY = 0;
-  targetZ = block_pos.z+5;
-}
-else if(view==5)
-{//helicopter WASD to move in helicopter mode
-  heliViewFlag = 1;
-  eyeX = camera_pos.x;
-  eyeY = camera_pos.y;
-  eyeZ = camera_pos.z;
-  targetX = target_pos.x;
-  targetY = target_pos.y;
-  targetZ = target_pos.z;
-}
-else if(view==6)
-{//followcam bird mode
-  eyeX = block_pos.x-10;
-  eyeY = 10;
-  eyeZ = block_pos.z;
-  targetX = block_pos.x+10;
-  targetY = 10;
-  targetZ = block_pos.z+10;
-}
-
-    // Eye - Location of camera. Don't change unless you are sure!!
-	glm::vec3 eye (eyeX,eyeY,eyeZ);
-
-	// Target - Where is the camera looking at.  Don't change unless you are sure!!
-    glm::vec3 target (targetX,targetY,targetZ);
-    // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-    glm::vec3 up (0,1,0);
-
-    // Compute Camera matrix (view)
-    // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-    //  Don't change unless you are sure!!
-    Matrices.view = glm::lookAt(eye, target, up); // Fixed camera for 2D (ortho) in XY plane
-
-    // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-    //  Don't change unless you are sure!!
-    VP = Matrices.projectionP * Matrices.view;
-
-    // Send our transformation to the currently bound shader, in the "MVP" uniform
-    // For each model you render, since the MVP will be different (at least the M part)
-    //  Don't change unless you are sure!!
-    //glm::mat4 MVP;	// MVP = Projection * View * Model
+    // the scene was built by simulate(), the GL calls below and the
+    // software renderer only replay it
+    memcpy(&VP[0][0], frame.scene.view_projection.m, sizeof(frame.scene.view_projection.m));
 
     /* Render your scene */
-    //  Don't change unless you are sure!!
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
     drawAxis();
+    uploadRoll(frame.roll);
+    drawSceneGL(frame.scene, !frame.editing);
+    if (frame.editing)
+        drawEditor(frame);
+
+    // the particles step on the GPU, then draw over the opaque scene
+    updateParticles(frame);
+    drawParticles(frame);
+}
 
-    // Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-    // glPopMatrix ();
+/****************************
+ * Frame capture (PBO ring) *
+ ****************************/
+
+/* glReadPixels goes into a pixel buffer object and a fence, the PBO is only
+   mapped once its fence has signaled a few frames later, so reading back
+   the frame never waits for the GPU */
+#define CAPTURE_SLOTS 3
+
+struct CaptureSlot {
+    GLuint pbo;
+    GLsync fence;
+    GLsizeiptr size;
+    int width, height;
+    int format;
+    char path[64];
+};
 
-    moveBlock();
+CaptureSlot capture_slots[CAPTURE_SLOTS];
+int capture_next = 0;     // slot used by the next readback
+int capture_pending = 0;  // slots waiting on their fence, oldest first
 
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translateBlock = glm::translate (block_pos);        // glTranslatef
-	glm::mat4 translateBlock_to_origin = glm::translate (glm::vec3(-1.0*block_pos.x,-1.0*block_pos.y,-1.0*block_pos.z));
-	glm::mat4 rotateBlock = glm::rotate(blockRotation, axis);  // rotate about vector (1,0,0)
-	glm::mat4 translateBlock_back = glm::translate (glm::vec3(block_pos.x, block_pos.y, block_pos.z));
-	Matrices.model *= translateBlock_back*rotateBlock*translateBlock_to_origin*translateBlock;
+void initCapture ()
+{
+    for (int i=0; i<CAPTURE_SLOTS; i++) {
+        glGenBuffers(1, &capture_slots[i].pbo);
+        capture_slots[i].fence = 0;
+        capture_slots[i].size = 0;
+    }
+    startCaptureWorker();
+    // Escape and the last level leave through exit() : registered before
+    // atexit(stopRenderThread), so it runs after it, with the context back here
+    atexit(finishCapture);
+}
 
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(block);
+/* Hands the finished readbacks to the encoder, in order */
+/* Only finishCapture() waits for the GPU */
+void collectCaptures (bool wait)
+{
+    while (capture_pending > 0) {
+        CaptureSlot& slot = capture_slots[(capture_next - capture_pending + CAPTURE_SLOTS) % CAPTURE_SLOTS];
+        GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            break;
 
-    for(int i=0;i<11;i++)
-    {
-        for(int j=0;j<15;j++)
-        {
-            if(map1[level][i][j] == 1)
-            {
-                Matrices.model = glm::mat4(1.0f);
-                glm::mat4 translateBrick = glm::translate(glm::vec3(0,0,0));
-                translateBrick *= glm::translate(glm::vec3(i,0,j));
-                Matrices.model *= translateBrick;
-                MVP = VP * Matrices.model;
-                glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(brick);
-            }
-            else if(map1[level][i][j]==3)
-            {
-              Matrices.model = glm::mat4(1.0f);
-              glm::mat4 translateBrick = glm::translate(glm::vec3(0,0,0));
-              translateBrick *= glm::translate(glm::vec3(i,0,j));
-              Matrices.model *= translateBrick;
-              MVP = VP * Matrices.model;
-              glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-              draw3DObject(orange_brick);
-            }
-            else if(map1[level][i][j]==4 && bridgeCheck==1)
-            {
-              Matrices.model = glm::mat4(1.0f);
-              glm::mat4 translateBrick = glm::translate(glm::vec3(0,0,0));
-              translateBrick *= glm::translate(glm::vec3(i,0,j));
-              Matrices.model *= translateBrick;
-              MVP = VP * Matrices.model;
-              glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-              draw3DObject(bridge_brick);
-            }
-            else if(map1[level][i][j]==5)
-            {
-              Matrices.model = glm::mat4(1.0f);
-              glm::mat4 translateBrick = glm::translate(glm::vec3(0,0,0));
-              translateBrick *= glm::translate(glm::vec3(i,0,j));
-              Matrices.model *= translateBrick;
-              MVP = VP * Matrices.model;
-              glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-              draw3DObject(switch_brick);
-            }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        capture_pending--;
+        if (status == GL_WAIT_FAILED)
+            continue;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+        if (data != NULL) {
+            unsigned char* pixels = new unsigned char[slot.size];
+            memcpy(pixels, data, slot.size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            queueCaptureFrame(pixels, slot.width, slot.height, slot.format, slot.path);
         }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    if (capture_pending == 0 && capture_close_pending) {
+        closeCaptureVideo(capture_video_path);
+        capture_close_pending = 0;
+    }
+}
+
+/* Starts the readback of the back buffer when a capture is due */
+/* Call after draw() and before glfwSwapBuffers */
+void captureFrame (const FrameSnapshot& frame)
+{
+    collectCaptures(false);
+    if (!screenshot_requested && !capture_continuous)
+        return;
+
+    // All slots still in flight : skip this frame instead of stalling
+    if (capture_pending == CAPTURE_SLOTS)
+        return;
+
+    CaptureSlot& slot = capture_slots[capture_next];
+    slot.width = frame.fbwidth;
+    slot.height = frame.fbheight;
+    if (screenshot_requested) {
+        slot.format = CAPTURE_PNG;
+        snprintf(slot.path, sizeof(slot.path), "screenshot-%03d.png", screenshot_count++);
+        screenshot_requested = 0;
+    }
+    else if (capture_format == CAPTURE_PNG) {
+        slot.format = CAPTURE_PNG;
+        snprintf(slot.path, sizeof(slot.path), "capture-%05d.png", capture_frame_count++);
     }
+    else {
+        slot.format = CAPTURE_Y4M;
+        snprintf(slot.path, sizeof(slot.path), "%s", capture_video_path);
+    }
+
+    GLsizeiptr size = 4 * (GLsizeiptr)slot.width * slot.height;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    if (size != slot.size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot.size = size;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadBuffer(GL_BACK);
+    glReadPixels(0, 0, slot.width, slot.height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    capture_next = (capture_next + 1) % CAPTURE_SLOTS;
+    capture_pending++;
+}
+
+/* Flushes the readbacks in flight and stops the encoder, on exit */
+void finishCapture ()
+{
+    collectCaptures(true);
+    if (capture_continuous && capture_format == CAPTURE_Y4M)
+        closeCaptureVideo(capture_video_path);
+    stopCaptureWorker();
+}
+
+/******************************
+ * Dynamic resolution scaling *
+ ******************************/
+
+/* The scene is drawn into an offscreen FBO whose size follows the measured
+   frame cost, and stretched to the window with a linear blit. The cost is
+   read from GL_TIME_ELAPSED queries a few frames late (so it is not
+   hidden by the vsync wait), with the CPU submit time as a floor. */
+#define FRAME_QUERIES 4
+
+struct RenderTarget {
+    GLuint fbo, color, depth;
+    int width, height;
+};
+
+RenderTarget scene_target;
+int dynamic_resolution = 1;
+float render_scale = 1.0f;
+float min_render_scale = 0.35f;
+float frame_budget_ms = 16.6f;  // --frame-budget=MS
+float scale_hysteresis = 0.15f; // only scale up when comfortably under budget
+double frame_cost_ms = 0;       // smoothed cost of the last frames
+int scale_cooldown = 0;         // frames to wait before the next change
+
+GLuint frame_queries[FRAME_QUERIES];
+int query_next = 0, query_pending = 0, query_running = 0;
+double frame_cpu_start;
+
+void initSceneTarget ()
+{
+    glGenFramebuffers(1, &scene_target.fbo);
+    glGenTextures(1, &scene_target.color);
+    glGenRenderbuffers(1, &scene_target.depth);
+    scene_target.width = scene_target.height = 0;
+    glGenQueries(FRAME_QUERIES, frame_queries);
+}
+
+/* (Re)allocates the FBO attachments for a new render size */
+void resizeSceneTarget (int width, int height)
+{
+    if (scene_target.width == width && scene_target.height == height)
+        return;
+    scene_target.width = width;
+    scene_target.height = height;
+
+    glBindTexture(GL_TEXTURE_2D, scene_target.color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, scene_target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scene_target.color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, scene_target.depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "scene framebuffer incomplete at %dx%d\n", width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* Feeds one frame cost to the scale controller */
+void updateRenderScale (double cost_ms)
+{
+    frame_cost_ms = frame_cost_ms == 0 ? cost_ms : 0.9*frame_cost_ms + 0.1*cost_ms;
+    if (!dynamic_resolution || scale_cooldown > 0) {
+        scale_cooldown--;
+        return;
+    }
+
+    // fill cost goes with the pixel count, that is the square of the scale
+    float scale = render_scale;
+    if (frame_cost_ms > frame_budget_ms)
+        scale = max(min_render_scale, max(render_scale - 0.15f, render_scale * (float)sqrt(frame_budget_ms / frame_cost_ms)));
+    else {
+        float up = min(1.0f, render_scale + 0.05f);
+        if (frame_cost_ms * (up*up) / (render_scale*render_scale) < frame_budget_ms * (1 - scale_hysteresis))
+            scale = up;
+    }
+
+    if (scale != render_scale) {
+        // the smoothed cost was measured at the old size
+        frame_cost_ms *= (scale*scale) / (render_scale*render_scale);
+        render_scale = scale;
+        scale_cooldown = 20;
+        printf("RENDER SCALE %.2f (frame cost %.2f ms)\n", render_scale, frame_cost_ms);
+    }
+}
+
+/* Reads the timer queries that have finished, oldest first */
+void collectFrameQueries ()
+{
+    while (query_pending > 0) {
+        GLuint query = frame_queries[(query_next - query_pending + FRAME_QUERIES) % FRAME_QUERIES];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        query_pending--;
+        updateRenderScale(elapsed / 1e6);
+    }
+}
+
+/* FXAA : with a preset on, the scene goes to the offscreen target even at
+   full scale, and instead of the blit one full screen triangle resolves it
+   to the window through Fxaa_GL.frag (upscaling too, when scaled down).
+   A few texture reads per pixel, and most pixels stop at the first five,
+   where MSAA would multiply the fill cost of the CPU rasterizers. */
+struct FxaaPass {
+    GLuint program, vao;
+    GLint scene, texel_size, edge_threshold, edge_threshold_min, subpixel, search_steps;
+} fxaa;
+
+void initFxaa (const string& vertexShader, const string& fragmentShader)
+{
+    fxaa.program = CompileShaders(vertexShader, fragmentShader);
+    fxaa.scene = glGetUniformLocation(fxaa.program, "scene");
+    fxaa.texel_size = glGetUniformLocation(fxaa.program, "texelSize");
+    fxaa.edge_threshold = glGetUniformLocation(fxaa.program, "edgeThreshold");
+    fxaa.edge_threshold_min = glGetUniformLocation(fxaa.program, "edgeThresholdMin");
+    fxaa.subpixel = glGetUniformLocation(fxaa.program, "subpixel");
+    fxaa.search_steps = glGetUniformLocation(fxaa.program, "searchSteps");
+    // the triangle comes from gl_VertexID, the core profile still wants a VAO
+    glGenVertexArrays(1, &fxaa.vao);
+}
+
+/* Resolves the scene target to the window */
+void drawFxaa (const FrameSnapshot& frame)
+{
+    const FxaaPreset& p = fxaa_presets[frame.fxaa];
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, frame.fbwidth, frame.fbheight);
+    glDisable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    glUseProgram(fxaa.program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scene_target.color);
+    glUniform1i(fxaa.scene, 0);
+    glUniform2f(fxaa.texel_size, 1.0f / render_width, 1.0f / render_height);
+    glUniform1f(fxaa.edge_threshold, p.edge_threshold);
+    glUniform1f(fxaa.edge_threshold_min, p.edge_threshold_min);
+    glUniform1f(fxaa.subpixel, p.subpixel);
+    glUniform1i(fxaa.search_steps, p.search_steps);
+    statAdd(STAT_UNIFORM_UPLOADS, 6);
+
+    glBindVertexArray(fxaa.vao);
+    statAdd(STAT_VAO_BINDS);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    statAdd(STAT_DRAW_CALLS);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+/* Binds the buffer the scene is drawn into and clears it */
+void beginScene (const FrameSnapshot& frame)
+{
+    frame_cpu_start = glfwGetTime();
+    collectFrameQueries();
+    streamBeginFrame();
+
+    int fbwidth = frame.fbwidth, fbheight = frame.fbheight;
+
+    query_running = query_pending < FRAME_QUERIES;
+    if (query_running)
+        glBeginQuery(GL_TIME_ELAPSED, frame_queries[query_next]);
+
+    if (render_scale >= 1.0f) {
+        render_width = fbwidth;
+        render_height = fbheight;
+    }
+    else {
+        render_width = max(1, (int)(fbwidth * render_scale + 0.5f));
+        render_height = max(1, (int)(fbheight * render_scale + 0.5f));
+    }
+    // FXAA reads the scene back, even at full scale
+    if (render_scale >= 1.0f && frame.fxaa == FXAA_OFF)
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    else {
+        resizeSceneTarget(render_width, render_height);
+        glBindFramebuffer(GL_FRAMEBUFFER, scene_target.fbo);
+    }
+
+    // clear the color and depth in the frame buffer
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+/* Upscales the scene to the window, the default framebuffer is bound afterwards */
+void endScene (const FrameSnapshot& frame)
+{
+    if (frame.fxaa != FXAA_OFF)
+        drawFxaa(frame);
+    else if (render_scale < 1.0f) {
+        int fbwidth = frame.fbwidth, fbheight = frame.fbheight;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_target.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, render_width, render_height, 0, 0, fbwidth, fbheight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    if (query_running) {
+        glEndQuery(GL_TIME_ELAPSED);
+        query_next = (query_next + 1) % FRAME_QUERIES;
+        query_pending++;
+    }
+    else {
+        // no query slot free : the GPU is behind, use the CPU submit time instead
+        updateRenderScale((glfwGetTime() - frame_cpu_start) * 1000);
+    }
+}
+
+/*******
+ * HUD *
+ *******/
+
+/* Level, moves, time and block state in the top left corner (F1), drawn
+   from the glyph atlas of font.cpp with the Text_GL program. The glyph
+   quads are rebuilt and uploaded only when the text changes, then drawn
+   with one call every frame. */
+GLuint text_program, text_vao, text_vbo, font_texture;
+GLint text_screen_uniform, text_glyphs_uniform;
+string hud_text;
+int hud_vertices = 0;
+
+void initHud (const vector<unsigned char>& atlas, const string& vertexShader, const string& fragmentShader)
+{
+    text_program = CompileShaders(vertexShader, fragmentShader);
+    text_screen_uniform = glGetUniformLocation(text_program, "screenSize");
+    text_glyphs_uniform = glGetUniformLocation(text_program, "glyphs");
+
+    glGenTextures(1, &font_texture);
+    glBindTexture(GL_TEXTURE_2D, font_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, FONT_ATLAS_W, FONT_ATLAS_H, 0, GL_RED, GL_UNSIGNED_BYTE, &atlas[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    statAdd(STAT_BUFFER_BYTES, atlas.size());
+
+    // x, y, u, v, r, g, b per vertex, see layoutText
+    glGenVertexArrays(1, &text_vao);
+    glGenBuffers(1, &text_vbo);
+    glBindVertexArray(text_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 7*sizeof(GLfloat), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 7*sizeof(GLfloat), (void*)(2*sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 7*sizeof(GLfloat), (void*)(4*sizeof(GLfloat)));
+    glBindVertexArray(0);
+}
+
+const char* blockStateName ()
+{
+    if (block_pos.y < 0.5f)
+        return "FALLING";
+    if (blockState == BLOCK_STANDING)
+        return "STANDING";
+    return blockState == BLOCK_LYING_X ? "LYING X" : "LYING Z";
+}
+
+/* The HUD line of the current game state, on the simulation side */
+void formatHud (char* line, size_t size)
+{
+    int seconds = (int)(glfwGetTime() - level_start_time);
+    snprintf(line, size, "LEVEL %d/%d  MOVES %d  TIME %d:%02d  %s",
+             level + 1, LEVELS, moves, seconds / 60, seconds % 60, blockStateName());
+}
+
+/* Draws the HUD over the whole window, after endScene */
+void drawHud (const FrameSnapshot& frame)
+{
+    const char* line = frame.hud;
+    if (line[0] == 0)
+        return;
+
+    if (hud_text != line) {
+        static vector<float> vertices;
+        static const float shadow[3] = { 0, 0, 0 }, white[3] = { 1, 1, 1 };
+        vertices.clear();
+        layoutText(vertices, line, 12, 12, 2, shadow);
+        layoutText(vertices, line, 10, 10, 2, white);
+
+        glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(float), &vertices[0], GL_DYNAMIC_DRAW);
+        statAdd(STAT_BUFFER_BYTES, vertices.size()*sizeof(float));
+        hud_vertices = vertices.size() / 7;
+        hud_text = line;
+    }
+
+    int fbwidth = frame.fbwidth, fbheight = frame.fbheight;
+    glViewport(0, 0, fbwidth, fbheight);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(text_program);
+    glUniform2f(text_screen_uniform, fbwidth, fbheight);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, font_texture);
+    glUniform1i(text_glyphs_uniform, 0);
+
+    glBindVertexArray(text_vao);
+    statAdd(STAT_VAO_BINDS);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArrays(GL_TRIANGLES, 0, hud_vertices);
+    statAdd(STAT_DRAW_CALLS);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+/***************************
+ * Software renderer check *
+ ***************************/
+
+/* --soft-check : once a second the frame is read back and drawn again by
+   the CPU renderer (softrast.cpp) from the same Scene, and the pixels that
+   differ by more than SOFT_CHECK_TOLERANCE are counted */
+#define SOFT_CHECK_TOLERANCE 8
+
+int soft_check = 0;
+double soft_check_time = 0;
+SoftRasterizer* soft_rasterizer = NULL;
+
+void checkSoftRenderer (const FrameSnapshot& frame)
+{
+    // a scaled down scene was stretched, nothing to compare pixel for pixel
+    // the CPU renderer shows the block where the roll ends, and has no FXAA
+    if (!soft_check || render_scale < 1.0f || frame.fxaa != FXAA_OFF || glfwGetTime() - soft_check_time < 1
+        || glfwGetTime() < frame.roll.start + frame.roll.duration)
+        return;
+    soft_check_time = glfwGetTime();
+
+    int w = render_width, h = render_height;
+    if (soft_rasterizer == NULL || softWidth(soft_rasterizer) != w || softHeight(soft_rasterizer) != h) {
+        if (soft_rasterizer != NULL)
+            softDestroy(soft_rasterizer);
+        soft_rasterizer = softCreate(w, h, 0);
+        softSetMeshes(soft_rasterizer, bakeBlockMesh(), bakeTileMesh());
+    }
+
+    vector<unsigned char> pixels(4*(size_t)w*h);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    double soft_start = glfwGetTime();
+    softRender(soft_rasterizer, frame.scene);
+    double soft_ms = (glfwGetTime() - soft_start) * 1000;
+
+    const unsigned char* soft = softPixels(soft_rasterizer);
+    int differ = 0, worst = 0;
+    for (size_t i=0; i<(size_t)w*h; i++) {
+        int diff = 0;
+        for (int c=0; c<3; c++)
+            diff = max(diff, abs(pixels[4*i+c] - soft[4*i+c]));
+        worst = max(worst, diff);
+        if (diff > SOFT_CHECK_TOLERANCE)
+            differ++;
+    }
+    printf("SOFTRAST CHECK : %d of %d pixels differ by more than %d (max %d), %.2f ms on the CPU\n",
+           differ, w*h, SOFT_CHECK_TOLERANCE, worst, soft_ms);
+}
+
+/*****************
+ * Asset loading *
+ *****************/
+
+/* Everything that does not need the GL context (file I/O, sound decoding,
+   mesh building) is a job on engine_jobs, started before the window is
+   created. The levels need no loading, their tables are built by the
+   compiler (levels.h). initGL then waits for ready, running jobs itself
+   meanwhile, and uploads the results. */
+struct AssetJobs {
+    string vertexShader, fragmentShader;
+    string textVertexShader, textFragmentShader;
+    string particleUpdateShader, particleVertexShader, particleFragmentShader;
+    string fxaaVertexShader, fxaaFragmentShader;
+    vector<unsigned char> fontAtlas;
+    Mesh blockMesh, tileMesh;
+    JobHandle ready;    // after everything above
+} asset_jobs;
+
+chrono::steady_clock::time_point startup_time;
+
+double millisecondsSinceStartup ()
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - startup_time).count();
+}
+
+void startAssetLoading ()
+{
+    engine_jobs = jobsCreate(0);
+
+    AssetJobs* a = &asset_jobs;
+    vector<JobHandle> loads;
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->vertexShader = readShaderFile("Sample_GL.vert"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->fragmentShader = readShaderFile("Sample_GL.frag"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->textVertexShader = readShaderFile("Text_GL.vert"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->textFragmentShader = readShaderFile("Text_GL.frag"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->particleUpdateShader = readShaderFile("Particle_Update.vert"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->particleVertexShader = readShaderFile("Particle_GL.vert"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->particleFragmentShader = readShaderFile("Particle_GL.frag"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->fxaaVertexShader = readShaderFile("Fxaa_GL.vert"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->fxaaFragmentShader = readShaderFile("Fxaa_GL.frag"); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->fontAtlas = bakeFontAtlas(); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->blockMesh = bakeBlockMesh(); }));
+    loads.push_back(jobsSubmit(engine_jobs, [a] { a->tileMesh = bakeTileMesh(); }));
+    a->ready = jobsSubmitAfter(engine_jobs, [] {}, loads);
+
+    // playSound falls back to mpg123 until these are done, never waited on;
+    // they sit in system(), so the main loop's jobsRunUntil leaves them alone
+    JobHandle aplay = jobsSubmit(engine_jobs, findAplay, JOB_BLOCKING);
+    for (int i=0; i<SOUND_COUNT; i++)
+        jobsSubmitAfter(engine_jobs, [i] { decodeSound(i); }, vector<JobHandle>(1, aplay), JOB_BLOCKING);
+
+    // the first level's hint field, before anyone asks
+    prefetchLevelField(0);
+}
+
+/* Utilisation of the engine workers, at exit */
+void printJobStats ()
+{
+    int threads = jobsThreadCount(engine_jobs);
+    for (int t=0; t<=threads; t++) {
+        JobWorkerStats w = jobsWorkerStats(engine_jobs, t);
+        printf("JOBS %s %d : %ld jobs, %.1f%% busy\n", t < threads ? "worker" : "main",
+               t, w.jobs, 100 * w.busy_ms / w.alive_ms);
+    }
+}
+
+/***********************
+ * Performance overlay *
+ ***********************/
+
+/* F3 : graph of the last frame times in the bottom left corner, green
+   under the frame budget, yellow under twice the budget and red above,
+   with the counters of the last frame in the window title */
+#define OVERLAY_BARS 120
+
+GLuint overlay_vao;
+
+struct WindowTitle {
+    char text[256];
+};
+TripleBuffer<WindowTitle> window_titles;
+double overlay_title_time = 0;
+
+/*****************
+ * Input latency *
+ *****************/
+
+/* A frame that applied a key gets a GL_TIMESTAMP query and a fence right
+   after glfwSwapBuffers. Later frames poll them without waiting; the GPU
+   time is mapped to glfwGetTime() through GL_TIMESTAMP, read again at
+   every collection so the two clocks cannot drift apart. */
+#define LATENCY_SLOTS 4
+
+struct LatencySlot {
+    GLuint query;
+    GLsync fence;
+    double key_time;
+};
+
+LatencySlot latency_slots[LATENCY_SLOTS];
+int latency_next = 0, latency_pending = 0;
+const char* latency_export_path = NULL;  // --latency=FILE
+
+void initLatency ()
+{
+    for (int i=0; i<LATENCY_SLOTS; i++) {
+        glGenQueries(1, &latency_slots[i].query);
+        latency_slots[i].fence = 0;
+    }
+}
+
+/* Call before glfwSwapBuffers, once the frame is submitted */
+void latencySubmitted ()
+{
+    if (frame_key_time >= 0)
+        latencyAdd(LATENCY_SUBMIT, (glfwGetTime() - frame_key_time) * 1000);
+}
+
+/* Call right after glfwSwapBuffers */
+void latencySwapped ()
+{
+    if (frame_key_time < 0)
+        return;
+    // all slots in flight : drop the sample rather than stall
+    if (latency_pending < LATENCY_SLOTS) {
+        LatencySlot& slot = latency_slots[latency_next];
+        glQueryCounter(slot.query, GL_TIMESTAMP);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.key_time = frame_key_time;
+        latency_next = (latency_next + 1) % LATENCY_SLOTS;
+        latency_pending++;
+    }
+    frame_key_time = -1;
+}
+
+/* Reads the slots the GPU is done with, oldest first */
+void collectLatency ()
+{
+    while (latency_pending > 0) {
+        LatencySlot& slot = latency_slots[(latency_next - latency_pending + LATENCY_SLOTS) % LATENCY_SLOTS];
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        latency_pending--;
+
+        GLuint64 done = 0;
+        GLint64 gpu_now = 0;
+        glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &done);
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        double done_time = glfwGetTime() - (gpu_now - (GLint64)done) / 1e9;
+        latencyAdd(LATENCY_PRESENT, (done_time - slot.key_time) * 1000);
+    }
+}
+
+/* Prints the summary and writes --latency, at exit */
+void finishLatency ()
+{
+    if (latencyCount(LATENCY_APPLY) > 0)
+        printf("LATENCY apply p50 %.2f p99 %.2f, submit p50 %.2f p99 %.2f, present p50 %.2f p99 %.2f ms\n",
+               latencyPercentile(LATENCY_APPLY, 0.5), latencyPercentile(LATENCY_APPLY, 0.99),
+               latencyPercentile(LATENCY_SUBMIT, 0.5), latencyPercentile(LATENCY_SUBMIT, 0.99),
+               latencyPercentile(LATENCY_PRESENT, 0.5), latencyPercentile(LATENCY_PRESENT, 0.99));
+    if (latency_export_path != NULL)
+        latencyExport(latency_export_path);
+}
+
+void initStatsOverlay ()
+{
+    glGenVertexArrays(1, &overlay_vao);
+}
+
+/* Appends a 2D quad to the overlay vertices (position, color) */
+void overlayQuad (GLfloat*& v, float x0, float y0, float x1, float y1, float r, float g, float b)
+{
+    float corners[6][2] = { {x0,y0}, {x1,y0}, {x1,y1}, {x0,y0}, {x1,y1}, {x0,y1} };
+    for (int i=0; i<6; i++) {
+        *v++ = corners[i][0]; *v++ = corners[i][1]; *v++ = 0;
+        *v++ = r; *v++ = g; *v++ = b;
+    }
+}
+
+/* Draws the overlay over the whole window, after endScene */
+void drawStatsOverlay (const FrameSnapshot& frame)
+{
+    if (!frame.overlay)
+        return;
+
+    int fbwidth = frame.fbwidth, fbheight = frame.fbheight;
+
+    // only the main thread may set the title, it picks it up from window_titles
+    if (glfwGetTime() - overlay_title_time > 1) {
+        char* title = tripleBack(window_titles).text;
+        snprintf(title, sizeof(tripleBack(window_titles).text), "Sample OpenGL 3.3 Application - %.1f ms p50, %.1f ms p99, %lld draws, %lld uniforms, %lld VAO binds, %lld stream bytes, scale %.2f",
+                 histogramPercentile(frame_ms_history, 0.5f), histogramPercentile(frame_ms_history, 0.99f),
+                 last_frame_counters[STAT_DRAW_CALLS], last_frame_counters[STAT_UNIFORM_UPLOADS],
+                 last_frame_counters[STAT_VAO_BINDS], last_frame_counters[STAT_STREAM_BYTES], render_scale);
+        triplePublish(window_titles);
+        overlay_title_time = glfwGetTime();
+    }
+
+    GLsizeiptr offset;
+    int vertices = 6 * (OVERLAY_BARS + 1);
+    GLfloat* v = (GLfloat*) streamAlloc(vertices * 6 * sizeof(GLfloat), &offset);
+    if (v == NULL)
+        return;
+
+    // bars fill [-0.95,-0.35] x [-0.95,-0.55], full height is twice the budget
+    float x0 = -0.95f, y0 = -0.95f, width = 0.6f, height = 0.4f;
+    float bar = width / OVERLAY_BARS;
+    for (int i=0; i<OVERLAY_BARS; i++) {
+        float ms = histogramRecent(frame_ms_history, OVERLAY_BARS - 1 - i);
+        float h = min(1.0f, ms / (2 * frame_budget_ms)) * height;
+        if (ms <= frame_budget_ms)
+            overlayQuad(v, x0 + i*bar, y0, x0 + (i+0.8f)*bar, y0 + h, 0.2f, 0.9f, 0.2f);
+        else if (ms <= 2 * frame_budget_ms)
+            overlayQuad(v, x0 + i*bar, y0, x0 + (i+0.8f)*bar, y0 + h, 0.9f, 0.9f, 0.2f);
+        else
+            overlayQuad(v, x0 + i*bar, y0, x0 + (i+0.8f)*bar, y0 + h, 0.9f, 0.2f, 0.2f);
+    }
+    // budget line
+    overlayQuad(v, x0, y0 + height/2, x0 + width, y0 + height/2 + 0.005f, 1, 1, 1);
+    streamFlush();
+
+    glViewport(0, 0, fbwidth, fbheight);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(programID);
+    MVP = glm::mat4(1.0f);
+    uploadMVP();
+
+    glBindVertexArray(overlay_vao);
+    statAdd(STAT_VAO_BINDS);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)offset);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)(offset + 3*sizeof(GLfloat)));
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArrays(GL_TRIANGLES, 0, vertices);
+    statAdd(STAT_DRAW_CALLS);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+/****************
+ * Frame pacing *
+ ****************/
+
+/* --pacing=vsync (default) renders as soon as the last swap returns, so
+   a frame shows the input of up to two refreshes ago. --pacing=late
+   waits after each swap until the frame completes (glFinish, nothing is
+   queued ahead), then sleeps until just before the next vblank, leaving
+   the predicted render cost and a margin, and only then takes the newest
+   snapshot (or polls the events, with --single-thread). --pacing=adaptive
+   is late pacing with adaptive vsync (EXT_swap_control_tear) : a frame
+   that misses its vblank is shown at once, torn, instead of a refresh
+   later. */
+enum { PACING_VSYNC, PACING_LATE, PACING_ADAPTIVE };
+#define PACING_SAMPLES 32
+#define PACING_MARGIN_MS 1.0
+
+int pacing_mode = PACING_VSYNC;
+
+struct FramePacer {
+    double period;            // seconds between vblanks, measured
+    double last_vblank;       // glfwGetTime() when the last swap completed, 0 before the first
+    double start, submitted;  // of the frame being drawn
+    double cost_ms[PACING_SAMPLES];   // CPU submit + GPU time of the last frames
+    int samples;
+    long frames, missed;
+    bool tear;                // adaptive vsync is on
+} pacer;
+
+/* Swap interval and refresh period, on the main thread with the context current */
+void initPacing ()
+{
+    pacer.tear = false;
+    if (pacing_mode == PACING_ADAPTIVE) {
+        if (glfwExtensionSupported("GLX_EXT_swap_control_tear") || glfwExtensionSupported("WGL_EXT_swap_control_tear"))
+            pacer.tear = true;
+        else
+            printf("PACING : no EXT_swap_control_tear, late frames wait for the next vblank\n");
+    }
+    glfwSwapInterval(pacer.tear ? -1 : 1);
+
+    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    pacer.period = 1.0 / (mode != NULL && mode->refreshRate > 0 ? mode->refreshRate : 60);
+}
+
+/* Render cost to plan for : the 90th percentile of the last frames */
+double pacingCost ()
+{
+    if (pacer.samples == 0)
+        return pacer.period * 1000;
+    int n = min(pacer.samples, PACING_SAMPLES);
+    double sorted[PACING_SAMPLES];
+    copy(pacer.cost_ms, pacer.cost_ms + n, sorted);
+    sort(sorted, sorted + n);
+    return sorted[n * 9 / 10];
+}
+
+/* Sleeps until the latest time a frame can start and still make the next vblank */
+void pacingWait ()
+{
+    if (pacing_mode == PACING_VSYNC || pacer.last_vblank == 0)
+        return;
+    double now = glfwGetTime();
+    double vblank = pacer.last_vblank + pacer.period;
+    while (vblank < now)
+        vblank += pacer.period;
+    double wake = vblank - (pacingCost() + PACING_MARGIN_MS) / 1000;
+    if (wake > now)
+        this_thread::sleep_for(chrono::duration<double>(wake - now));
+}
+
+/* Call when the frame starts and once it is submitted, before the swap */
+void pacingStarted ()
+{
+    pacer.start = glfwGetTime();
+}
+
+void pacingSubmitted ()
+{
+    pacer.submitted = glfwGetTime();
+}
+
+/* Call after the swap : waits for it with late pacing, the vblank it
+   returns at gives the phase of the next one */
+void pacingSwapped ()
+{
+    if (pacing_mode == PACING_VSYNC)
+        return;
+    glFinish();
+    double now = glfwGetTime();
+    if (pacer.last_vblank != 0) {
+        double interval = now - pacer.last_vblank;
+        if (interval > 1.5 * pacer.period)
+            pacer.missed++;
+        // refreshes that were not missed keep the period estimate honest
+        else if (interval > 0.5 * pacer.period)
+            pacer.period = 0.95 * pacer.period + 0.05 * interval;
+    }
+    pacer.last_vblank = now;
+    pacer.cost_ms[pacer.samples % PACING_SAMPLES] = (pacer.submitted - pacer.start) * 1000 + frame_cost_ms;
+    pacer.samples++;
+    pacer.frames++;
+}
+
+/* At exit */
+void printPacing ()
+{
+    if (pacing_mode == PACING_VSYNC || pacer.frames == 0)
+        return;
+    printf("PACING %s : %ld frames, %ld missed vblanks, planned cost %.2f ms, refresh %.2f ms\n",
+           pacing_mode == PACING_LATE ? "late" : pacer.tear ? "adaptive" : "adaptive (no tear control)",
+           pacer.frames, pacer.missed, pacingCost(), pacer.period * 1000);
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -1391,14 +2904,16 @@ GLFWwindow* initGLFW (int width, int height){
     }
 
     glfwMakeContextCurrent(window);
-    glfwSwapInterval( 1 );
+    // vsync, or adaptive vsync with --pacing=adaptive
+    initPacing();
     glfwSetFramebufferSizeCallback(window, reshapeWindow);
     glfwSetWindowSizeCallback(window, reshapeWindow);
     glfwSetWindowCloseCallback(window, quit);
     glfwSetKeyCallback(window, keyboard);      // general keyboard input
     glfwSetCharCallback(window, keyboardChar);  // simpler specific character handling
-  //  glfwSetMouseButtonCallback(window, mouseButton);  // mouse button clicks
-//    glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouseButton);  // mouse button clicks
+    glfwSetCursorPosCallback(window, cursorMoved);     // editor painting
+    glfwSetScrollCallback(window, scroll_callback);
 
     return window;
 }
@@ -1407,21 +2922,43 @@ GLFWwindow* initGLFW (int width, int height){
 /* Add all the models to be created here */
 void initGL (GLFWwindow* window, int width, int height)
 {
+    double wait_start = millisecondsSinceStartup();
+
     /* Objects should be created before any other gl function and shaders */
-    // Create the models
-    createBlock ();
-    createBrick();
-    createOrangeBrick();
-    createBridgeBrick();
-    createSwitchBrick();
+    // Upload the models baked by the asset jobs
+    jobsWaitFor(engine_jobs, asset_jobs.ready);
+    block = uploadMesh(asset_jobs.blockMesh);
+    tile = uploadMesh(asset_jobs.tileMesh);
+    axes = createAxes();
 
     // Create and compile our GLSL program from the shaders
-    programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+    programID = CompileShaders(asset_jobs.vertexShader, asset_jobs.fragmentShader);
+    initHud(asset_jobs.fontAtlas, asset_jobs.textVertexShader, asset_jobs.textFragmentShader);
+    initParticles(asset_jobs.particleUpdateShader, asset_jobs.particleVertexShader, asset_jobs.particleFragmentShader);
+    initFxaa(asset_jobs.fxaaVertexShader, asset_jobs.fxaaFragmentShader);
+
+    printf("ASSETS READY at %.1f ms (waited %.1f ms for the workers)\n",
+           millisecondsSinceStartup(), millisecondsSinceStartup() - wait_start);
     // Get a handle for our "MVP" uniform
     Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+    initRoll();
+
+    // Objects drawn without instances use an identity model and the vertex colors
+    glVertexAttrib4f(2, 1, 0, 0, 0);
+    glVertexAttrib4f(3, 0, 1, 0, 0);
+    glVertexAttrib4f(4, 0, 0, 1, 0);
+    glVertexAttrib4f(5, 0, 0, 0, 1);
+    glVertexAttrib1f(6, 0);
+
+    initStreamBuffer();
 
     reshapeWindow (window, width, height);
 
+    initCapture();
+    initSceneTarget();
+    initLatency();
+    initStatsOverlay();
+
     // Background color of the scene
     glClearColor (0.3f, 0.3f, 0.3f, 0.0f); // R, G, B, A
     glClearDepth (1.0f);
@@ -1430,31 +2967,425 @@ void initGL (GLFWwindow* window, int width, int height)
     glDepthFunc (GL_LEQUAL);
 }
 
+/*****************
+ * Render thread *
+ *****************/
+
+/* The GL context belongs to a render thread that draws the newest
+   FrameSnapshot as often as the swap allows. The main thread polls the
+   events and ticks the game SIM_HZ times a second, so neither a slow
+   glfwSwapBuffers nor the vsync wait delays the input, and neither side
+   ever waits for the other (triplebuffer.h). */
+#define SIM_HZ 60
+
+int single_thread = 0;
+thread render_thread;
+atomic<bool> render_running(false);
+GLFWwindow* render_window;
+
+/* Spectators (broadcast.h) : --broadcast publishes the game of this
+   window tick by tick, --spectate draws the game another window
+   publishes instead of playing one */
+const char* broadcast_path = NULL;   // --broadcast[=PATH]
+const char* spectate_path = NULL;    // --spectate[=PATH]
+BroadcastWriter* broadcaster = NULL;
+BroadcastReader* spectator = NULL;
+BroadcastState spectated;
+bool spectated_valid = false;
+double spectate_retry_time = 0;
+
+BroadcastState currentBroadcastState ()
+{
+    BroadcastState b;
+    b.x2 = (int)floor(block_pos.x*2 + 0.5f);
+    b.y2 = (int)floor(block_pos.y*2 + 0.5f);
+    b.z2 = (int)floor(block_pos.z*2 + 0.5f);
+    b.state = blockState;
+    b.rotation = (int)floor(blockRotation / (M_PI/2) + 0.5);
+    // the axis is always one of the six unit vectors
+    if (fabs(axis.x) > 0.5f)
+        b.axis = axis.x > 0 ? 0 : 1;
+    else if (fabs(axis.y) > 0.5f)
+        b.axis = axis.y > 0 ? 2 : 3;
+    else
+        b.axis = axis.z > 0 ? 4 : 5;
+    b.level = level;
+    b.bridge = bridge_toggle;
+    b.moves = moves;
+    return b;
+}
+
+void closeBroadcast ()
+{
+    if (broadcaster != NULL)
+        broadcastClose(broadcaster);
+    broadcaster = NULL;
+}
+
+/* Replaces moveBlock() for a spectator : the newest state of the stream,
+   the game waits on its first keyframe */
+void spectate ()
+{
+    arrow_key = 0;
+    key_queue_count = 0;
+    if (spectator == NULL) {
+        if (glfwGetTime() < spectate_retry_time)
+            return;
+        spectator = broadcastAttach(spectate_path);
+        if (spectator == NULL) {
+            printf("SPECTATE : no game on %s yet\n", spectate_path);
+            spectate_retry_time = glfwGetTime() + 1;
+            return;
+        }
+        printf("SPECTATE %s\n", spectate_path);
+    }
+
+    BroadcastState b;
+    if (broadcastPoll(spectator, b) && b.level >= 0 && b.level < LEVELS && b.state >= BLOCK_STANDING) {
+        if (b.level != level) {
+            prefetchLevel(b.level);
+            prefetchLevel(b.level + 1);
+        }
+        spectated = b;
+        spectated_valid = true;
+    }
+    if (!spectated_valid)
+        return;
+
+    // set every tick, the keys of this window change nothing for long
+    const BroadcastState& g = spectated;
+    block_pos = glm::vec3(g.x2 / 2.0f, g.y2 / 2.0f, g.z2 / 2.0f);
+    blockState = g.state;
+    blockRotation = g.rotation * M_PI/2;
+    static const glm::vec3 axes[6] = {
+        glm::vec3(1,0,0), glm::vec3(-1,0,0), glm::vec3(0,1,0),
+        glm::vec3(0,-1,0), glm::vec3(0,0,1), glm::vec3(0,0,-1),
+    };
+    axis = axes[min(g.axis, 5)];
+    level = g.level;
+    bridge_toggle = bridgeCheck = g.bridge;
+    moves = g.moves;
+}
+
+/* One game tick into a new snapshot, on the main thread */
+void simulate (GLFWwindow* window)
+{
+    FrameSnapshot& frame = tripleBack(frame_snapshots);
+
+    //helicopter WASD to move in helicopter mode
+    if(view==5)
+      heliViewFlag = 1;
+
+    // the game waits while the editor is open
+    double sim_start = glfwGetTime();
+    if (spectate_path != NULL)
+        spectate();
+    else if (!editor_enabled)
+        moveBlock();
+    if (broadcaster != NULL)
+        broadcastTick(broadcaster, currentBroadcastState());
+    // every tick is timed, drawn or not : the renderer catches up from the ring
+    static long ticks = 0;
+    static float tick_ms[SIM_TIMES];
+    ticks++;
+    tick_ms[ticks % SIM_TIMES] = (glfwGetTime() - sim_start) * 1000;
+    frame.tick = ticks;
+    memcpy(frame.sim_ms, tick_ms, sizeof(tick_ms));
+
+    glfwGetFramebufferSize(window, &frame.fbwidth, &frame.fbheight);
+
+    // Everything the frame shows (camera, block, tiles) goes into the scene
+    SceneInput in = {
+        view,
+        {block_pos.x, block_pos.y, block_pos.z},
+        blockRotation,
+        {axis.x, axis.y, axis.z},
+        {camera_pos.x, camera_pos.y, camera_pos.z},
+        {target_pos.x, target_pos.y, target_pos.z},
+        level,
+        bridgeCheck,
+        (float)frame.fbwidth / max(1, frame.fbheight),
+    };
+    buildScene(frame.scene, in);
+    if (editor_enabled)
+        frame.scene.view_projection = editViewProjection(in.aspect);
+    edit_view_projection = frame.scene.view_projection;
+
+    updateHintField();
+    addHint(frame.scene);
+
+    if (hud_enabled)
+        formatHud(frame.hud, sizeof(frame.hud));
+    else
+        frame.hud[0] = 0;
+    frame.overlay = stats_overlay;
+    frame.fxaa = fxaa_preset;
+    frame.screenshot_requests = screenshot_requests;
+    frame.capture_toggles = capture_toggles;
+    frame.key_time = applied_key_time;
+    frame.key_ms = applied_key_ms;
+    frame.roll = block_roll;
+    memcpy(frame.particle_events, particle_events, sizeof(particle_events));
+    frame.particle_event_count = particle_event_count;
+    frame.editing = editor_enabled;
+    frame.edit_cursor_x = editor_enabled ? edit_cursor_x : -1;
+    frame.edit_cursor_z = edit_cursor_z;
+
+    triplePublish(frame_snapshots);
+}
+
+/* Draws one snapshot and swaps, on the thread that owns the context */
+void renderFrame (GLFWwindow* window, const FrameSnapshot& frame)
+{
+    pacingStarted();
+
+    // F12 and F11 pressed since the last frame
+    static int screenshots_seen = 0, capture_toggles_seen = 0;
+    if (frame.screenshot_requests != screenshots_seen) {
+        screenshot_requested = 1;
+        screenshots_seen = frame.screenshot_requests;
+    }
+    for (; capture_toggles_seen != frame.capture_toggles; capture_toggles_seen++)
+        toggleContinuousCapture();
+
+    // the first frame that shows a move measures its latency
+    static double last_key_time = -1;
+    if (frame.key_time > last_key_time) {
+        latencyAdd(LATENCY_APPLY, frame.key_ms);
+        frame_key_time = last_key_time = frame.key_time;
+    }
+
+    // bind the scaled scene buffer and clear it
+    beginScene(frame);
+
+    // OpenGL Draw commands
+    draw(frame, 0, 0, 1, 1);
+
+    // stretch the scene to the window
+    endScene(frame);
+
+    // --soft-check, before the overlay is drawn over the scene
+    checkSoftRenderer(frame);
+
+    // level, moves and time (F1)
+    drawHud(frame);
+
+    // frame time graph (F3)
+    drawStatsOverlay(frame);
+
+    // Read back the frame if a screenshot or a capture is running
+    captureFrame(frame);
+
+    // the stream buffer region of this frame can be reused once this fence passes
+    streamEndFrame();
+    latencySubmitted();
+    pacingSubmitted();
+
+    // Swap Frame Buffer in double buffering
+    glfwSwapBuffers(window);
+
+    // key to GPU done after the swap, read back on a later frame
+    latencySwapped();
+    pacingSwapped();
+    collectLatency();
+
+    static bool first_frame = true;
+    if (first_frame) {
+        printf("TIME TO FIRST FRAME %.1f ms\n", millisecondsSinceStartup());
+        first_frame = false;
+    }
+
+    // the ticks since the last snapshot drawn, once each : a snapshot
+    // drawn again adds none, one never drawn still has its time in the next
+    static long ticks_seen = 0;
+    for (long t=max(ticks_seen + 1, frame.tick - SIM_TIMES + 1); t<=frame.tick; t++)
+        statsSimTick(frame.sim_ms[t % SIM_TIMES]);
+    ticks_seen = max(ticks_seen, frame.tick);
+
+    double now = glfwGetTime();
+    static double last_frame_time = now;
+    statsEndFrame((now - last_frame_time) * 1000, now);
+    last_frame_time = now;
+}
+
+void renderLoop ()
+{
+    glfwMakeContextCurrent(render_window);
+    while (render_running.load(memory_order_acquire)) {
+        // --pacing=late : the snapshot is taken just in time for the vblank
+        pacingWait();
+        // without a new snapshot the last one is drawn again
+        tripleAcquire(frame_snapshots);
+        renderFrame(render_window, tripleFront(frame_snapshots));
+    }
+    glfwMakeContextCurrent(NULL);
+}
+
+/* Hands the GL context over to a new render thread */
+void startRenderThread (GLFWwindow* window)
+{
+    render_window = window;
+    render_running.store(true, memory_order_release);
+    glfwMakeContextCurrent(NULL);
+    render_thread = thread(renderLoop);
+}
+
+/* Joins the render thread and makes the context current here again,
+   does nothing with --single-thread or when already stopped */
+void stopRenderThread ()
+{
+    if (!render_thread.joinable())
+        return;
+    render_running.store(false, memory_order_release);
+    render_thread.join();
+    glfwMakeContextCurrent(render_window);
+}
+
 int main (int argc, char** argv)
 {
+    startup_time = chrono::steady_clock::now();
+    startAssetLoading();
+    atexit(removeDecodedSounds);
+
     int width = 600;
     int height = 600;
 
+    for (int i=1; i<argc; i++) {
+        // --capture[=png|y4m] : capture every frame from the start
+        if (strncmp(argv[i], "--capture", 9) == 0) {
+            if (strcmp(argv[i], "--capture=png") == 0)
+                capture_format = CAPTURE_PNG;
+            toggleContinuousCapture();
+        }
+        // --frame-budget=MS : frame time the dynamic resolution aims for
+        else if (strncmp(argv[i], "--frame-budget=", 15) == 0)
+            frame_budget_ms = atof(argv[i] + 15);
+        // --min-scale=S : lowest render scale, 1 disables the scaling
+        else if (strncmp(argv[i], "--min-scale=", 12) == 0)
+            min_render_scale = min(1.0, max(0.1, atof(argv[i] + 12)));
+        else if (strcmp(argv[i], "--no-dynamic-res") == 0)
+            dynamic_resolution = 0;
+        // --soft-check : compare the frames with the CPU renderer once a second
+        else if (strcmp(argv[i], "--soft-check") == 0)
+            soft_check = 1;
+        // --stats=FILE or --stats=unix:PATH : JSON report once a second
+        else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            if (statsOpenOutput(argv[i] + 8))
+                atexit(statsCloseOutput);
+        }
+        // --single-thread : input, game and GL on the main thread, one tick per frame
+        else if (strcmp(argv[i], "--single-thread") == 0)
+            single_thread = 1;
+        // --pacing=vsync|late|adaptive : when frames start, see Frame pacing
+        else if (strcmp(argv[i], "--pacing=late") == 0)
+            pacing_mode = PACING_LATE;
+        else if (strcmp(argv[i], "--pacing=adaptive") == 0)
+            pacing_mode = PACING_ADAPTIVE;
+        else if (strcmp(argv[i], "--pacing=vsync") == 0)
+            pacing_mode = PACING_VSYNC;
+        // --fxaa=off|low|medium|high : anti-aliasing preset at start, F4 cycles them
+        else if (strncmp(argv[i], "--fxaa=", 7) == 0) {
+            for (int p=0; p<FXAA_PRESETS; p++)
+                if (strcmp(argv[i] + 7, fxaa_presets[p].name) == 0)
+                    fxaa_preset = p;
+        }
+        // --edit=FILE : board the editor (F2) opens and F5 saves
+        else if (strncmp(argv[i], "--edit=", 7) == 0)
+            edit_path = argv[i] + 7;
+        // --edit-size=RxC : the editor starts from a blank board
+        else if (strncmp(argv[i], "--edit-size=", 12) == 0) {
+            if (sscanf(argv[i] + 12, "%dx%d", &edit_new_rows, &edit_new_cols) != 2 || edit_new_rows <= 0 || edit_new_cols <= 0)
+                edit_new_rows = edit_new_cols = 0;
+        }
+        // --latency=FILE : input latency histogram of the session, written on exit
+        else if (strncmp(argv[i], "--latency=", 10) == 0)
+            latency_export_path = argv[i] + 10;
+        // --broadcast[=PATH] : publish the game to spectators
+        else if (strcmp(argv[i], "--broadcast") == 0)
+            broadcast_path = BROADCAST_PATH;
+        else if (strncmp(argv[i], "--broadcast=", 12) == 0)
+            broadcast_path = argv[i] + 12;
+        // --spectate[=PATH] : watch the game a --broadcast window plays
+        else if (strcmp(argv[i], "--spectate") == 0)
+            spectate_path = BROADCAST_PATH;
+        else if (strncmp(argv[i], "--spectate=", 11) == 0)
+            spectate_path = argv[i] + 11;
+    }
+
     GLFWwindow* window = initGLFW(width, height);
     initGLEW();
     initGL (window, width, height);
 
+    level_start_time = glfwGetTime();
+    // also on Escape, which leaves through exit()
+    atexit(finishLatency);
+    atexit(printJobStats);
+    atexit(printPacing);
+
+    // the tiles of this level and the next one go to the GPU in the background
+    startLevelLoader(window);
+    atexit(stopLevelLoader);
+    prefetchLevel(level);
+    prefetchLevel(level + 1);
+
+    if (broadcast_path != NULL && spectate_path == NULL) {
+        broadcaster = broadcastCreate(broadcast_path);
+        atexit(closeBroadcast);
+    }
+
+    // the start of the first level is the oldest undo step
+    historyClear(history);
+    pushHistory(KEY_NONE, BLOCK_STANDING);
+
+    // the renderer starts from a full snapshot
+    simulate(window);
+    double next_tick = glfwGetTime() + 1.0 / SIM_HZ;
+    if (!single_thread) {
+        // runs first at exit, before anything the render thread still uses goes away
+        atexit(stopRenderThread);
+        startRenderThread(window);
+    }
+
     /* Draw in loop */
     while (!glfwWindowShouldClose(window)) {
 
-		// clear the color and depth in the frame buffer
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (single_thread) {
+            tripleAcquire(frame_snapshots);
+            renderFrame(window, tripleFront(frame_snapshots));
 
-	    // OpenGL Draw commands
-		draw(window, 0, 0, 1, 1);
-        // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+            // Poll for Keyboard and mouse events, as late as --pacing allows
+            pacingWait();
+            glfwPollEvents();
+        }
+        else {
+            // background jobs until the tick, then the events as they come;
+            // the game ticks SIM_HZ times a second
+            // a key queued behind a roll is applied as soon as the roll ends
+            if (key_queue_count > 0 && blockRolling())
+                next_tick = min(next_tick, block_roll.start + block_roll.duration);
+            double wait = next_tick - glfwGetTime();
+            if (wait > 0)
+                jobsRunUntil(engine_jobs, chrono::steady_clock::now() +
+                             chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(wait)));
+            glfwWaitEventsTimeout(max(0.0, next_tick - glfwGetTime()));
+        }
 
-        // Poll for Keyboard and mouse events
-        glfwPollEvents();
+        // set by drawStatsOverlay(), only this thread may touch the window
+        if (tripleAcquire(window_titles))
+            glfwSetWindowTitle(window, tripleFront(window_titles).text);
 
         // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
         current_time = glfwGetTime(); // Time in seconds
+        if (single_thread)
+            simulate(window);
+        else {
+            // a pending arrow key does not wait for the tick
+            bool early = current_time < next_tick;
+            if (early && !arrowKeyReady())
+                continue;
+            simulate(window);
+            next_tick = early ? current_time + 1.0 / SIM_HZ : max(next_tick + 1.0 / SIM_HZ, current_time);
+        }
         last_update_time = current_time;
 
         if(current_time - last_update_time > 1)
@@ -1466,6 +3397,9 @@ int main (int argc, char** argv)
         }
     }
 
+    stopRenderThread();
+    stopLevelLoader();
+    finishCapture();
     glfwTerminate();
     //    exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "scene.h"
+
+using namespace std;
+
+// Builds the cube object used in this sample code
+Mesh bakeBlockMesh ()
+{
+  float vertex_buffer_data [] = {
+    -0.5, 1, 0.5,
+    -0.5, -1, 0.5,
+    0.5, -1, 0.5,
+    -0.5, 1, 0.5,
+    0.5, -1, 0.5,
+    0.5, 1, 0.5,
+    0.5, 1, 0.5,
+    0.5, -1, 0.5,
+    0.5, -1, -0.5,
+    0.5, 1, 0.5,
+    0.5, -1, -0.5,
+    0.5, 1, -0.5,
+    0.5, 1, -0.5,
+    0.5, -1, -0.5,
+    -0.5, -1, -0.5,
+    0.5, 1, -0.5,
+    -0.5, -1, -0.5,
+    -0.5, 1, -0.5,
+    -0.5, 1, -0.5,
+    -0.5, -1, -0.5,
+    -0.5, -1, 0.5,
+    -0.5, 1, -0.5,
+    -0.5, -1, 0.5,
+    -0.5, 1, 0.5,
+    -0.5, 1, -0.5,
+    -0.5, 1, 0.5,
+    0.5, 1, 0.5,
+    -0.5, 1, -0.5,
+    0.5, 1, 0.5,
+    0.5, 1, -0.5,
+    -0.5, -1, 0.5,
+    -0.5, -1, -0.5,
+    0.5, -1, -0.5,
+    -0.5, -1, 0.5,
+    0.5, -1, -0.5,
+    0.5, -1, 0.5,
+  };
+
+  float color_buffer_data [] = {
+    1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+            1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 0.0f,
+
+  };
+    Mesh mesh;
+    mesh.vertices.assign(vertex_buffer_data, vertex_buffer_data + 36*3);
+    mesh.colors.assign(color_buffer_data, color_buffer_data + 36*3);
+    return mesh;
+}
+
+Mesh bakeTileMesh ()
+{
+    // GL3 accepts only Triangles. Quads are not supported
+    // Every floor tile shares this slab, the fragment shader colors it by tile type
+    static const float vertex_buffer_data [] = {
+        -0.5, 0.1, 0.5,
+        -0.5, -0.1, 0.5,
+        0.5, -0.1, 0.5,
+        -0.5, 0.1, 0.5,
+        0.5, -0.1, 0.5,
+        0.5, 0.1, 0.5,
+        0.5, 0.1, 0.5,
+        0.5, -0.1, 0.5,
+        0.5, -0.1, -0.5,
+        0.5, 0.1, 0.5,
+        0.5, -0.1, -0.5,
+        0.5, 0.1, -0.5,
+        0.5, 0.1, -0.5,
+        0.5, -0.1, -0.5,
+        -0.5, -0.1, -0.5,
+        0.5, 0.1, -0.5,
+        -0.5, -0.1, -0.5,
+        -0.5, 0.1, -0.5,
+        -0.5, 0.1, -0.5,
+        -0.5, -0.1, -0.5,
+        -0.5, -0.1, 0.5,
+        -0.5, 0.1, -0.5,
+        -0.5, -0.1, 0.5,
+        -0.5, 0.1, 0.5,
+        -0.5, 0.1, -0.5,
+        -0.5, 0.1, 0.5,
+        0.5, 0.1, 0.5,
+        -0.5, 0.1, -0.5,
+        0.5, 0.1, 0.5,
+        0.5, 0.1, -0.5,
+        -0.5, -0.1, 0.5,
+        -0.5, -0.1, -0.5,
+        0.5, -0.1, -0.5,
+        -0.5, -0.1, 0.5,
+        0.5, -0.1, -0.5,
+        0.5, -0.1, 0.5,
+        -0.5, 0.1, 0.5,
+        0.5, 0.1, -0.5,
+        0.5, 0.25, -0.5,
+    };
+
+    Mesh mesh;
+    mesh.vertices.assign(vertex_buffer_data, vertex_buffer_data + 13*3*3);
+    return mesh;
+}
+
+void solidColors (std::vector<float>& colors, int count, float red, float green, float blue)
+{
+    colors.resize(3*count);
+    for (int i=0; i<count; i++) {
+        colors[3*i] = red;
+        colors[3*i + 1] = green;
+        colors[3*i + 2] = blue;
+    }
+}
+
+/******************
+ * Matrix helpers *
+ ******************/
+
+Mat4 matIdentity ()
+{
+    Mat4 r;
+    memset(r.m, 0, sizeof(r.m));
+    r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1;
+    return r;
+}
+
+Mat4 matMultiply (const Mat4& a, const Mat4& b)
+{
+    Mat4 r;
+    for (int col=0; col<4; col++)
+        for (int row=0; row<4; row++) {
+            float sum = 0;
+            for (int k=0; k<4; k++)
+                sum += a.m[k*4 + row] * b.m[col*4 + k];
+            r.m[col*4 + row] = sum;
+        }
+    return r;
+}
+
+Mat4 matTranslate (float x, float y, float z)
+{
+    Mat4 r = matIdentity();
+    r.m[12] = x;
+    r.m[13] = y;
+    r.m[14] = z;
+    return r;
+}
+
+Mat4 matRotate (float angle, float x, float y, float z)
+{
+    float c = cos(angle), s = sin(angle);
+    float length = sqrt(x*x + y*y + z*z);
+    float a[3] = { x/length, y/length, z/length };
+    float t[3] = { (1-c)*a[0], (1-c)*a[1], (1-c)*a[2] };
+
+    Mat4 r = matIdentity();
+    r.m[0] = c + t[0]*a[0];
+    r.m[1] = t[0]*a[1] + s*a[2];
+    r.m[2] = t[0]*a[2] - s*a[1];
+    r.m[4] = t[1]*a[0] - s*a[2];
+    r.m[5] = c + t[1]*a[1];
+    r.m[6] = t[1]*a[2] + s*a[0];
+    r.m[8] = t[2]*a[0] + s*a[1];
+    r.m[9] = t[2]*a[1] - s*a[0];
+    r.m[10] = c + t[2]*a[2];
+    return r;
+}
+
+Mat4 matPerspective (float fovy, float aspect, float near, float far)
+{
+    float f = 1 / tan(fovy / 2);
+    Mat4 r;
+    memset(r.m, 0, sizeof(r.m));
+    r.m[0] = f / aspect;
+    r.m[5] = f;
+    r.m[10] = -(far + near) / (far - near);
+    r.m[11] = -1;
+    r.m[14] = -(2 * far * near) / (far - near);
+    return r;
+}
+
+static void normalize (float v[3])
+{
+    float length = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+}
+
+static void cross (const float a[3], const float b[3], float r[3])
+{
+    r[0] = a[1]*b[2] - a[2]*b[1];
+    r[1] = a[2]*b[0] - a[0]*b[2];
+    r[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+Mat4 matLookAt (const float eye[3], const float target[3], const float up[3])
+{
+    float f[3] = { target[0]-eye[0], target[1]-eye[1], target[2]-eye[2] };
+    normalize(f);
+    float s[3], u[3];
+    cross(f, up, s);
+    normalize(s);
+    cross(s, f, u);
+
+    Mat4 r = matIdentity();
+    r.m[0] = s[0]; r.m[4] = s[1]; r.m[8] = s[2];
+    r.m[1] = u[0]; r.m[5] = u[1]; r.m[9] = u[2];
+    r.m[2] = -f[0]; r.m[6] = -f[1]; r.m[10] = -f[2];
+    r.m[12] = -(s[0]*eye[0] + s[1]*eye[1] + s[2]*eye[2]);
+    r.m[13] = -(u[0]*eye[0] + u[1]*eye[1] + u[2]*eye[2]);
+    r.m[14] = f[0]*eye[0] + f[1]*eye[1] + f[2]*eye[2];
+    return r;
+}
+
+bool matInverse (const Mat4& a, Mat4& inverse)
+{
+    // Gauss-Jordan on [a | I] with partial pivoting, rows of the math matrix
+    double m[4][8];
+    for (int r=0; r<4; r++)
+        for (int c=0; c<4; c++) {
+            m[r][c] = a.m[c*4 + r];
+            m[r][c+4] = r == c;
+        }
+    for (int c=0; c<4; c++) {
+        int pivot = c;
+        for (int r=c+1; r<4; r++)
+            if (fabs(m[r][c]) > fabs(m[pivot][c]))
+                pivot = r;
+        if (fabs(m[pivot][c]) < 1e-12)
+            return false;
+        for (int k=0; k<8; k++)
+            swap(m[c][k], m[pivot][k]);
+        double scale = 1 / m[c][c];
+        for (int k=0; k<8; k++)
+            m[c][k] *= scale;
+        for (int r=0; r<4; r++) {
+            if (r == c || m[r][c] == 0)
+                continue;
+            double f = m[r][c];
+            for (int k=0; k<8; k++)
+                m[r][k] -= f * m[c][k];
+        }
+    }
+    for (int r=0; r<4; r++)
+        for (int c=0; c<4; c++)
+            inverse.m[c*4 + r] = m[r][c+4];
+    return true;
+}
+
+/*********
+ * Scene *
+ *********/
+
+/* Eye and target of each view. They were always kept in ints, the follow
+   cameras snap to whole tiles because of it. */
+static void cameraForView (const SceneInput& in, int eye[3], int target[3])
+{
+    const float* b = in.block_pos;
+    switch (in.view) {
+    default:    // normal
+        eye[0] = 8; eye[1] = 10; eye[2] = 10;
+        target[0] = 0; target[1] = 0; target[2] = 0;
+        break;
+    case 1:     // block
+        eye[0] = b[0]-1; eye[1] = 3; eye[2] = b[2];
+        target[0] = b[0]+5; target[1] = 0; target[2] = b[2]+5;
+        break;
+    case 2:     // top
+        eye[0] = 0; eye[1] = 12; eye[2] = 0;
+        target[0] = 1; target[1] = 1; target[2] = 1;
+        break;
+    case 3:     // tower
+        eye[0] = 7; eye[1] = 15; eye[2] = 7;
+        target[0] = 1; target[1] = 1; target[2] = 1;
+        break;
+    case 4:     // follow camera actor mode
+        eye[0] = b[0]-5; eye[1] = 5; eye[2] = b[2];
+        target[0] = b[0]+5; target[1] = 0; target[2] = b[2]+5;
+        break;
+    case 5:     // helicopter, WASD to move
+        for (int i=0; i<3; i++) {
+            eye[i] = in.camera_pos[i];
+            target[i] = in.target_pos[i];
+        }
+        break;
+    case 6:     // followcam bird mode
+        eye[0] = b[0]-10; eye[1] = 10; eye[2] = b[2];
+        target[0] = b[0]+10; target[1] = 10; target[2] = b[2]+10;
+        break;
+    }
+}
+
+void blockModel (float model[16], const float pos[3], float rotation, const float axis[3])
+{
+    // translate back * rotate * translate to origin * translate, which
+    // comes down to translate * rotate
+    Mat4 m = matMultiply(matTranslate(pos[0], pos[1], pos[2]),
+                         matRotate(rotation, axis[0], axis[1], axis[2]));
+    memcpy(model, m.m, sizeof(m.m));
+}
+
+void buildScene (Scene& scene, const SceneInput& in)
+{
+    int eye_i[3], target_i[3];
+    cameraForView(in, eye_i, target_i);
+    float eye[3] = { (float)eye_i[0], (float)eye_i[1], (float)eye_i[2] };
+    float target[3] = { (float)target_i[0], (float)target_i[1], (float)target_i[2] };
+    float up[3] = { 0, 1, 0 };
+
+    Mat4 projection = matPerspective(M_PI/2, in.aspect, 0.05f, 25.05f);
+    scene.view_projection = matMultiply(projection, matLookAt(eye, target, up));
+
+    scene.clear_color[0] = scene.clear_color[1] = scene.clear_color[2] = 0.3f;
+
+    // the three axes
+    static const SceneLine axes[3] = {
+        { {10, 0, 0}, {-10, 0, 0}, {1, 1, 1} },
+        { {0, 10, 0}, {0, -10, 0}, {0, 1, 0} },
+        { {0, 0, 10}, {0, 0, -10}, {1, 0, 0} },
+    };
+    scene.lines.assign(axes, axes + 3);
+
+    blockModel(scene.block.model, in.block_pos, in.block_rotation, in.axis);
+    scene.block.type = 0;
+    scene.show_hint = false;
+
+    // the tile list is baked at compile time (levels.h), bridges come last
+    // and only show up once switched on
+    const LevelTiles& tiles = level_tiles[in.level];
+    scene.level = in.level;
+    levelInstances(scene.tiles, in.level, in.bridge == 1 ? tiles.count : tiles.solid);
+}
+
+/* inverse * (x, y, z, 1), divided by w */
+static void unproject (const Mat4& inverse, float x, float y, float z, double out[3])
+{
+    double v[4];
+    for (int r=0; r<4; r++)
+        v[r] = inverse.m[r] * x + inverse.m[4+r] * y + inverse.m[8+r] * z + inverse.m[12+r];
+    for (int i=0; i<3; i++)
+        out[i] = v[i] / v[3];
+}
+
+bool pickTile (const int* tiles, int rows, int cols, const Mat4& view_projection,
+               float ndc_x, float ndc_y, int* x, int* z)
+{
+    Mat4 inverse;
+    if (!matInverse(view_projection, inverse))
+        return false;
+    double o[3], far[3], d[3];
+    unproject(inverse, ndc_x, ndc_y, -1, o);
+    unproject(inverse, ndc_x, ndc_y, 1, far);
+    for (int i=0; i<3; i++)
+        d[i] = far[i] - o[i];
+
+    // clip t in [0, 1] to the board, cell i spans [i - 0.5, i + 0.5]
+    double t0 = 0, t1 = 1;
+    double lo[2] = { -0.5, -0.5 }, hi[2] = { rows - 0.5, cols - 0.5 };
+    int axes[2] = { 0, 2 };
+    for (int a=0; a<2; a++) {
+        double p = o[axes[a]], v = d[axes[a]];
+        if (fabs(v) < 1e-12) {
+            if (p < lo[a] || p > hi[a])
+                return false;
+            continue;
+        }
+        double ta = (lo[a] - p) / v, tb = (hi[a] - p) / v;
+        t0 = max(t0, min(ta, tb));
+        t1 = min(t1, max(ta, tb));
+    }
+    if (t0 > t1)
+        return false;
+
+    // Amanatides & Woo over the xz grid from the entry point
+    int cell[2], step[2];
+    double next[2], delta[2];
+    for (int a=0; a<2; a++) {
+        double p = o[axes[a]] + t0 * d[axes[a]], v = d[axes[a]];
+        int limit = a == 0 ? rows : cols;
+        cell[a] = min(limit - 1, max(0, (int)floor(p + 0.5)));
+        step[a] = v > 0 ? 1 : -1;
+        if (fabs(v) < 1e-12) {
+            next[a] = delta[a] = 1e30;
+            continue;
+        }
+        double edge = cell[a] + (v > 0 ? 0.5 : -0.5);
+        next[a] = (edge - o[axes[a]]) / v;
+        delta[a] = fabs(1 / v);
+    }
+
+    double t_in = t0;
+    bool plane_hit = false;
+    int plane_cell[2] = { 0, 0 };
+    for (;;) {
+        double t_out = min(t1, min(next[0], next[1]));
+        double y_in = o[1] + t_in * d[1], y_out = o[1] + t_out * d[1];
+        double y_low = min(y_in, y_out), y_high = max(y_in, y_out);
+        int tile = tiles[cell[0]*cols + cell[1]];
+
+        // goal cells are holes, like empty ones
+        if (tile != TILE_EMPTY && tile != TILE_GOAL && y_low <= TILE_TOP && y_high >= TILE_BOTTOM) {
+            *x = cell[0];
+            *z = cell[1];
+            return true;
+        }
+        if (!plane_hit && y_low <= TILE_TOP && y_high >= TILE_TOP) {
+            plane_hit = true;
+            plane_cell[0] = cell[0];
+            plane_cell[1] = cell[1];
+        }
+        // under the slabs, no tile side can show up any more
+        if (y_high < TILE_BOTTOM || t_out >= t1)
+            break;
+
+        int a = next[0] < next[1] ? 0 : 1;
+        cell[a] += step[a];
+        if (cell[a] < 0 || cell[a] >= (a == 0 ? rows : cols))
+            break;
+        t_in = next[a];
+        next[a] += delta[a];
+    }
+    if (!plane_hit)
+        return false;
+    *x = plane_cell[0];
+    *z = plane_cell[1];
+    return true;
+}
+
+void levelInstances (vector<SceneInstance>& out, int level, int count)
+{
+    const LevelTiles& tiles = level_tiles[level];
+    out.resize(count);
+    for (int i=0; i<count; i++) {
+        Mat4 m = matTranslate(tiles.tiles[i].x, 0, tiles.tiles[i].z);
+        memcpy(out[i].model, m.m, sizeof(m.m));
+        out[i].type = tiles.tiles[i].type;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+
+#include "levels.h"
+
+/* What a frame shows, without any GL : draw() fills a Scene from the game
+   state and hands it to a renderer, the OpenGL one in main.cpp or the CPU
+   one in softrast.cpp. Matrices are column major like glm::mat4. */
+
+/* Vertex data of a model, built on a worker and uploaded by uploadMesh */
+struct Mesh {
+    std::vector<float> vertices;
+    std::vector<float> colors;   // empty when the shader colors the model
+};
+
+Mesh bakeBlockMesh ();
+Mesh bakeTileMesh ();
+/* The color buffer of a model drawn in one color, as create3DObject()
+   uploads it : red, green, blue for each of count vertices */
+void solidColors (std::vector<float>& colors, int count, float red, float green, float blue);
+
+struct Mat4 {
+    float m[16];
+};
+
+Mat4 matIdentity ();
+Mat4 matMultiply (const Mat4& a, const Mat4& b);
+Mat4 matTranslate (float x, float y, float z);
+/* Same as glm::rotate, the axis does not need to be normalized */
+Mat4 matRotate (float angle, float x, float y, float z);
+Mat4 matPerspective (float fovy, float aspect, float near, float far);
+Mat4 matLookAt (const float eye[3], const float target[3], const float up[3]);
+/* false when a is singular */
+bool matInverse (const Mat4& a, Mat4& inverse);
+
+/* One instance of the Sample_GL program : model matrix and tile type
+   (0 for the vertex colored block) */
+struct SceneInstance {
+    float model[16];
+    float type;
+};
+
+/* Unlit line, drawn with the view projection only */
+struct SceneLine {
+    float from[3], to[3];
+    float color[3];
+};
+
+struct Scene {
+    int level;                  // for renderers that keep the tiles of a level resident
+    Mat4 view_projection;
+    float clear_color[3];
+    std::vector<SceneLine> lines;
+    SceneInstance block;
+    std::vector<SceneInstance> tiles;
+    // where the hinted move puts the block, drawn as a wireframe (GL only)
+    bool show_hint;
+    SceneInstance hint;
+};
+
+/* The part of the game state a frame depends on */
+struct SceneInput {
+    int view;                   // camera, as cycled by the V key
+    float block_pos[3];
+    float block_rotation;
+    float axis[3];
+    float camera_pos[3];        // helicopter camera (view 5)
+    float target_pos[3];
+    int level;
+    int bridge;                 // bridge tiles are drawn once switched on
+    float aspect;
+};
+
+void buildScene (Scene& scene, const SceneInput& in);
+
+/* The first count tiles of a level (levels.h order, bridges last) as instances */
+void levelInstances (std::vector<SceneInstance>& out, int level, int count);
+
+/* Model matrix of the block at pos, turned by rotation around axis */
+void blockModel (float model[16], const float pos[3], float rotation, const float axis[3]);
+
+/* Top and bottom of the tile slab (bakeTileMesh), tile x, z is centered on (x, 0, z) */
+#define TILE_TOP 0.1f
+#define TILE_BOTTOM -0.1f
+
+/* The cell of a rows x cols board under the point ndc_x, ndc_y of the
+   screen : the ray through it (unprojected with the inverse view
+   projection) is walked cell by cell over the grid (DDA) until it meets a
+   tile, or crosses the top of the slab above an empty cell with no tile
+   side behind it. False when the ray misses the board. */
+bool pickTile (const int* tiles, int rows, int cols, const Mat4& view_projection,
+               float ndc_x, float ndc_y, int* x, int* z);
+
+#endif
@@ -0,0 +1,557 @@
+#include <bits/stdc++.h>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logic.h"
+#include "server.h"
+
+using namespace std;
+
+/* Headless puzzle server : the rules of logic.cpp without GLFW, for many
+   sessions at once. Connections are spread over worker threads (shards),
+   each with its own epoll loop and its own session table. A worker reads
+   everything its ready connections sent, runs the whole batch of requests
+   against the table, then writes one reply buffer per connection. */
+
+#define SESSION_BITS 24
+#define READ_CHUNK 65536
+#define MAX_PENDING_OUT (4 << 20)   // unread reply bytes before a client is dropped
+
+struct Connection;
+
+/* Sessions of one shard, struct of arrays */
+struct SessionTable {
+    vector<int16_t> x2, z2;
+    vector<uint32_t> moves;
+    vector<uint8_t> state, level, bridge, used;
+    vector<Connection*> owner;      // connection that created the session
+    vector<uint32_t> free_slots;
+
+    void init (int capacity)
+    {
+        x2.assign(capacity, 0);
+        z2.assign(capacity, 0);
+        moves.assign(capacity, 0);
+        state.assign(capacity, 0);
+        level.assign(capacity, 0);
+        bridge.assign(capacity, 0);
+        used.assign(capacity, 0);
+        owner.assign(capacity, NULL);
+        free_slots.clear();
+        for (int i=capacity-1; i>=0; i--)
+            free_slots.push_back(i);
+    }
+
+    GameState load (int i) const
+    {
+        GameState g = { x2[i], z2[i], state[i], level[i], bridge[i], (int)moves[i] };
+        return g;
+    }
+
+    void store (int i, const GameState& g)
+    {
+        x2[i] = g.x2;
+        z2[i] = g.z2;
+        state[i] = g.state;
+        level[i] = g.level;
+        bridge[i] = g.bridge;
+        moves[i] = g.moves;
+    }
+};
+
+struct Connection {
+    int fd;
+    vector<char> in;        // bytes of an incomplete request
+    string out;             // replies not written yet
+    size_t out_sent;
+    bool closing;
+    bool failed;            // send error or too far behind : nothing more goes out
+    bool touched;           // has replies queued in this batch
+    bool want_write;        // EPOLLOUT is armed
+    vector<uint32_t> sessions;  // slots it created, freed when it closes
+};
+
+struct PendingRequest {
+    Connection* conn;
+    ServerRequest request;
+};
+
+struct Shard {
+    int index;
+    int epfd;
+    thread worker;
+    SessionTable sessions;
+    atomic<unsigned long long> requests;
+    atomic<int> live_sessions;
+};
+
+static atomic<bool> running(true);
+static vector<Shard*> shards;
+
+static void onSignal (int)
+{
+    running = false;
+}
+
+static void fillReply (ServerReply& reply, const SessionTable& t, uint32_t id, int slot, int status, uint16_t tag)
+{
+    memset(&reply, 0, sizeof(reply));
+    reply.session = id;
+    reply.tag = tag;
+    reply.status = status;
+    if (slot >= 0) {
+        reply.moves = t.moves[slot];
+        reply.x2 = t.x2[slot];
+        reply.z2 = t.z2[slot];
+        reply.state = t.state[slot];
+        reply.level = t.level[slot];
+        reply.bridge = t.bridge[slot];
+    }
+}
+
+/* Frees a session slot and drops it from its owner's list */
+static void freeSession (SessionTable& t, int slot)
+{
+    Connection* owner = t.owner[slot];
+    if (owner != NULL) {
+        vector<uint32_t>& owned = owner->sessions;
+        for (size_t i=0; i<owned.size(); i++)
+            if ((int)owned[i] == slot) {
+                owned[i] = owned.back();
+                owned.pop_back();
+                break;
+            }
+    }
+    t.used[slot] = 0;
+    t.owner[slot] = NULL;
+    t.free_slots.push_back(slot);
+}
+
+/* Runs one request of connection c against the shard's sessions */
+static void handleRequest (Shard& shard, Connection* c, const ServerRequest& req, ServerReply& reply)
+{
+    SessionTable& t = shard.sessions;
+
+    if (req.op == OP_CREATE) {
+        if (req.arg >= LEVELS) {
+            fillReply(reply, t, 0, -1, STATUS_BAD_REQUEST, req.tag);
+            return;
+        }
+        if (t.free_slots.empty()) {
+            fillReply(reply, t, 0, -1, STATUS_FULL, req.tag);
+            return;
+        }
+        int slot = t.free_slots.back();
+        t.free_slots.pop_back();
+        GameState g;
+        g.moves = 0;
+        resetGame(g, req.arg);
+        t.store(slot, g);
+        t.used[slot] = 1;
+        t.owner[slot] = c;
+        c->sessions.push_back(slot);
+        shard.live_sessions++;
+        fillReply(reply, t, (shard.index << SESSION_BITS) | slot, slot, STATUS_OK, req.tag);
+        return;
+    }
+
+    int slot = req.session & ((1 << SESSION_BITS) - 1);
+    if ((int)(req.session >> SESSION_BITS) != shard.index || slot >= (int)t.used.size() || !t.used[slot]) {
+        fillReply(reply, t, req.session, -1, STATUS_BAD_SESSION, req.tag);
+        return;
+    }
+
+    int status = STATUS_OK;
+    switch (req.op) {
+    case OP_MOVE: {
+        if (req.arg < KEY_LEFT || req.arg > KEY_DOWN) {
+            status = STATUS_BAD_REQUEST;
+            break;
+        }
+        GameState g = t.load(slot);
+        int support = stepGame(g, req.arg);
+        if (support == SUPPORT_GOAL) {
+            // same as moveBlock : on to the next level, or done
+            status = g.level < LEVELS-1 ? STATUS_WIN : STATUS_DONE;
+            resetGame(g, g.level < LEVELS-1 ? g.level+1 : 0);
+        }
+        else if (support != SUPPORT_OK) {
+            status = STATUS_FALL;
+            resetGame(g, g.level);
+        }
+        t.store(slot, g);
+        break;
+    }
+    case OP_RESET: {
+        if (req.arg >= LEVELS) {
+            status = STATUS_BAD_REQUEST;
+            break;
+        }
+        GameState g = t.load(slot);
+        resetGame(g, req.arg);
+        t.store(slot, g);
+        break;
+    }
+    case OP_GET:
+        break;
+    case OP_CLOSE:
+        freeSession(t, slot);
+        shard.live_sessions--;
+        fillReply(reply, t, req.session, -1, STATUS_OK, req.tag);
+        return;
+    default:
+        status = STATUS_BAD_REQUEST;
+    }
+    fillReply(reply, t, req.session, slot, status, req.tag);
+}
+
+static void armWrite (Shard& shard, Connection* c, bool on)
+{
+    if (c->want_write == on)
+        return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (on ? (uint32_t)EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(shard.epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_write = on;
+}
+
+/* Closes c at the end of the batch without sending it anything more */
+static void dropConnection (Connection* c)
+{
+    c->closing = c->failed = true;
+    c->out.clear();
+    c->out_sent = 0;
+}
+
+/* Writes what the socket takes, EPOLLOUT brings the worker back for the rest */
+static void flushConnection (Shard& shard, Connection* c)
+{
+    while (c->out_sent < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + c->out_sent, c->out.size() - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            dropConnection(c);
+            return;
+        }
+        c->out_sent += n;
+    }
+    if (c->out_sent == c->out.size()) {
+        c->out.clear();
+        c->out_sent = 0;
+    }
+    armWrite(shard, c, !c->out.empty());
+}
+
+/* The sessions the connection created go with it */
+static void closeConnection (Shard& shard, Connection* c)
+{
+    while (!c->sessions.empty()) {
+        freeSession(shard.sessions, c->sessions.back());
+        shard.live_sessions--;
+    }
+    epoll_ctl(shard.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    delete c;
+}
+
+static void shardLoop (Shard* s)
+{
+    Shard& shard = *s;
+    struct epoll_event events[256];
+    vector<PendingRequest> batch;
+    vector<Connection*> touched;
+    char buffer[READ_CHUNK];
+
+    while (running) {
+        int n = epoll_wait(shard.epfd, events, 256, 100);
+        batch.clear();
+        touched.clear();
+
+        // gather every complete request the ready connections sent
+        for (int e=0; e<n; e++) {
+            Connection* c = (Connection*) events[e].data.ptr;
+            if (events[e].events & EPOLLOUT) {
+                flushConnection(shard, c);
+                // a failed send closes it below, with the others
+                if (c->closing && !c->touched) {
+                    c->touched = true;
+                    touched.push_back(c);
+                }
+            }
+            if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                continue;
+
+            ssize_t got = recv(c->fd, buffer, sizeof(buffer), 0);
+            if (got <= 0) {
+                if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    c->closing = true;
+            }
+            else
+                c->in.insert(c->in.end(), buffer, buffer + got);
+
+            size_t count = c->in.size() / sizeof(ServerRequest);
+            for (size_t i=0; i<count; i++) {
+                PendingRequest p;
+                p.conn = c;
+                memcpy(&p.request, &c->in[i*sizeof(ServerRequest)], sizeof(ServerRequest));
+                batch.push_back(p);
+            }
+            c->in.erase(c->in.begin(), c->in.begin() + count*sizeof(ServerRequest));
+            if (!c->touched) {
+                c->touched = true;
+                touched.push_back(c);
+            }
+        }
+
+        // run the batch, in arrival order so requests of a session stay ordered
+        for (size_t i=0; i<batch.size(); i++) {
+            Connection* c = batch[i].conn;
+            if (c->failed)
+                continue;
+            ServerReply reply;
+            handleRequest(shard, c, batch[i].request, reply);
+            c->out.append((const char*)&reply, sizeof(reply));
+            // a client that sends but does not read is dropped
+            if (c->out.size() - c->out_sent > MAX_PENDING_OUT)
+                dropConnection(c);
+        }
+        shard.requests += batch.size();
+
+        // one write per connection
+        for (size_t i=0; i<touched.size(); i++) {
+            Connection* c = touched[i];
+            c->touched = false;
+            if (!c->out.empty())
+                flushConnection(shard, c);
+            if (c->closing)
+                closeConnection(shard, c);
+        }
+    }
+}
+
+static int listenOn (const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        fprintf(stderr, "cannot listen on %s : %s\n", path, strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+static int connectTo (const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "cannot connect to %s : %s\n", path, strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll (int fd, const void* data, size_t size)
+{
+    const char* p = (const char*) data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool recvAll (int fd, void* data, size_t size)
+{
+    char* p = (char*) data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* --load-test : one client per thread, each pipelining batches of random moves */
+static int loadTest (const char* path, int clients, int sessions, double seconds)
+{
+    atomic<unsigned long long> total(0);
+    vector<thread> threads;
+    for (int c=0; c<clients; c++) {
+        threads.push_back(thread([&, c] {
+            int fd = connectTo(path);
+            if (fd < 0)
+                return;
+            vector<ServerRequest> requests(sessions);
+            vector<ServerReply> replies(sessions);
+            for (int i=0; i<sessions; i++) {
+                requests[i].session = 0;
+                requests[i].op = OP_CREATE;
+                requests[i].arg = i % LEVELS;
+                requests[i].tag = i;
+            }
+            if (!sendAll(fd, &requests[0], sessions*sizeof(ServerRequest)) || !recvAll(fd, &replies[0], sessions*sizeof(ServerReply))) {
+                close(fd);
+                return;
+            }
+            // a full server creates fewer, the rest are left out
+            vector<uint32_t> ids;
+            for (int i=0; i<sessions; i++)
+                if (replies[i].status == STATUS_OK)
+                    ids.push_back(replies[i].session);
+            int live = ids.size();
+            if (live == 0) {
+                close(fd);
+                return;
+            }
+
+            unsigned int seed = 12345 + c;
+            chrono::steady_clock::time_point end = chrono::steady_clock::now() + chrono::microseconds((long long)(seconds * 1e6));
+            while (chrono::steady_clock::now() < end) {
+                for (int i=0; i<live; i++) {
+                    requests[i].session = ids[i];
+                    requests[i].op = OP_MOVE;
+                    requests[i].arg = 1 + rand_r(&seed) % 4;
+                }
+                if (!sendAll(fd, &requests[0], live*sizeof(ServerRequest)) || !recvAll(fd, &replies[0], live*sizeof(ServerReply)))
+                    break;
+                // errors (a session the server dropped) are not moves
+                int moved = 0;
+                for (int i=0; i<live; i++)
+                    moved += replies[i].status <= STATUS_FALL;
+                total += moved;
+            }
+            close(fd);
+        }));
+    }
+    for (size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+    printf("%llu moves in %.1f s : %.0f moves/s\n", (unsigned long long)total, seconds, total / seconds);
+    return 0;
+}
+
+int main (int argc, char** argv)
+{
+    const char* path = "/tmp/bloxie.sock";
+    int workers = max(1u, thread::hardware_concurrency());
+    int capacity = 65536;
+    int clients = 0, client_sessions = 256;
+    double seconds = 5;
+
+    for (int i=1; i<argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0)
+            path = argv[i] + 9;
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            workers = max(1, atoi(argv[i] + 10));
+        else if (strncmp(argv[i], "--sessions=", 11) == 0)
+            capacity = max(1, min(1 << SESSION_BITS, atoi(argv[i] + 11)));
+        else if (strncmp(argv[i], "--load-test=", 12) == 0)
+            clients = max(1, atoi(argv[i] + 12));
+        else if (strncmp(argv[i], "--load-sessions=", 16) == 0)
+            client_sessions = max(1, atoi(argv[i] + 16));
+        else if (strncmp(argv[i], "--seconds=", 10) == 0)
+            seconds = atof(argv[i] + 10);
+        else {
+            fprintf(stderr, "usage : %s [--socket=PATH] [--threads=N] [--sessions=PER_WORKER]\n"
+                            "       %s --load-test=CLIENTS [--load-sessions=N] [--seconds=S] [--socket=PATH]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    if (clients > 0)
+        return loadTest(path, clients, client_sessions, seconds);
+
+    int listener = listenOn(path);
+    if (listener < 0)
+        return 1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i=0; i<workers; i++) {
+        Shard* s = new Shard;
+        s->index = i;
+        s->epfd = epoll_create1(EPOLL_CLOEXEC);
+        s->sessions.init(capacity);
+        s->requests = 0;
+        s->live_sessions = 0;
+        shards.push_back(s);
+    }
+    for (int i=0; i<workers; i++)
+        shards[i]->worker = thread(shardLoop, shards[i]);
+    printf("bloxie-server on %s, %d workers, %d sessions each\n", path, workers, capacity);
+
+    // accept connections and deal them out to the workers
+    int acceptor = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    epoll_ctl(acceptor, EPOLL_CTL_ADD, listener, &ev);
+
+    int next = 0;
+    unsigned long long last_requests = 0;
+    double last_report = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (running) {
+        if (epoll_wait(acceptor, &ev, 1, 200) == 1) {
+            int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd >= 0) {
+                Shard& shard = *shards[next];
+                next = (next + 1) % workers;
+                Connection* c = new Connection;
+                c->fd = fd;
+                c->out_sent = 0;
+                c->closing = c->failed = c->touched = c->want_write = false;
+                struct epoll_event cev;
+                cev.events = EPOLLIN;
+                cev.data.ptr = c;
+                epoll_ctl(shard.epfd, EPOLL_CTL_ADD, fd, &cev);
+            }
+        }
+
+        double now = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (now - last_report >= 5) {
+            unsigned long long requests = 0;
+            int live = 0;
+            for (int i=0; i<workers; i++) {
+                requests += shards[i]->requests;
+                live += shards[i]->live_sessions;
+            }
+            if (requests != last_requests)
+                printf("%d sessions, %.0f requests/s\n", live, (requests - last_requests) / (now - last_report));
+            last_requests = requests;
+            last_report = now;
+        }
+    }
+
+    for (int i=0; i<workers; i++)
+        shards[i]->worker.join();
+    close(listener);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+/* Wire protocol of bloxie-server : fixed size little endian records over a
+   Unix stream socket. A client may pipeline any number of requests, each
+   one gets exactly one reply, in order. Sessions live on the worker that
+   owns the connection which created them, so a client keeps using that
+   connection for them. */
+
+enum {
+    OP_CREATE,   // arg = level, replies with the new session id
+    OP_MOVE,     // arg = arrow key (KEY_LEFT .. KEY_DOWN)
+    OP_RESET,    // arg = level
+    OP_GET,
+    OP_CLOSE,
+};
+
+enum {
+    STATUS_OK,
+    STATUS_WIN,          // level done, the session moved to the next one
+    STATUS_DONE,         // last level done, the session is back on level 0
+    STATUS_FALL,         // fell or stood on a fragile tile, level restarted
+    STATUS_BAD_SESSION,  // unknown session, or owned by another connection's worker
+    STATUS_BAD_REQUEST,
+    STATUS_FULL,         // no free session slot
+};
+
+struct ServerRequest {
+    uint32_t session;
+    uint8_t op;
+    uint8_t arg;
+    uint16_t tag;        // echoed back
+};
+
+struct ServerReply {
+    uint32_t session;
+    uint32_t moves;
+    int16_t x2, z2;      // block position in half tiles
+    uint16_t tag;
+    uint8_t status;
+    uint8_t state;       // blockState
+    uint8_t level;
+    uint8_t bridge;
+    uint8_t pad[2];
+};
+
+#endif
@@ -0,0 +1,431 @@
+#include <bits/stdc++.h>
+#include <emmintrin.h>
+
+#include "jobs.h"
+#include "softrast.h"
+
+using namespace std;
+
+#define SOFT_TILE 32
+#define SOFT_ATTRIBUTES 6   // vertex color, model space position
+
+/* Triangle ready for the tiles : window space edge functions scaled so
+   they give the barycentric weights, and attributes divided by w */
+struct SoftTriangle {
+    float a[3], b[3], c[3];     // weight of vertex i : a*x + b*y + c
+    bool tie[3];                // pixel centers on edge i belong to this triangle
+    float z[3];                 // window depth, 0..1
+    float inv_w[3];
+    float attr[3][SOFT_ATTRIBUTES];
+    int type;
+    int minx, miny, maxx, maxy;
+};
+
+struct SoftRasterizer {
+    int width, height;
+    int depth_stride;           // rounded up to 4 floats, for the SSE loads
+    int tiles_x, tiles_y;
+    vector<unsigned int> color; // RGBA, bottom-up
+    vector<float> depth;
+    Mesh block, tile;
+    vector<SoftTriangle> triangles;
+    vector<vector<int> > bins;
+    unsigned int clear;
+    JobPool* pool;
+};
+
+/* Clip space vertex with its attributes */
+struct ClipVertex {
+    float p[4];
+    float attr[SOFT_ATTRIBUTES];
+};
+
+SoftRasterizer* softCreate (int width, int height, int threads)
+{
+    SoftRasterizer* r = new SoftRasterizer;
+    r->width = width;
+    r->height = height;
+    r->depth_stride = (width + 3) & ~3;
+    r->tiles_x = (width + SOFT_TILE - 1) / SOFT_TILE;
+    r->tiles_y = (height + SOFT_TILE - 1) / SOFT_TILE;
+    r->color.resize((size_t)width * height);
+    r->depth.resize((size_t)r->depth_stride * height);
+    r->bins.resize(r->tiles_x * r->tiles_y);
+    r->clear = 0;
+    r->pool = threads == 1 ? NULL : jobsCreate(threads);
+    return r;
+}
+
+void softDestroy (SoftRasterizer* r)
+{
+    if (r->pool)
+        jobsDestroy(r->pool);
+    delete r;
+}
+
+void softSetMeshes (SoftRasterizer* r, const Mesh& block, const Mesh& tile)
+{
+    r->block = block;
+    r->tile = tile;
+}
+
+const unsigned char* softPixels (const SoftRasterizer* r)
+{
+    return (const unsigned char*) &r->color[0];
+}
+
+int softWidth (const SoftRasterizer* r)
+{
+    return r->width;
+}
+
+int softHeight (const SoftRasterizer* r)
+{
+    return r->height;
+}
+
+/* Float color to a GL_RGBA8 texel, alpha 0 like the cleared window */
+static unsigned int packColor (float r, float g, float b)
+{
+    unsigned int c[3];
+    float v[3] = { r, g, b };
+    for (int i=0; i<3; i++)
+        c[i] = (unsigned int)(min(1.0f, max(0.0f, v[i])) * 255 + 0.5f);
+    return c[0] | c[1] << 8 | c[2] << 16;
+}
+
+/***********
+ * Shading *
+ ***********/
+
+static float smoothstep (float e0, float e1, float x)
+{
+    float t = min(1.0f, max(0.0f, (x - e0) / (e1 - e0)));
+    return t * t * (3 - 2*t);
+}
+
+static float sign (float x)
+{
+    return x > 0 ? 1 : (x < 0 ? -1 : 0);
+}
+
+/* Sample_GL.frag for the tiles, p is the model space position */
+static void shadeTile (int type, const float p[3], float out[3])
+{
+    const float half_size[3] = { 0.5f, 0.1f, 0.5f };
+
+    // the little flag on top of every tile
+    if (p[1] > half_size[1] + 0.001f) {
+        out[0] = out[1] = out[2] = (p[1] - half_size[1]) / 0.15f;
+        return;
+    }
+
+    float d[3];
+    for (int i=0; i<3; i++)
+        d[i] = half_size[i] - fabs(p[i]);
+
+    int face;
+    float uv[2], extent[2];
+    if (d[0] <= d[1] && d[0] <= d[2]) {
+        face = p[0] > 0 ? 0 : 1;
+        uv[0] = p[2]; uv[1] = p[1]; extent[0] = half_size[2]; extent[1] = half_size[1];
+    }
+    else if (d[1] <= d[2]) {
+        face = p[1] > 0 ? 2 : 3;
+        uv[0] = p[0]; uv[1] = p[2]; extent[0] = half_size[0]; extent[1] = half_size[2];
+    }
+    else {
+        face = p[2] > 0 ? 4 : 5;
+        uv[0] = p[0]; uv[1] = p[1]; extent[0] = half_size[0]; extent[1] = half_size[1];
+    }
+
+    static const float normal_faces[6][3] = {
+        {1, 0, 1}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {1, 1, 0}, {0, 1, 1},
+    };
+    float base[3];
+    if (type == TILE_FRAGILE) {
+        base[0] = 1; base[1] = 0.5f; base[2] = 0;
+    }
+    else if (type == TILE_BRIDGE || type == TILE_SWITCH) {
+        base[0] = 0.2f; base[1] = 0.2f; base[2] = 0;
+    }
+    else
+        memcpy(base, normal_faces[face], sizeof(base));
+
+    float edge[2] = { extent[0] - fabs(uv[0]), extent[1] - fabs(uv[1]) };
+    float dist = min(edge[0], edge[1]);
+
+    float bevel = 1 - smoothstep(0, 0.08f, dist);
+    float side = edge[0] < edge[1] ? sign(uv[0]) : -sign(uv[1]);
+    float highlight = 1 - smoothstep(0, 0.015f, dist);
+    for (int i=0; i<3; i++) {
+        base[i] *= 1 - 0.35f * bevel * side;
+        base[i] = base[i] * (1 - highlight) + highlight;
+    }
+
+    if (type == TILE_SWITCH && face == 2) {
+        float radius = sqrt(p[0]*p[0] + p[2]*p[2]);
+        if (radius > 0.2f && radius < 0.28f)
+            base[0] = base[1] = base[2] = 1;
+    }
+    memcpy(out, base, sizeof(base));
+}
+
+/*********
+ * Setup *
+ *********/
+
+static void transform (const Mat4& m, const float v[4], float out[4])
+{
+    for (int row=0; row<4; row++)
+        out[row] = m.m[row] * v[0] + m.m[4+row] * v[1] + m.m[8+row] * v[2] + m.m[12+row] * v[3];
+}
+
+static ClipVertex lerpVertex (const ClipVertex& a, const ClipVertex& b, float t)
+{
+    ClipVertex v;
+    for (int i=0; i<4; i++)
+        v.p[i] = a.p[i] + (b.p[i] - a.p[i]) * t;
+    for (int i=0; i<SOFT_ATTRIBUTES; i++)
+        v.attr[i] = a.attr[i] + (b.attr[i] - a.attr[i]) * t;
+    return v;
+}
+
+/* Window space triangle, skipped when it covers no pixel center */
+static void setupTriangle (SoftRasterizer* r, const ClipVertex* v[3], int type)
+{
+    SoftTriangle t;
+    float x[3], y[3];
+    for (int i=0; i<3; i++) {
+        float inv_w = 1 / v[i]->p[3];
+        x[i] = (v[i]->p[0] * inv_w + 1) * 0.5f * r->width;
+        y[i] = (v[i]->p[1] * inv_w + 1) * 0.5f * r->height;
+        t.z[i] = v[i]->p[2] * inv_w * 0.5f + 0.5f;
+        t.inv_w[i] = inv_w;
+        for (int k=0; k<SOFT_ATTRIBUTES; k++)
+            t.attr[i][k] = v[i]->attr[k] * inv_w;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0)
+        return;
+    // no culling in the GL state, both windings are drawn
+    for (int i=0; i<3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        float a = -(y[k] - y[j]), b = x[k] - x[j];
+        t.a[i] = a / area;
+        t.b[i] = b / area;
+        t.c[i] = -(a * x[j] + b * y[j]) / area;
+        // edges shared by two triangles go to the one on their left or bottom
+        float na = area > 0 ? a : -a, nb = area > 0 ? b : -b;
+        t.tie[i] = na > 0 || (na == 0 && nb > 0);
+    }
+
+    t.minx = max(0, (int)floor(min(x[0], min(x[1], x[2])) - 0.5f));
+    t.miny = max(0, (int)floor(min(y[0], min(y[1], y[2])) - 0.5f));
+    t.maxx = min(r->width - 1, (int)ceil(max(x[0], max(x[1], x[2])) - 0.5f));
+    t.maxy = min(r->height - 1, (int)ceil(max(y[0], max(y[1], y[2])) - 0.5f));
+    if (t.minx > t.maxx || t.miny > t.maxy)
+        return;
+    t.type = type;
+
+    int index = r->triangles.size();
+    r->triangles.push_back(t);
+    for (int ty=t.miny / SOFT_TILE; ty<=t.maxy / SOFT_TILE; ty++)
+        for (int tx=t.minx / SOFT_TILE; tx<=t.maxx / SOFT_TILE; tx++)
+            r->bins[ty * r->tiles_x + tx].push_back(index);
+}
+
+/* Clips against the near plane (z >= -w) and sets up what is left */
+static void clipTriangle (SoftRasterizer* r, const ClipVertex in[3], int type)
+{
+    ClipVertex out[4];
+    int count = 0;
+    for (int i=0; i<3; i++) {
+        const ClipVertex& a = in[i];
+        const ClipVertex& b = in[(i + 1) % 3];
+        float da = a.p[2] + a.p[3], db = b.p[2] + b.p[3];
+        if (da >= 0)
+            out[count++] = a;
+        if ((da >= 0) != (db >= 0))
+            out[count++] = lerpVertex(a, b, da / (da - db));
+    }
+    for (int i=1; i+1<count; i++) {
+        const ClipVertex* v[3] = { &out[0], &out[i], &out[i+1] };
+        setupTriangle(r, v, type);
+    }
+}
+
+static void submitMesh (SoftRasterizer* r, const Mesh& mesh, const SceneInstance& instance, const Mat4& vp)
+{
+    Mat4 model;
+    memcpy(model.m, instance.model, sizeof(model.m));
+    Mat4 mvp = matMultiply(vp, model);
+    int type = (int)(instance.type + 0.5f);
+
+    size_t count = mesh.vertices.size() / 3;
+    for (size_t i=0; i+2<count; i+=3) {
+        ClipVertex v[3];
+        for (int k=0; k<3; k++) {
+            const float* p = &mesh.vertices[(i+k)*3];
+            float position[4] = { p[0], p[1], p[2], 1 };
+            transform(mvp, position, v[k].p);
+            for (int c=0; c<3; c++)
+                v[k].attr[c] = mesh.colors.empty() ? 0 : mesh.colors[(i+k)*3 + c];
+            memcpy(v[k].attr + 3, p, 3 * sizeof(float));
+        }
+        clipTriangle(r, v, type);
+    }
+}
+
+/**********
+ * Raster *
+ **********/
+
+static void rasterTriangle (SoftRasterizer* r, const SoftTriangle& t, int x0, int y0, int x1, int y1)
+{
+    int minx = max(t.minx, x0) & ~3, maxx = min(t.maxx, x1);
+    int miny = max(t.miny, y0), maxy = min(t.maxy, y1);
+
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 a[3], b[3], c[3], z[3];
+    for (int i=0; i<3; i++) {
+        a[i] = _mm_set1_ps(t.a[i]);
+        b[i] = _mm_set1_ps(t.b[i]);
+        c[i] = _mm_set1_ps(t.c[i]);
+        z[i] = _mm_set1_ps(t.z[i]);
+    }
+
+    for (int y=miny; y<=maxy; y++) {
+        __m128 py = _mm_set1_ps(y + 0.5f);
+        float* depth_row = &r->depth[(size_t)y * r->depth_stride];
+        unsigned int* color_row = &r->color[(size_t)y * r->width];
+
+        for (int x=minx; x<=maxx; x+=4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(x), lane);
+            __m128 w[3];
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int i=0; i<3; i++) {
+                w[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[i], px), _mm_mul_ps(b[i], py)), c[i]);
+                inside = _mm_and_ps(inside, t.tie[i] ? _mm_cmpge_ps(w[i], zero) : _mm_cmpgt_ps(w[i], zero));
+            }
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+
+            // screen space depth, tested like GL_LEQUAL and clipped at the far plane
+            __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w[0], z[0]), _mm_mul_ps(w[1], z[1])), _mm_mul_ps(w[2], z[2]));
+            __m128 old = _mm_loadu_ps(depth_row + x);
+            __m128 pass = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(depth, old), _mm_cmple_ps(depth, one)));
+            int mask = _mm_movemask_ps(pass);
+            // lanes past the end of the triangle box, the other tile owns them
+            mask &= (1 << min(4, maxx - x + 1)) - 1;
+            if (mask == 0)
+                continue;
+            __m128 keep = _mm_castsi128_ps(_mm_setr_epi32(mask & 1 ? -1 : 0, mask & 2 ? -1 : 0, mask & 4 ? -1 : 0, mask & 8 ? -1 : 0));
+            _mm_storeu_ps(depth_row + x, _mm_or_ps(_mm_and_ps(keep, depth), _mm_andnot_ps(keep, old)));
+
+            float wl[3][4];
+            for (int i=0; i<3; i++)
+                _mm_storeu_ps(wl[i], w[i]);
+            for (int l=0; l<4; l++) {
+                if (!(mask & (1 << l)))
+                    continue;
+                // perspective correct attributes
+                float q = wl[0][l] * t.inv_w[0] + wl[1][l] * t.inv_w[1] + wl[2][l] * t.inv_w[2];
+                float attr[SOFT_ATTRIBUTES];
+                for (int k=0; k<SOFT_ATTRIBUTES; k++)
+                    attr[k] = (wl[0][l] * t.attr[0][k] + wl[1][l] * t.attr[1][k] + wl[2][l] * t.attr[2][k]) / q;
+
+                float rgb[3];
+                if (t.type == 0)
+                    memcpy(rgb, attr, sizeof(rgb));
+                else
+                    shadeTile(t.type, attr + 3, rgb);
+                color_row[x + l] = packColor(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+    }
+}
+
+/* Clears one tile and draws its bin in submission order */
+static void rasterTile (SoftRasterizer* r, int tx, int ty)
+{
+    int x0 = tx * SOFT_TILE, y0 = ty * SOFT_TILE;
+    int x1 = min(r->width, x0 + SOFT_TILE) - 1, y1 = min(r->height, y0 + SOFT_TILE) - 1;
+    for (int y=y0; y<=y1; y++) {
+        fill(&r->color[(size_t)y * r->width + x0], &r->color[(size_t)y * r->width + x1 + 1], r->clear);
+        fill(&r->depth[(size_t)y * r->depth_stride + x0], &r->depth[(size_t)y * r->depth_stride + x1 + 1], 1.0f);
+    }
+
+    const vector<int>& bin = r->bins[ty * r->tiles_x + tx];
+    for (size_t i=0; i<bin.size(); i++)
+        rasterTriangle(r, r->triangles[bin[i]], x0, y0, x1, y1);
+}
+
+/* One pixel wide DDA lines, depth tested, after the triangles */
+static void rasterLine (SoftRasterizer* r, const SceneLine& line, const Mat4& vp)
+{
+    ClipVertex v[2];
+    float from[4] = { line.from[0], line.from[1], line.from[2], 1 };
+    float to[4] = { line.to[0], line.to[1], line.to[2], 1 };
+    transform(vp, from, v[0].p);
+    transform(vp, to, v[1].p);
+
+    float da = v[0].p[2] + v[0].p[3], db = v[1].p[2] + v[1].p[3];
+    if (da < 0 && db < 0)
+        return;
+    if (da < 0)
+        v[0] = lerpVertex(v[0], v[1], da / (da - db));
+    else if (db < 0)
+        v[1] = lerpVertex(v[0], v[1], da / (da - db));
+
+    float x[2], y[2], z[2];
+    for (int i=0; i<2; i++) {
+        x[i] = (v[i].p[0] / v[i].p[3] + 1) * 0.5f * r->width;
+        y[i] = (v[i].p[1] / v[i].p[3] + 1) * 0.5f * r->height;
+        z[i] = v[i].p[2] / v[i].p[3] * 0.5f + 0.5f;
+    }
+
+    unsigned int color = packColor(line.color[0], line.color[1], line.color[2]);
+    int steps = (int)ceil(max(fabs(x[1] - x[0]), fabs(y[1] - y[0])));
+    for (int s=0; s<=steps; s++) {
+        float t = steps ? (float)s / steps : 0;
+        int px = (int)floor(x[0] + (x[1] - x[0]) * t);
+        int py = (int)floor(y[0] + (y[1] - y[0]) * t);
+        if (px < 0 || py < 0 || px >= r->width || py >= r->height)
+            continue;
+        float depth = z[0] + (z[1] - z[0]) * t;
+        float& d = r->depth[(size_t)py * r->depth_stride + px];
+        if (depth <= d && depth <= 1) {
+            d = depth;
+            r->color[(size_t)py * r->width + px] = color;
+        }
+    }
+}
+
+void softRender (SoftRasterizer* r, const Scene& scene)
+{
+    r->clear = packColor(scene.clear_color[0], scene.clear_color[1], scene.clear_color[2]);
+
+    r->triangles.clear();
+    for (size_t i=0; i<r->bins.size(); i++)
+        r->bins[i].clear();
+
+    submitMesh(r, r->block, scene.block, scene.view_projection);
+    for (size_t i=0; i<scene.tiles.size(); i++)
+        submitMesh(r, r->tile, scene.tiles[i], scene.view_projection);
+
+    for (int ty=0; ty<r->tiles_y; ty++)
+        for (int tx=0; tx<r->tiles_x; tx++) {
+            if (r->pool)
+                jobsSubmit(r->pool, [r, tx, ty] { rasterTile(r, tx, ty); });
+            else
+                rasterTile(r, tx, ty);
+        }
+    if (r->pool)
+        jobsWait(r->pool);
+
+    for (size_t i=0; i<scene.lines.size(); i++)
+        rasterLine(r, scene.lines[i], scene.view_projection);
+}
@@ -0,0 +1,28 @@
+#ifndef SOFTRAST_H
+#define SOFTRAST_H
+
+#include "scene.h"
+
+/* CPU renderer for the Scene, for machines without a GPU (CI, thin
+   clients). Triangles are clipped to the near plane, binned into 32x32
+   screen tiles, and each tile is rasterized on the job pool with SSE edge
+   functions and a depth buffer. The tile shading of Sample_GL.frag is
+   ported to C++ so the frames match the GL ones up to edge rounding. */
+
+struct SoftRasterizer;
+
+/* threads <= 0 uses every core, 1 renders on the calling thread */
+SoftRasterizer* softCreate (int width, int height, int threads);
+void softDestroy (SoftRasterizer* r);
+
+/* The models drawn for scene.block and scene.tiles */
+void softSetMeshes (SoftRasterizer* r, const Mesh& block, const Mesh& tile);
+
+void softRender (SoftRasterizer* r, const Scene& scene);
+
+/* Bottom-up RGBA pixels of the last frame, laid out like glReadPixels */
+const unsigned char* softPixels (const SoftRasterizer* r);
+int softWidth (const SoftRasterizer* r);
+int softHeight (const SoftRasterizer* r);
+
+#endif
@@ -0,0 +1,281 @@
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+
+using namespace std;
+
+long long stat_counters[STAT_COUNTERS];
+long long last_frame_counters[STAT_COUNTERS];
+RollingHistogram frame_ms_history, sim_ms_history;
+
+static const char* counter_names[STAT_COUNTERS] = {
+    "draw_calls", "uniform_uploads", "buffer_bytes", "stream_bytes", "vao_binds",
+};
+
+/* Per second totals and maxima of the counters */
+static long long second_totals[STAT_COUNTERS], second_max[STAT_COUNTERS];
+static int second_frames = 0;
+static double second_start = -1;
+
+/* Frame time buckets (ms) of the histogram in the report */
+static const float frame_buckets[] = { 4, 8, 12, 16.7f, 20, 33.3f, 50, 100 };
+#define FRAME_BUCKETS (int)(sizeof(frame_buckets)/sizeof(frame_buckets[0]))
+
+static const char* latency_names[LATENCY_STAGES] = { "apply", "submit", "present" };
+
+struct LatencyHistogram {
+    long long counts[LATENCY_BUCKETS];
+    long long count;
+    double sum, maximum;
+};
+static LatencyHistogram latency[LATENCY_STAGES];
+
+static FILE* stats_file = NULL;
+static int stats_listener = -1;
+static vector<int> stats_clients;
+static string stats_socket_path;
+
+void histogramAdd (RollingHistogram& h, float value)
+{
+    h.samples[h.next] = value;
+    h.next = (h.next + 1) % STAT_HISTORY;
+    if (h.count < STAT_HISTORY)
+        h.count++;
+}
+
+float histogramPercentile (const RollingHistogram& h, float p)
+{
+    if (h.count == 0)
+        return 0;
+    float sorted[STAT_HISTORY];
+    copy(h.samples, h.samples + h.count, sorted);
+    int k = min(h.count - 1, (int)(p * h.count));
+    nth_element(sorted, sorted + k, sorted + h.count);
+    return sorted[k];
+}
+
+float histogramRecent (const RollingHistogram& h, int i)
+{
+    if (i >= h.count)
+        return 0;
+    return h.samples[(h.next - 1 - i + 2*STAT_HISTORY) % STAT_HISTORY];
+}
+
+bool statsOpenOutput (const char* path)
+{
+    if (strncmp(path, "unix:", 5) != 0) {
+        stats_file = fopen(path, "a");
+        if (stats_file == NULL) {
+            fprintf(stderr, "stats : cannot open %s\n", path);
+            return false;
+        }
+        return true;
+    }
+
+    stats_socket_path = path + 5;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (stats_socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "stats : socket path too long\n");
+        return false;
+    }
+    strcpy(addr.sun_path, stats_socket_path.c_str());
+    unlink(addr.sun_path);
+
+    stats_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (stats_listener < 0 || bind(stats_listener, (struct sockaddr*)&addr, sizeof(addr)) < 0
+        || listen(stats_listener, 16) < 0) {
+        fprintf(stderr, "stats : cannot listen on %s : %s\n", addr.sun_path, strerror(errno));
+        if (stats_listener >= 0)
+            close(stats_listener);
+        stats_listener = -1;
+        return false;
+    }
+    return true;
+}
+
+void statsCloseOutput ()
+{
+    if (stats_file != NULL)
+        fclose(stats_file);
+    stats_file = NULL;
+    for (size_t i=0; i<stats_clients.size(); i++)
+        close(stats_clients[i]);
+    stats_clients.clear();
+    if (stats_listener >= 0) {
+        close(stats_listener);
+        unlink(stats_socket_path.c_str());
+    }
+    stats_listener = -1;
+}
+
+static void appendHistogram (string& out, const char* name, const RollingHistogram& h)
+{
+    char buf[256];
+    float maximum = 0;
+    for (int i=0; i<h.count; i++)
+        maximum = max(maximum, h.samples[i]);
+    snprintf(buf, sizeof(buf), ",\"%s\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f,\"hist\":[",
+             name, histogramPercentile(h, 0.5f), histogramPercentile(h, 0.9f), histogramPercentile(h, 0.99f), maximum);
+    out += buf;
+
+    // counts per bucket, the last one is everything above the last edge
+    int counts[FRAME_BUCKETS + 1] = {};
+    for (int i=0; i<h.count; i++) {
+        int b = 0;
+        while (b < FRAME_BUCKETS && h.samples[i] > frame_buckets[b])
+            b++;
+        counts[b]++;
+    }
+    for (int b=0; b<=FRAME_BUCKETS; b++) {
+        snprintf(buf, sizeof(buf), "%s%d", b ? "," : "", counts[b]);
+        out += buf;
+    }
+    out += "]}";
+}
+
+void latencyAdd (int stage, double ms)
+{
+    LatencyHistogram& h = latency[stage];
+    int b = min(LATENCY_BUCKETS - 1, max(0, (int)(ms / LATENCY_BUCKET_MS)));
+    h.counts[b]++;
+    h.count++;
+    h.sum += ms;
+    h.maximum = max(h.maximum, ms);
+}
+
+double latencyPercentile (int stage, double p)
+{
+    const LatencyHistogram& h = latency[stage];
+    if (h.count == 0)
+        return 0;
+    long long rank = min(h.count - 1, (long long)(p * h.count));
+    long long seen = 0;
+    for (int b=0; b<LATENCY_BUCKETS; b++) {
+        seen += h.counts[b];
+        if (seen > rank)
+            return b == LATENCY_BUCKETS - 1 ? h.maximum : min(h.maximum, (b + 1) * LATENCY_BUCKET_MS);
+    }
+    return h.maximum;
+}
+
+long long latencyCount (int stage)
+{
+    return latency[stage].count;
+}
+
+static void appendLatency (string& out, bool buckets)
+{
+    char buf[256];
+    out += ",\"latency\":{";
+    for (int s=0; s<LATENCY_STAGES; s++) {
+        const LatencyHistogram& h = latency[s];
+        snprintf(buf, sizeof(buf), "%s\"%s\":{\"count\":%lld,\"mean\":%.3f,\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f",
+                 s ? "," : "", latency_names[s], h.count, h.count ? h.sum / h.count : 0.0,
+                 latencyPercentile(s, 0.5), latencyPercentile(s, 0.99), h.maximum);
+        out += buf;
+        if (buckets) {
+            // [upper edge in ms, count] of the buckets that were hit
+            out += ",\"buckets\":[";
+            bool first = true;
+            for (int b=0; b<LATENCY_BUCKETS; b++) {
+                if (h.counts[b] == 0)
+                    continue;
+                snprintf(buf, sizeof(buf), "%s[%.2f,%lld]", first ? "" : ",", (b + 1) * LATENCY_BUCKET_MS, h.counts[b]);
+                out += buf;
+                first = false;
+            }
+            out += "]";
+        }
+        out += "}";
+    }
+    out += "}";
+}
+
+bool latencyExport (const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "stats : cannot write %s\n", path);
+        return false;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"bucket_ms\":%.2f", LATENCY_BUCKET_MS);
+    string out = buf;
+    appendLatency(out, true);
+    out += "}\n";
+    fputs(out.c_str(), f);
+    fclose(f);
+    return true;
+}
+
+static void publish (double now)
+{
+    if (stats_file == NULL && stats_listener < 0)
+        return;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"time\":%.3f,\"frames\":%d", now, second_frames);
+    string line = buf;
+    for (int c=0; c<STAT_COUNTERS; c++) {
+        snprintf(buf, sizeof(buf), ",\"%s\":{\"avg\":%.1f,\"max\":%lld}", counter_names[c],
+                 (double)second_totals[c] / max(1, second_frames), second_max[c]);
+        line += buf;
+    }
+    appendHistogram(line, "frame_ms", frame_ms_history);
+    appendHistogram(line, "sim_ms", sim_ms_history);
+    appendLatency(line, false);
+    line += "}\n";
+
+    if (stats_file != NULL) {
+        fputs(line.c_str(), stats_file);
+        fflush(stats_file);
+        return;
+    }
+
+    // accept whoever connected since the last report, drop the ones that left or lag
+    int fd;
+    while ((fd = accept4(stats_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        stats_clients.push_back(fd);
+    for (size_t i=0; i<stats_clients.size(); ) {
+        if (send(stats_clients[i], line.data(), line.size(), MSG_NOSIGNAL) != (ssize_t)line.size()) {
+            close(stats_clients[i]);
+            stats_clients.erase(stats_clients.begin() + i);
+        }
+        else
+            i++;
+    }
+}
+
+void statsSimTick (double sim_ms)
+{
+    histogramAdd(sim_ms_history, sim_ms);
+}
+
+void statsEndFrame (double frame_ms, double now)
+{
+    histogramAdd(frame_ms_history, frame_ms);
+
+    for (int c=0; c<STAT_COUNTERS; c++) {
+        last_frame_counters[c] = stat_counters[c];
+        second_totals[c] += stat_counters[c];
+        second_max[c] = max(second_max[c], stat_counters[c]);
+        stat_counters[c] = 0;
+    }
+    second_frames++;
+
+    if (second_start < 0)
+        second_start = now;
+    if (now - second_start >= 1.0) {
+        publish(now);
+        second_start = now;
+        second_frames = 0;
+        memset(second_totals, 0, sizeof(second_totals));
+        memset(second_max, 0, sizeof(second_max));
+    }
+}
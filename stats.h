@@ -0,0 +1,74 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* Rendering health counters : the renderer bumps the counters while it
+   works, statsEndFrame() closes the frame, keeps rolling histories and
+   once a second publishes a JSON line to a file or a Unix socket. */
+
+enum StatCounter {
+    STAT_DRAW_CALLS,       // draw3DObject and instanced draws
+    STAT_UNIFORM_UPLOADS,  // glUniformMatrix4fv
+    STAT_BUFFER_BYTES,     // glBufferData in create3DObject
+    STAT_STREAM_BYTES,     // per-frame data written to the stream buffer
+    STAT_VAO_BINDS,
+    STAT_COUNTERS
+};
+
+/* Counters of the frame being drawn */
+extern long long stat_counters[STAT_COUNTERS];
+
+inline void statAdd (int counter, long long n = 1)
+{
+    stat_counters[counter] += n;
+}
+
+/* Last STAT_HISTORY samples of a value, for percentiles and histograms */
+#define STAT_HISTORY 256
+
+struct RollingHistogram {
+    float samples[STAT_HISTORY];
+    int next, count;
+};
+
+void histogramAdd (RollingHistogram& h, float value);
+/* p in [0,1], 0 when empty */
+float histogramPercentile (const RollingHistogram& h, float p);
+/* i-th most recent sample, 0 is the last one */
+float histogramRecent (const RollingHistogram& h, int i);
+
+extern RollingHistogram frame_ms_history, sim_ms_history;
+/* Counters of the last finished frame */
+extern long long last_frame_counters[STAT_COUNTERS];
+
+/* Publishes to path, or to a listening Unix socket when it starts with "unix:" */
+bool statsOpenOutput (const char* path);
+void statsCloseOutput ();
+
+/* Records the time of one simulation tick, whether a frame showed it or not */
+void statsSimTick (double sim_ms);
+/* Closes the frame : frame_ms is the whole frame */
+/* now is the time in seconds, used for the once a second report */
+void statsEndFrame (double frame_ms, double now);
+
+/* Input latency : how long after the key event a move is applied by the
+   tick, submitted with the frame, and done by the GPU after the swap.
+   Unlike the rolling histories these keep the whole session, in fixed
+   LATENCY_BUCKET_MS buckets. */
+enum LatencyStage {
+    LATENCY_APPLY,    // key event -> moveBlock()
+    LATENCY_SUBMIT,   // key event -> frame submitted, before the swap
+    LATENCY_PRESENT,  // key event -> GPU past the swap
+    LATENCY_STAGES
+};
+
+#define LATENCY_BUCKET_MS 0.25
+#define LATENCY_BUCKETS 1000   // up to 250 ms, the last bucket also counts everything above
+
+void latencyAdd (int stage, double ms);
+/* p in [0,1], the upper edge of the bucket, 0 when empty */
+double latencyPercentile (int stage, double p);
+long long latencyCount (int stage);
+/* Writes the summary and the non-empty buckets as JSON */
+bool latencyExport (const char* path);
+
+#endif
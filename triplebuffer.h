@@ -0,0 +1,54 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+/* Lock-free triple buffer between one writer and one reader thread. The
+   writer fills the back slot and swaps it with the middle one, the reader
+   swaps the middle slot with its front one when it holds something newer.
+   Neither side ever waits : the writer may overwrite a value the reader
+   never saw, the reader keeps its last value until a newer one arrives.
+   The slots are reused, so vectors inside T keep their capacity. */
+
+#define TRIPLE_FRESH 4   // set in middle when it holds a value the reader has not taken
+
+template <class T>
+struct TripleBuffer {
+    T slots[3];
+    int back = 0;                     // writer only
+    int front = 2;                    // reader only
+    std::atomic<int> middle { 1 };    // slot index | TRIPLE_FRESH
+};
+
+/* Slot the writer fills, valid until triplePublish */
+template <class T>
+T& tripleBack (TripleBuffer<T>& b)
+{
+    return b.slots[b.back];
+}
+
+/* Hands the back slot to the reader */
+template <class T>
+void triplePublish (TripleBuffer<T>& b)
+{
+    b.back = b.middle.exchange(b.back | TRIPLE_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+/* Takes the newest published slot, false when there is nothing new */
+template <class T>
+bool tripleAcquire (TripleBuffer<T>& b)
+{
+    if (!(b.middle.load(std::memory_order_relaxed) & TRIPLE_FRESH))
+        return false;
+    b.front = b.middle.exchange(b.front, std::memory_order_acq_rel) & 3;
+    return true;
+}
+
+/* Slot the reader owns, the last one tripleAcquire took */
+template <class T>
+const T& tripleFront (const TripleBuffer<T>& b)
+{
+    return b.slots[b.front];
+}
+
+#endif